@@ -0,0 +1,54 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Raw block storage used by dataManager for the outgoing ring buffer.
+ *
+ * Blocks are always BLOCK_DEVICE_BLOCK_SIZE bytes. Implementations are
+ * expected to serialize access to any bus they share with other peripherals.
+ */
+#define BLOCK_DEVICE_BLOCK_SIZE     (512)
+
+class blockDevice {
+  public: virtual ~blockDevice() {}
+
+  public: virtual bool begin() = 0;
+
+  public: virtual const char * name() = 0;
+
+  public: virtual uint32_t blockCount() = 0;
+
+  public: virtual bool readBlock(uint32_t block, uint8_t * dst) = 0;
+
+  public: virtual bool writeBlock(uint32_t block, const uint8_t * src) = 0;
+
+  public: virtual bool readBlocks(uint32_t block, uint8_t * dst, size_t count) {
+    for(size_t b=0; b<count; b++) {
+      if(!this->readBlock(block + b, dst + b * BLOCK_DEVICE_BLOCK_SIZE)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  public: virtual bool writeBlocks(uint32_t block, const uint8_t * src, size_t count) {
+    for(size_t b=0; b<count; b++) {
+      if(!this->writeBlock(block + b, src + b * BLOCK_DEVICE_BLOCK_SIZE)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // Erase blocks first..last (inclusive). Devices without erase support report false.
+  public: virtual bool erase(uint32_t, uint32_t) {
+    return false;
+  }
+
+};
@@ -0,0 +1,83 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define BLOCK_HEADER_MAGIC          (0xB7)
+
+// Source queue of a block's payload
+#define BLOCK_QUEUE_HOST            (0)
+#define BLOCK_QUEUE_RELAY           (1) // linkRelay store slots
+
+/**
+ * Header at the start of every backlog block, so a block read back from
+ * the ring describes itself: stored blocks can be partial and binary, and
+ * a block that was never written or was torn is recognised by its CRC.
+ */
+struct __attribute__((packed)) blockHeader {
+  uint8_t magic;
+  uint8_t queue;            // BLOCK_QUEUE_*
+  uint16_t length;          // valid payload bytes after the header
+  uint32_t sequence;        // ingest order, keeps counting across ring wraps
+  uint32_t timestamp;       // millis() when the first payload byte arrived
+  uint32_t crc;             // CRC-32 of the header (crc = 0) and the valid payload
+
+  // Fill in the header of a block whose payload is already in place
+  void seal(uint8_t * block) {
+    this->magic = BLOCK_HEADER_MAGIC;
+    this->crc = 0;
+
+    memcpy(block, this, sizeof(blockHeader));
+
+    this->crc = blockHeader::checksum(block, sizeof(blockHeader) + this->length);
+
+    memcpy(block, this, sizeof(blockHeader));
+  }
+
+  // Header of a stored block; false if the block is not one we wrote intact
+  static bool read(const uint8_t * block, size_t capacity, blockHeader &header) {
+    uint8_t copy[sizeof(blockHeader)];
+    uint32_t crc;
+
+    memcpy(&header, block, sizeof(blockHeader));
+
+    if(header.magic != BLOCK_HEADER_MAGIC || sizeof(blockHeader) + header.length > capacity) {
+      return false;
+    }
+
+    memcpy(copy, block, sizeof(blockHeader));
+    memset(copy + offsetof(blockHeader, crc), 0, sizeof(header.crc));
+
+    crc = blockHeader::update(0xFFFFFFFF, copy, sizeof(copy));
+    crc = blockHeader::update(crc, block + sizeof(blockHeader), header.length);
+
+    return ~crc == header.crc;
+  }
+
+  static uint32_t checksum(const uint8_t * data, size_t length) {
+    return ~blockHeader::update(0xFFFFFFFF, data, length);
+  }
+
+  // CRC-32 (IEEE, reflected), a nibble at a time to keep the table small
+  static uint32_t update(uint32_t crc, const uint8_t * data, size_t length) {
+    static const uint32_t table[16] = {
+      0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+      0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+
+    for(size_t n=0; n<length; n++) {
+      crc ^= data[n];
+      crc = (crc >> 4) ^ table[crc & 0x0F];
+      crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+
+    return crc;
+  }
+};
+
+#define BLOCK_HEADER_BYTES          (sizeof(blockHeader))
+
+static_assert(sizeof(blockHeader) == 16, "block header layout changed");
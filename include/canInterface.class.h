@@ -1,8 +1,8 @@
-using namespace std;
-
-#pragma once
-
-class canInterface {
-  // not implemented yet.
-  
-};
+using namespace std;
+
+#pragma once
+
+class canInterface {
+  // not implemented yet.
+  
+};
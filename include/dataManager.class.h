@@ -1,199 +1,967 @@
-using namespace std;
-
-#pragma once
-
-#include <string.h>
-#include "definitions.h"
-#include <MD5Builder.h>
-#include <EEPROM.h>
-
-#define BUFFER_BLOCK_SIZE_BYTES   (512)
-#define BUFFER_OUTGOING_START     (300)
-#define BUFFER_MAX_SIZE_BLOCKS    (8000000)
-
-MD5Builder _md5;
-
-const size_t buffer_length = BUFFER_BLOCK_SIZE_BYTES;
-const size_t buffer_length_excess = 768;
-
-// PIN definitions
-#define SDCS_PIN 14
-
-class dataManager {
-  private: SdFat uSD;
-
-  // outgoing block buffer
-  private: uint8_t _block1[buffer_length_excess];
-  public: uint8_t _block2[buffer_length_excess];
-
-  // buffer for SD card operations
-  private: uint8_t _exchange[buffer_length_excess];
-
-  // outgoing block pointers
-  public: const uint32_t outgoingBlockStart = BUFFER_OUTGOING_START;
-  public: uint32_t outgoingBlockPointer = BUFFER_OUTGOING_START;
-  public: size_t outgoingBytePointer = 0;
-
-  public: void initialize(SdFat &uSD) {
-    this->uSD = uSD;
-
-    SPI_OP_BEGIN();
-
-    while(!this->uSD.cardBegin(SDCS_PIN, SD_SCK_MHZ(20))) {
-      Serial.println(PROGMEM "uSD card failed to initialize. Trying again");
-      ring(5, 2, 50);
-
-      delay(1000);
-    }
-
-    long blocks = this->uSD.card()->cardCapacity();
-
-    SPI_OP_END();
-
-    Serial.println(PROGMEM "uSD card initialized with total size of " + (String) blocks + " blocks");
-  }
-
-  public: uint64_t bufferSize() {
-    return (uint64_t) BUFFER_MAX_SIZE_BLOCKS * (uint64_t) BUFFER_BLOCK_SIZE_BYTES;
-  }
-
-  public: uint64_t outgoingBufferLength() {
-    return (this->outgoingBlockPointer - BUFFER_OUTGOING_START) * BUFFER_BLOCK_SIZE_BYTES
-      + this->outgoingBytePointer;
-  }
-
-  public: uint16_t outgoingBufferBlockCount() {
-    return (this->outgoingBlockPointer - BUFFER_OUTGOING_START);
-  }
-
-  public: void outgoingBufferFlush() {
-    this->outgoingBlockPointer = this->outgoingBlockStart;
-    
-    this->frontBufferFlush();
-  }
-
-  public: void frontBufferFlush() {
-    this->outgoingBytePointer = 0;
-
-    memset(this->_block1, 0, (size_t) BUFFER_BLOCK_SIZE_BYTES);
-  }
-
-  public: uint8_t * returnOutgoingBlock(uint32_t block) {
-    uint32_t uSD_block_count = this->outgoingBufferBlockCount();
-
-    if(block <= (this->outgoingBlockStart + uSD_block_count)) {
-      SPI_OP_BEGIN();
-
-      #ifdef DEBUG
-      Serial.print(PROGMEM "Reading block: ");
-      Serial.println(block);
-      #endif
-
-      this->uSD.card()->readBlock(block, this->_block2);
-      SPI_OP_END();
-
-      return this->_block2;
-    }
-
-    return this->returnOutgoingDataExcess();
-  }
-
-  public: uint8_t * returnOutgoingDataExcess() {
-    return this->_block1;
-  }
-
-  private: uint32_t returnOutgoingBlockPointer() {
-    this->outgoingBlockPointer++;
-    
-    if(this->outgoingBlockPointer > (this->outgoingBlockStart + BUFFER_MAX_SIZE_BLOCKS)) {
-      this->outgoingBlockPointer = this->outgoingBlockStart;
-    }
-
-    return this->outgoingBlockPointer;
-  }
-
-  public: void outgoingBufferPush(char data) {
-    uint32_t pointer;
-    size_t buffer_len = BUFFER_BLOCK_SIZE_BYTES;
-
-    bool match = false;
-
-    #ifdef DEBUG
-    bool last_matched = true;
-    #endif
-    
-    memset(this->_exchange, 0, buffer_len);
-
-    this->_block1[this->outgoingBytePointer++] = (uint8_t) data;
-
-    if(this->outgoingBytePointer >= buffer_len) {
-      match = false;
-
-      pointer = this->returnOutgoingBlockPointer();
-
-      while(!match) {
-        SPI_OP_BEGIN();
-        this->uSD.card()->writeBlock(pointer, this->_block1);
-        this->uSD.card()->readBlock(pointer, this->_exchange);
-        SPI_OP_END();
-
-        this->_exchange[buffer_len] = (uint8_t) 0;
-
-        match = this->md5((char*) this->_exchange).toString() == this->md5((char*) this->_block1).toString();
-
-        #ifdef DEBUG
-        // Serial.print(PROGMEM "Push _block1: ");
-        // Serial.println(this->md5((char*) this->_block1).toString());
-        // Serial.print(PROGMEM "Push _exchange: ");
-        // Serial.println(this->md5((char*) this->_exchange).toString());
-        Serial.print(match ? (last_matched ? '+' : '*') : '!');
-        last_matched = match;
-        #endif
-
-        if(!match) {
-          delay(100);
-        }
-      }
-
-      this->outgoingBytePointer = 0;
-
-      memset(this->_block1, 0, buffer_len);
-    }
-  }
-
-  public: void reportOutgoingBufferStats() {
-    Serial.println(PROGMEM "outgoingBytePointer: " + (String) this->outgoingBytePointer);
-    Serial.println(PROGMEM "outgoingBlockPointer: " + (String) this->outgoingBlockPointer);
-
-    Serial.print(PROGMEM "buffer length: ");
-    print_uint64_t(Serial, this->outgoingBufferLength());
-    Serial.println();
-  }
-
-  public: void copy(uint8_t* src, uint8_t* dst, int len) {
-    memcpy(dst, src, sizeof(src[0])*len);
-  }
-
-  public: MD5Builder md5(char * data) {
-    _md5.begin();
-    _md5.add(data);
-    _md5.calculate();
-
-    return _md5;
-  }
-
-  public: String midString(String str, String start, String finish){
-    int locStart = str.indexOf(start);
-
-    if (locStart==-1) return "";
-
-    locStart += start.length();
-
-    int locFinish = str.indexOf(finish, locStart);
-
-    if (locFinish==-1) return "";
-
-    return str.substring(locStart, locFinish);
-  }
-
-};
+using namespace std;
+
+#pragma once
+
+#include <string.h>
+#include "definitions.h"
+#include "events.h"
+#include "blockDevice.class.h"
+#include "latencyHistogram.class.h"
+#include "blockHeader.class.h"
+#include <EEPROM.h>
+
+#define BUFFER_BLOCK_SIZE_BYTES   (512)
+#define BUFFER_BLOCK_PAYLOAD_BYTES (BUFFER_BLOCK_SIZE_BYTES - BLOCK_HEADER_BYTES)
+#define BUFFER_OUTGOING_START     (300)
+#define BUFFER_MAX_SIZE_BLOCKS    (8000000)
+
+// Read-ahead cache for the transmit backlog (blocks)
+#ifndef PREFETCH_CACHE_BLOCKS
+#define PREFETCH_CACHE_BLOCKS     (8)
+#endif
+
+#define PREFETCH_EMPTY_SLOT       (0)
+
+// Ring buffer full policies
+#define BUFFER_FULL_BLOCK         (0) // refuse new data until blocks are transmitted
+#define BUFFER_FULL_DROP_OLDEST   (1) // discard the oldest untransmitted block
+#define BUFFER_FULL_DROP_NEWEST   (2) // discard the block being committed
+
+#ifndef BUFFER_FULL_POLICY
+#define BUFFER_FULL_POLICY        BUFFER_FULL_BLOCK
+#endif
+
+// Completed blocks queued between UART ingest and the SD writer stage
+#ifndef SD_WRITE_QUEUE_BLOCKS
+#define SD_WRITE_QUEUE_BLOCKS     (8)
+#endif
+
+// Write and read-back rounds before a block is given up; its header CRC then drops it on the way out
+#ifndef SD_WRITE_ATTEMPTS
+#define SD_WRITE_ATTEMPTS         (10)
+#endif
+
+// Outcome of reserving a ring position for a completed block
+#define COMMIT_REFUSED            (0)
+#define COMMIT_STORE              (1)
+#define COMMIT_DISCARD            (2)
+
+// Background erase of sent ring ranges: blocks per pass, aligned to a multiple of it
+#ifndef ERASE_BATCH_BLOCKS
+#define ERASE_BATCH_BLOCKS        (2048)
+#endif
+
+// Blocks per erase command; the card is released between commands (divides ERASE_BATCH_BLOCKS)
+#ifndef ERASE_STEP_BLOCKS
+#define ERASE_STEP_BLOCKS         (128)
+#endif
+
+// The card must have been left alone this long before a batch is erased
+#ifndef ERASE_IDLE_MS
+#define ERASE_IDLE_MS             (50)
+#endif
+
+#include "psramTier.class.h"
+
+const size_t buffer_length = BUFFER_BLOCK_SIZE_BYTES;
+const size_t buffer_length_excess = 768;
+
+class dataManager {
+  private: blockDevice *device = NULL;
+
+  // outgoing block buffer
+  private: uint8_t _block1[buffer_length_excess];
+  public: uint8_t _block2[buffer_length_excess];
+
+  // buffer for SD card operations
+  private: uint8_t _exchange[buffer_length_excess];
+
+  // read-ahead cache, direct mapped: block N lives in slot N % PREFETCH_CACHE_BLOCKS
+  private: uint8_t _prefetch[PREFETCH_CACHE_BLOCKS * BUFFER_BLOCK_SIZE_BYTES];
+  private: uint32_t _prefetchTags[PREFETCH_CACHE_BLOCKS];
+
+  // run being read into the cache with DATA_OP released; cleared when the run goes stale
+  private: uint32_t prefetch_run_start = 0;
+  private: size_t prefetch_run_length = 0;
+
+  public: uint32_t prefetchHits = 0;
+  public: uint32_t prefetchMisses = 0;
+
+  // write-back RAM tier; blocks reach SD only when it fills or they age out
+  public: psramTier ramTier;
+
+  // completed blocks handed from ingest to the SD writer stage (slot indices)
+  private: uint8_t _writeSlots[SD_WRITE_QUEUE_BLOCKS][BUFFER_BLOCK_SIZE_BYTES];
+  private: QueueHandle_t writeFree = NULL;
+  private: QueueHandle_t writePending = NULL;
+
+  // outgoing block pointers: blocks after outgoingReadPointer up to outgoingBlockPointer are untransmitted
+  public: const uint32_t outgoingBlockStart = BUFFER_OUTGOING_START;
+  public: uint32_t outgoingBlockPointer = BUFFER_OUTGOING_START;
+  public: uint32_t outgoingReadPointer = BUFFER_OUTGOING_START;
+  public: size_t outgoingBytePointer = 0;
+
+  // last ring block whose data the remote end verified; blocks after erasedPointer up to it may be erased
+  public: volatile uint32_t outgoingAckedPointer = BUFFER_OUTGOING_START;
+  private: uint32_t erasedPointer = BUFFER_OUTGOING_START;
+
+  // batch being erased; the SD writer does not reserve a position inside it
+  private: volatile bool erasing = false;
+  private: uint32_t erase_first = 0;
+  private: uint32_t erase_last = 0;
+
+  // last foreground card access, for ERASE_IDLE_MS
+  private: volatile uint32_t last_io_ms = 0;
+
+  // header of the front buffer block, sealed when the block is committed
+  private: blockHeader front;
+  private: uint32_t blockSequence = 0;
+
+  // bumped whenever the untransmitted backlog is discarded
+  public: uint32_t flushes = 0;
+
+  // set once the card is mounted; nothing touches the device before that
+  public: volatile bool mounted = false;
+
+  // ring buffer overflow counters
+  public: uint32_t overflowBlocked = 0;
+  public: uint32_t overflowDroppedOldest = 0;
+  public: uint32_t overflowDroppedNewest = 0;
+  private: bool overflow_blocking = false;
+
+  // duration of the last verified SD block write
+  public: uint32_t writeLatencyUs = 0;
+
+  // blocks that never read back intact within SD_WRITE_ATTEMPTS
+  public: uint32_t writeFailures = 0;
+
+  // storage latency: verified block writes, synchronous block reads, prefetch reads
+  public: latencyHistogram writeLatency;
+  public: latencyHistogram readLatency;
+  public: latencyHistogram prefetchLatency;
+  public: latencyHistogram eraseLatency;
+
+  public: uint32_t erasedBlocks = 0;
+  public: uint32_t eraseFailures = 0;
+
+  public: void initialize(blockDevice &device) {
+    this->attach(device);
+    this->awaitMount();
+  }
+
+  /**
+   * Take the device and set up the RAM tier without touching the card, so
+   * ingest can start right after reset. Until mount() succeeds the SD writer
+   * stage holds completed blocks in the RAM tier, or in the write queue
+   * slots when there is no PSRAM, and flow control holds the host after that.
+   */
+  public: void attach(blockDevice &device) {
+    this->device = &device;
+    this->prefetchInvalidate();
+
+    if(this->ramTier.begin(PSRAM_TIER_BLOCKS, this->outgoingBlockStart, BUFFER_MAX_SIZE_BLOCKS + 1)) {
+      Serial.println(PROGMEM "PSRAM tier initialized with " + (String) this->ramTier.size() + " blocks");
+    }
+  }
+
+  public: bool mount() {
+    if(!this->device->begin()) {
+      return false;
+    }
+
+    long blocks = this->device->blockCount();
+
+    Serial.println(PROGMEM "uSD card (" + (String) this->device->name() + ") initialized with total size of " + (String) blocks + " blocks");
+
+    this->mounted = true;
+
+    // Blocks held back while the card was missing can go out now
+    notifyStage(sdWriterStage);
+
+    return true;
+  }
+
+  public: void awaitMount() {
+    while(!this->mount()) {
+      Serial.println(PROGMEM "uSD card failed to initialize. Trying again");
+      ring(5, 2, 50);
+
+      delay(1000);
+    }
+  }
+
+  public: uint64_t bufferSize() {
+    return (uint64_t) BUFFER_MAX_SIZE_BLOCKS * (uint64_t) BUFFER_BLOCK_SIZE_BYTES;
+  }
+
+  public: uint64_t outgoingBufferLength() {
+    return (this->outgoingBlockPointer - BUFFER_OUTGOING_START) * BUFFER_BLOCK_PAYLOAD_BYTES
+      + this->outgoingBytePointer;
+  }
+
+  public: uint16_t outgoingBufferBlockCount() {
+    return (this->outgoingBlockPointer - BUFFER_OUTGOING_START);
+  }
+
+  public: blockDevice * storage() {
+    return this->device;
+  }
+
+  // Blocks written to the ring that have not been handed to the transmitter yet
+  public: uint32_t outgoingBacklogBlocks() {
+    return this->ringDistance(this->outgoingReadPointer, this->outgoingBlockPointer);
+  }
+
+  public: bool outgoingBufferFull() {
+    return this->outgoingBacklogBlocks() >= BUFFER_MAX_SIZE_BLOCKS;
+  }
+
+  public: uint32_t peekOutgoingReadPointer() {
+    return this->nextRingBlock(this->outgoingReadPointer);
+  }
+
+  public: uint32_t advanceOutgoingReadPointer() {
+    this->outgoingReadPointer = this->nextRingBlock(this->outgoingReadPointer);
+
+    // A ring position freed up for a writer waiting under BUFFER_FULL_BLOCK
+    notifyStage(sdWriterStage);
+
+    return this->outgoingReadPointer;
+  }
+
+  /**
+   * Hand completed blocks to a separate SD writer stage (processWriteQueue)
+   * instead of committing them on the ingest path.
+   */
+  public: void beginWriteQueue() {
+    this->writeFree = xQueueCreate(SD_WRITE_QUEUE_BLOCKS, sizeof(uint8_t));
+    this->writePending = xQueueCreate(SD_WRITE_QUEUE_BLOCKS, sizeof(uint8_t));
+
+    for(uint8_t slot=0; slot<SD_WRITE_QUEUE_BLOCKS; slot++) {
+      xQueueSend(this->writeFree, &slot, 0);
+    }
+  }
+
+  // Completed blocks not yet committed to the ring by the SD writer stage
+  public: uint32_t outgoingPendingBlocks() {
+    if(this->writeFree == NULL) {
+      return 0;
+    }
+
+    return SD_WRITE_QUEUE_BLOCKS - uxQueueMessagesWaiting(this->writeFree);
+  }
+
+  public: void outgoingBufferFlush() {
+    this->outgoingBlockPointer = this->outgoingBlockStart;
+    this->outgoingReadPointer = this->outgoingBlockStart;
+    this->outgoingAckedPointer = this->outgoingBlockStart;
+    this->erasedPointer = this->outgoingBlockStart;
+    
+    this->frontBufferFlush();
+    this->prefetchInvalidate();
+    this->ramTier.clear();
+
+    this->flushes++;
+  }
+
+  // Every block leaving the front buffer, stored or not, takes a sequence number
+  public: void frontBufferFlush() {
+    this->outgoingBytePointer = 0;
+    this->blockSequence++;
+
+    memset(this->_block1, 0, (size_t) BUFFER_BLOCK_SIZE_BYTES);
+  }
+
+  /**
+   * A backlog block, from the RAM tier, the read-ahead cache or the card;
+   * NULL when a flush took it out of the backlog. Takes DATA_OP for the
+   * lookups only: a RAM tier block is copied to _block2 because the SD writer
+   * reuses its slot, and the card is read with the lock released.
+   */
+  public: uint8_t * returnOutgoingBlock(uint32_t block) {
+    DATA_OP_BEGIN();
+
+    if(this->ringDistance(block, this->outgoingBlockPointer) > this->outgoingBacklogBlocks()) {
+      DATA_OP_END();
+
+      return NULL;
+    }
+
+    uint8_t * cached = this->ramTier.lookup(block);
+
+    if(cached != NULL) {
+      memcpy(this->_block2, cached, BUFFER_BLOCK_SIZE_BYTES);
+      this->ramTier.markConsumed(block);
+
+      DATA_OP_END();
+
+      logEvent(EVENT_BLOCK_READ, EVENT_SOURCE_RAM_TIER, block);
+
+      return this->_block2;
+    }
+
+    DATA_OP_END();
+
+    // Only the transmitter fills the cache, so a hit stays valid without the lock
+    cached = this->prefetchLookup(block);
+
+    if(cached != NULL) {
+      this->prefetchHits++;
+
+      logEvent(EVENT_BLOCK_READ, EVENT_SOURCE_PREFETCH, block);
+
+      return cached;
+    }
+
+    this->prefetchMisses++;
+
+    logEvent(EVENT_BLOCK_READ, EVENT_SOURCE_SD, block);
+    logBegin(EVENT_SD_READ);
+
+    unsigned long start = micros();
+
+    this->device->readBlock(block, this->_block2);
+
+    this->readLatency.record(micros() - start);
+    this->last_io_ms = millis();
+
+    logEnd(EVENT_SD_READ, 0, block);
+
+    return this->_block2;
+  }
+
+  /**
+   * Fill the read-ahead cache with up to PREFETCH_CACHE_BLOCKS backlog blocks
+   * following the read pointer, using multi-block reads for runs that are not
+   * cached yet. Runs are picked under DATA_OP and read without it.
+   */
+  public: void prefetchOutgoingBlocks() {
+    uint32_t run_start;
+    size_t run_length;
+
+    while(this->nextPrefetchRun(run_start, run_length) && this->prefetchRead(run_start, run_length)) {
+    }
+  }
+
+  // First run of uncached blocks in the read-ahead window; its slots are emptied and it becomes the run in flight
+  private: bool nextPrefetchRun(uint32_t &run_start, size_t &run_length) {
+    uint32_t count, block;
+
+    run_start = 0;
+    run_length = 0;
+
+    DATA_OP_BEGIN();
+
+    count = this->outgoingBacklogBlocks();
+
+    if(count > PREFETCH_CACHE_BLOCKS) {
+      count = PREFETCH_CACHE_BLOCKS;
+    }
+
+    block = this->outgoingReadPointer;
+
+    for(uint32_t n=0; n<count; n++) {
+      block = this->nextRingBlock(block);
+
+      // Blocks still held by the RAM tier have not reached SD yet
+      bool cached = this->prefetchLookup(block) != NULL || this->ramTier.lookup(block) != NULL;
+
+      // Runs end at a cached block, the end of the slot array or the ring wrap
+      if(run_length > 0 && (cached || this->prefetchSlot(block) == 0 || block != run_start + run_length)) {
+        break;
+      }
+
+      if(!cached) {
+        if(run_length == 0) {
+          run_start = block;
+        }
+
+        run_length++;
+      }
+    }
+
+    // A read failing partway leaves the slots part overwritten: they hold nothing until it succeeds
+    for(size_t b=0; b<run_length; b++) {
+      this->_prefetchTags[this->prefetchSlot(run_start) + b] = PREFETCH_EMPTY_SLOT;
+    }
+
+    this->prefetch_run_start = run_start;
+    this->prefetch_run_length = run_length;
+
+    DATA_OP_END();
+
+    return run_length > 0;
+  }
+
+  public: void prefetchInvalidate() {
+    memset(this->_prefetchTags, PREFETCH_EMPTY_SLOT, sizeof(this->_prefetchTags));
+
+    this->prefetch_run_length = 0;
+  }
+
+  public: float prefetchHitRate() {
+    uint32_t total = this->prefetchHits + this->prefetchMisses;
+
+    return total > 0 ? (float) this->prefetchHits / (float) total : 0.0;
+  }
+
+  private: size_t prefetchSlot(uint32_t block) {
+    return block % PREFETCH_CACHE_BLOCKS;
+  }
+
+  private: uint8_t * prefetchLookup(uint32_t block) {
+    size_t slot = this->prefetchSlot(block);
+
+    if(this->_prefetchTags[slot] != block) {
+      return NULL;
+    }
+
+    return this->_prefetch + slot * BUFFER_BLOCK_SIZE_BYTES;
+  }
+
+  // Read the run in flight; its blocks are tagged only if no flush or overwrite touched them meanwhile
+  private: bool prefetchRead(uint32_t block, size_t count) {
+    size_t slot = this->prefetchSlot(block);
+    unsigned long start = micros();
+
+    logBegin(EVENT_SD_PREFETCH);
+
+    bool read = this->device->readBlocks(block, this->_prefetch + slot * BUFFER_BLOCK_SIZE_BYTES, count);
+
+    logEnd(EVENT_SD_PREFETCH, count, block);
+
+    if(read) {
+      this->prefetchLatency.record(micros() - start);
+      this->last_io_ms = millis();
+    }
+
+    DATA_OP_BEGIN();
+
+    read = read && this->prefetch_run_length == count;
+
+    if(read) {
+      for(size_t b=0; b<count; b++) {
+        this->_prefetchTags[slot + b] = block + b;
+      }
+    }
+
+    this->prefetch_run_length = 0;
+
+    DATA_OP_END();
+
+    return read;
+  }
+
+  // The front buffer as a block holding the bytes pushed so far
+  private: uint8_t * returnOutgoingDataExcess() {
+    this->sealFrontBuffer();
+
+    return this->_block1;
+  }
+
+  /**
+   * Take the bytes pushed so far as a block in _block2 and empty the front
+   * buffer. The check, the copy and the flush are one step under DATA_OP so
+   * ingest cannot push a byte in between. NULL when the front buffer is
+   * empty or blocks ahead of it are still queued for the SD writer.
+   */
+  public: uint8_t * takeOutgoingDataExcess() {
+    DATA_OP_BEGIN();
+
+    if(this->outgoingBytePointer == 0 || this->outgoingPendingBlocks() > 0) {
+      DATA_OP_END();
+
+      return NULL;
+    }
+
+    memcpy(this->_block2, this->returnOutgoingDataExcess(), BUFFER_BLOCK_SIZE_BYTES);
+    this->frontBufferFlush();
+
+    DATA_OP_END();
+
+    return this->_block2;
+  }
+
+  private: uint32_t nextRingBlock(uint32_t block) {
+    block++;
+
+    if(block > (this->outgoingBlockStart + BUFFER_MAX_SIZE_BLOCKS)) {
+      block = this->outgoingBlockStart;
+    }
+
+    return block;
+  }
+
+  private: uint32_t ringDistance(uint32_t from, uint32_t to) {
+    uint32_t span = BUFFER_MAX_SIZE_BLOCKS + 1;
+
+    return ((to - this->outgoingBlockStart) + span - (from - this->outgoingBlockStart)) % span;
+  }
+
+  /**
+   * Append a byte to the front buffer. Returns false when the byte was not
+   * accepted because the ring is full under BUFFER_FULL_BLOCK, or the SD
+   * writer stage has no free slot.
+   */
+  public: bool outgoingBufferPush(char data) {
+    size_t buffer_len = BUFFER_BLOCK_PAYLOAD_BYTES;
+
+    // A full front buffer is left pending when the ring refused it
+    if(this->outgoingBytePointer >= buffer_len && !this->commitFrontBuffer()) {
+      return false;
+    }
+
+    if(this->outgoingBytePointer == 0) {
+      this->front.timestamp = millis();
+    }
+
+    this->_block1[BLOCK_HEADER_BYTES + this->outgoingBytePointer++] = (uint8_t) data;
+
+    if(this->outgoingBytePointer >= buffer_len) {
+      this->commitFrontBuffer();
+    }
+
+    return true;
+  }
+
+  private: bool commitFrontBuffer() {
+    uint32_t pointer, flushes;
+    uint8_t slot, outcome;
+
+    this->sealFrontBuffer();
+
+    if(this->writePending != NULL) {
+      // The SD writer stage is behind: keep the block until a slot frees up
+      if(xQueueReceive(this->writeFree, &slot, 0) != pdTRUE) {
+        return false;
+      }
+
+      memcpy(this->_writeSlots[slot], this->_block1, BUFFER_BLOCK_SIZE_BYTES);
+      xQueueSend(this->writePending, &slot, 0);
+
+      this->frontBufferFlush();
+
+      return true;
+    }
+
+    outcome = this->reserveBlock(pointer, flushes);
+
+    if(outcome == COMMIT_REFUSED) {
+      return false;
+    }
+
+    if(outcome == COMMIT_STORE) {
+      this->storeBlock(pointer, this->_block1);
+      this->publishBlock(pointer);
+    }
+
+    this->frontBufferFlush();
+
+    return true;
+  }
+
+  private: void sealFrontBuffer() {
+    this->front.queue = BLOCK_QUEUE_HOST;
+    this->front.length = (uint16_t) this->outgoingBytePointer;
+    this->front.sequence = this->blockSequence;
+    this->front.seal(this->_block1);
+  }
+
+  /**
+   * SD writer stage: commit the next queued block to the ring, waiting up to
+   * timeout_ms for one. SD writes run outside DATA_OP so the transmitter is
+   * never held up by card latency.
+   */
+  public: void processWriteQueue(uint32_t timeout_ms) {
+    uint32_t pointer, flushes;
+    uint8_t slot, outcome;
+
+    // Makes room for the block below: nothing else pushes to the tier
+    this->spillRamTier();
+
+    // Card not mounted yet: only the RAM tier can take blocks, without evicting
+    if(!this->mounted && (!this->ramTier.enabled() || this->ramTier.full())) {
+      awaitStage(sdWriterStage, timeout_ms);
+
+      return;
+    }
+
+    if(xQueueReceive(this->writePending, &slot, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+      return;
+    }
+
+    while(true) {
+      DATA_OP_BEGIN();
+      outcome = this->reserveBlock(pointer, flushes);
+      DATA_OP_END();
+
+      if(outcome != COMMIT_REFUSED) {
+        break;
+      }
+
+      // BUFFER_FULL_BLOCK: wait for the transmitter to free a ring position, for as long as the link is down
+      awaitStage(sdWriterStage);
+      feedWatchdog();
+    }
+
+    // A host flush between reservation and publication discards the block with the rest of the backlog
+    if(outcome == COMMIT_STORE) {
+      if(this->ramTier.enabled()) {
+        DATA_OP_BEGIN();
+        if(flushes == this->flushes) {
+          this->ramTier.push(pointer, this->_writeSlots[slot], millis());
+          this->publishBlock(pointer);
+        }
+        DATA_OP_END();
+      } else {
+        this->writeVerifiedBlock(pointer, this->_writeSlots[slot]);
+
+        DATA_OP_BEGIN();
+        if(flushes == this->flushes) {
+          this->publishBlock(pointer);
+        }
+        DATA_OP_END();
+      }
+    }
+
+    xQueueSend(this->writeFree, &slot, 0);
+
+    // Ingest may be holding a full front buffer for this slot
+    notifyStage(ingestStage);
+  }
+
+  /**
+   * Pick the ring position for the next completed block, applying
+   * BUFFER_FULL_POLICY when the ring is full. Caller holds DATA_OP. The
+   * position is only valid while `flushes` stays what reserveBlock() saw.
+   */
+  private: uint8_t reserveBlock(uint32_t &pointer, uint32_t &flushes) {
+    uint32_t next = this->nextRingBlock(this->outgoingBlockPointer);
+
+    flushes = this->flushes;
+
+    // The ring came round, or was flushed, onto the batch being erased
+    if(this->erasing && next >= this->erase_first && next <= this->erase_last) {
+      return COMMIT_REFUSED;
+    }
+
+    if(this->outgoingBufferFull()) {
+      switch(BUFFER_FULL_POLICY) {
+        case BUFFER_FULL_BLOCK:
+          // Count each block that had to wait once, not every retry
+          if(!this->overflow_blocking) {
+            this->overflowBlocked++;
+            this->overflow_blocking = true;
+          }
+        return COMMIT_REFUSED;
+
+        case BUFFER_FULL_DROP_NEWEST:
+          this->overflowDroppedNewest++;
+        return COMMIT_DISCARD;
+
+        case BUFFER_FULL_DROP_OLDEST:
+          this->overflowDroppedOldest++;
+
+          // Never spill a block nobody is going to send
+          this->ramTier.markConsumed(this->advanceOutgoingReadPointer());
+        break;
+      }
+    }
+
+    this->overflow_blocking = false;
+
+    pointer = next;
+
+    return COMMIT_STORE;
+  }
+
+  // Without the SD writer stage the caller does the card I/O itself
+  private: void storeBlock(uint32_t pointer, uint8_t * data) {
+    if(this->ramTier.enabled()) {
+      if(this->ramTier.full()) {
+        this->evictRamTierBlock();
+      }
+
+      this->ramTier.push(pointer, data, millis());
+    } else {
+      this->writeVerifiedBlock(pointer, data);
+    }
+  }
+
+  // Make a stored block visible to the transmitter. Caller holds DATA_OP.
+  private: void publishBlock(uint32_t pointer) {
+    // The ring may have wrapped onto a block that is still cached or being read ahead
+    if(this->prefetchLookup(pointer) != NULL) {
+      this->_prefetchTags[this->prefetchSlot(pointer)] = PREFETCH_EMPTY_SLOT;
+    }
+
+    if(this->ringDistance(this->prefetch_run_start, pointer) < this->prefetch_run_length) {
+      this->prefetch_run_length = 0;
+    }
+
+    this->outgoingBlockPointer = pointer;
+
+    notifyStage(txFramerStage);
+  }
+
+  // Retire RAM tier blocks that were already transmitted; no card access, so any stage may call it
+  public: void serviceRamTier() {
+    DATA_OP_BEGIN();
+
+    while(this->ramTier.occupancy() > 0 && this->ramTier.oldestConsumed()) {
+      this->ramTier.popOldest(false);
+    }
+
+    DATA_OP_END();
+  }
+
+  /**
+   * SD writer stage: write the oldest RAM tier blocks to the card while the
+   * tier is full or they exceeded PSRAM_TIER_FLUSH_MS without being sent.
+   * The write runs outside DATA_OP. Only this stage pushes to the tier, so
+   * the block's slot keeps its data meanwhile, but the transmitter may send
+   * and retire the block before the write completes.
+   */
+  public: void spillRamTier() {
+    uint32_t block, oldest;
+    bool consumed;
+    uint8_t * data;
+
+    if(!this->mounted) {
+      return;
+    }
+
+    while(true) {
+      DATA_OP_BEGIN();
+
+      if(this->ramTier.occupancy() == 0
+        || (!this->ramTier.full() && !this->ramTier.oldestExpired(millis(), PSRAM_TIER_FLUSH_MS))) {
+        DATA_OP_END();
+
+        return;
+      }
+
+      data = this->ramTier.oldest(block, consumed);
+
+      if(consumed) {
+        this->ramTier.popOldest(false);
+
+        DATA_OP_END();
+
+        continue;
+      }
+
+      DATA_OP_END();
+
+      // A tier full of blocks that aged out while the card was not mounted takes a while
+      feedWatchdog();
+
+      this->writeVerifiedBlock(block, data);
+
+      DATA_OP_BEGIN();
+
+      if(this->ramTier.occupancy() > 0) {
+        this->ramTier.oldest(oldest, consumed);
+
+        if(oldest == block) {
+          this->ramTier.popOldest(true);
+        }
+      }
+
+      DATA_OP_END();
+    }
+  }
+
+  private: void evictRamTierBlock() {
+    uint32_t block;
+    bool consumed;
+
+    uint8_t * data = this->ramTier.oldest(block, consumed);
+
+    if(!consumed) {
+      this->writeVerifiedBlock(block, data);
+    }
+
+    this->ramTier.popOldest(!consumed);
+  }
+
+  private: void writeVerifiedBlock(uint32_t pointer, uint8_t * data) {
+    bool match = false;
+    uint16_t attempts = 0;
+
+    unsigned long start = micros();
+
+    logBegin(EVENT_SD_WRITE);
+    waitBegin(WAIT_SD_VERIFY);
+
+    while(!match && attempts < SD_WRITE_ATTEMPTS) {
+      this->device->writeBlock(pointer, data);
+      this->device->readBlock(pointer, this->_exchange);
+
+      match = memcmp(this->_exchange, data, BUFFER_BLOCK_SIZE_BYTES) == 0;
+
+      attempts++;
+
+      if(!match) {
+        logEvent(EVENT_SD_MISMATCH, attempts, pointer);
+
+        if(attempts < SD_WRITE_ATTEMPTS) {
+          delay(100);
+        }
+      }
+    }
+
+    if(!match) {
+      this->writeFailures++;
+    }
+
+    waitEnd(!match);
+    logEnd(EVENT_SD_WRITE, attempts, pointer);
+
+    this->writeLatencyUs = micros() - start;
+    this->writeLatency.record(this->writeLatencyUs);
+    this->last_io_ms = millis();
+  }
+
+  /**
+   * The remote end verified a frame built from the ring up to `block`. What
+   * is left of that block waits in the framer, so the block itself is no
+   * longer needed on the card. Frames built before a flush are ignored.
+   */
+  public: void acknowledgeBlocks(uint32_t block, uint32_t flushes) {
+    if(flushes == this->flushes) {
+      this->outgoingAckedPointer = block;
+    }
+  }
+
+  /**
+   * Erase the rest of the next ERASE_BATCH_BLOCKS aligned range of
+   * acknowledged ring blocks, so the card does not erase them on the write
+   * path when the ring comes round again. Only starts while the SD writer
+   * queue is empty and the card saw no other access for ERASE_IDLE_MS. The
+   * range goes out as ERASE_STEP_BLOCKS commands, each taking the card on
+   * its own, and the pass stops early once the SD writer has a block queued;
+   * the next pass resumes at the following step. Ranges at the ring ends
+   * shorter than a batch are left as they are. Returns whether a step was
+   * erased.
+   */
+  public: bool eraseConsumed() {
+    uint32_t first, last, step, next, limit, flushes, ring_end = this->outgoingBlockStart + BUFFER_MAX_SIZE_BLOCKS;
+    uint32_t steps = 0;
+    bool erased = true;
+
+    if(!this->mounted || this->outgoingPendingBlocks() > 0 || millis() - this->last_io_ms < ERASE_IDLE_MS) {
+      return false;
+    }
+
+    DATA_OP_BEGIN();
+
+    // Free blocks follow the position the writer fills next, up to the acknowledged pointer,
+    // or up to the read pointer when BUFFER_DROP_OLDEST let the writer overtake it
+    next = this->nextRingBlock(this->outgoingBlockPointer);
+    limit = this->outgoingAckedPointer;
+
+    if(this->ringDistance(next, limit) > this->ringDistance(next, this->outgoingReadPointer)) {
+      limit = this->outgoingReadPointer;
+    }
+
+    // The writer came round past erasedPointer: what it wrote since is backlog
+    if(this->ringDistance(this->erasedPointer, next) <= this->ringDistance(this->erasedPointer, limit)) {
+      this->erasedPointer = next;
+    }
+
+    first = this->nextRingBlock(this->erasedPointer);
+    first = ((first + ERASE_STEP_BLOCKS - 1) / ERASE_STEP_BLOCKS) * ERASE_STEP_BLOCKS;
+    last = (first / ERASE_BATCH_BLOCKS + 1) * ERASE_BATCH_BLOCKS - 1;
+
+    if(last > ring_end) {
+      // The acknowledged range wrapped: carry on from the ring start
+      if(this->ringDistance(this->erasedPointer, limit) > this->ringDistance(this->erasedPointer, ring_end)) {
+        this->erasedPointer = this->outgoingBlockStart;
+      }
+
+      DATA_OP_END();
+
+      return false;
+    }
+
+    if(this->ringDistance(this->erasedPointer, last) > this->ringDistance(this->erasedPointer, limit)) {
+      DATA_OP_END();
+
+      return false;
+    }
+
+    this->erase_first = first;
+    this->erase_last = last;
+    this->erasing = true;
+    flushes = this->flushes;
+
+    DATA_OP_END();
+
+    for(step = first; step <= last && erased; step += ERASE_STEP_BLOCKS) {
+      if(step > first && this->outgoingPendingBlocks() > 0) {
+        break;
+      }
+
+      unsigned long start = micros();
+
+      logBegin(EVENT_SD_ERASE);
+
+      erased = this->device->erase(step, step + ERASE_STEP_BLOCKS - 1);
+
+      logEnd(EVENT_SD_ERASE, ERASE_STEP_BLOCKS, step);
+
+      this->eraseLatency.record(micros() - start);
+
+      if(erased) {
+        this->erasedBlocks += ERASE_STEP_BLOCKS;
+        steps++;
+      } else {
+        this->eraseFailures++;
+      }
+    }
+
+    DATA_OP_BEGIN();
+
+    this->erasing = false;
+
+    // A flush during the erase restarted the ring; a failed step is skipped, not retried
+    this->erasedPointer = flushes == this->flushes ? step - 1 : this->outgoingBlockStart;
+
+    DATA_OP_END();
+
+    // The SD writer may be waiting for a position in the batch
+    notifyStage(sdWriterStage);
+
+    return steps > 0;
+  }
+
+  public: void reportOutgoingBufferStats() {
+    Serial.println(PROGMEM "outgoingBytePointer: " + (String) this->outgoingBytePointer);
+    Serial.println(PROGMEM "outgoingBlockPointer: " + (String) this->outgoingBlockPointer);
+    Serial.println(PROGMEM "outgoingReadPointer: " + (String) this->outgoingReadPointer);
+    Serial.println(PROGMEM "sd write failures: " + (String) this->writeFailures);
+    Serial.println(PROGMEM "erased: " + (String) this->erasedBlocks + " blocks up to " + (String) this->erasedPointer
+      + ", " + (String) this->eraseFailures + " steps of " + (String) ERASE_STEP_BLOCKS + " failed");
+    Serial.println(PROGMEM "overflow: " + (String) this->overflowBlocked + " blocked, "
+      + (String) this->overflowDroppedOldest + " dropped oldest, " + (String) this->overflowDroppedNewest + " dropped newest");
+
+    Serial.print(PROGMEM "buffer length: ");
+    print_uint64_t(Serial, this->outgoingBufferLength());
+    Serial.println();
+
+    Serial.println(PROGMEM "prefetch hit rate: " + (String) (this->prefetchHitRate() * 100) + "% ("
+      + (String) this->prefetchHits + "/" + (String) (this->prefetchHits + this->prefetchMisses) + ")");
+
+    if(this->ramTier.enabled()) {
+      Serial.println(PROGMEM "PSRAM tier occupancy: " + (String) this->ramTier.occupancy() + "/" + (String) this->ramTier.size()
+        + ", spill rate: " + (String) (this->ramTier.spillRate() * 100) + "% (" + (String) this->ramTier.spilled + " spilled, "
+        + (String) this->ramTier.dropped + " sent from RAM)");
+    }
+  }
+
+  public: void copy(uint8_t* src, uint8_t* dst, int len) {
+    memcpy(dst, src, sizeof(src[0])*len);
+  }
+
+};
@@ -0,0 +1,193 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Records held between drains (power of two)
+#ifndef EVENT_LOG_RECORDS
+#define EVENT_LOG_RECORDS           (512)
+#endif
+
+// Records per frame on the debug port: FRAME_LOG type byte + 32 * 16 bytes = FRAME_MAX_DECODED
+#define EVENT_LOG_FRAME_RECORDS     (32)
+
+// Record kinds: a point in time, the two ends of a span, or a span logged
+// once at its end with b holding its duration in microseconds
+#define EVENT_INSTANT               (0)
+#define EVENT_BEGIN                 (1)
+#define EVENT_END                   (2)
+#define EVENT_COMPLETE              (3)
+
+// Task that logged the record, one timeline track each
+#define EVENT_TRACK_OTHER           (0)
+#define EVENT_TRACK_INGEST          (1)
+#define EVENT_TRACK_SD_WRITER       (2)
+#define EVENT_TRACK_TX_FRAMER       (3)
+#define EVENT_TRACK_LINK            (4)
+#define EVENT_TRACK_HOST_EMITTER    (5)
+#define EVENT_TRACKS                (6)
+
+// Events: a is 16 bits, b is 32 bits (arguments of span events go on the end record)
+#define EVENT_LOG_DROPPED           (0x01) // b: records lost to a full ring since the last report
+#define EVENT_BLOCK_READ            (0x10) // a: EVENT_SOURCE_*, b: block
+#define EVENT_SD_MISMATCH           (0x12) // a: attempt, b: block
+#define EVENT_BLOCK_INVALID         (0x13) // b: sequence number in the header
+#define EVENT_SD_WRITE              (0x14) // span; end a: attempts, b: block
+#define EVENT_SD_READ               (0x15) // span; end b: block
+#define EVENT_SD_PREFETCH           (0x16) // span; end a: blocks, b: first block
+#define EVENT_SD_ERASE              (0x17) // span; end a: blocks, b: first block
+#define EVENT_TX_BEACON             (0x20)
+#define EVENT_TX_PACKET             (0x21) // a: packet flag, b: payload bytes
+#define EVENT_TX_VERIFIED           (0x22) // a: packet flag, b: microseconds streamed
+#define EVENT_TX_LINK_LOST          (0x23) // a: packet flag
+#define EVENT_TX_RESET_REQUEST      (0x24)
+#define EVENT_TX_SEARCH             (0x25) // span: beacon out, waiting for the remote beacon; end a: found
+#define EVENT_TX_PREAMBLE           (0x26) // span
+#define EVENT_TX_FRAME              (0x27) // span: packet and postamble; end a: packet flag
+#define EVENT_TX_ACK_WAIT           (0x28) // span; end a: verified, b: next wait in us
+#define EVENT_TX_RETRANSMIT         (0x29) // a: packet flag, b: attempt
+#define EVENT_RX_BEACON             (0x30)
+#define EVENT_RX_PACKET_DETECTED    (0x31)
+#define EVENT_RX_WAIT               (0x32) // a: expected packet flag
+#define EVENT_RX_PACKET             (0x33) // a: packet flag, b: bytes received
+#define EVENT_AGC                   (0x34) // span; end a: load, b: gain (0 when unresolved)
+#define EVENT_RX_RECEIVE            (0x35) // span: first byte to end of packet
+#define EVENT_LINK_RESET            (0x40)
+#define EVENT_LINK_PROFILE          (0x41) // a: profile index, b: frequency
+#define EVENT_INGEST_PASS           (0x50) // complete: host data moved into the buffer
+#define EVENT_LINK_PASS             (0x51) // span: one run of the inbound controller
+#define EVENT_WAIT_EXPIRED          (0x52) // a: WAIT_* site, b: microseconds waited
+#define EVENT_WAIT_STALL            (0x53) // a: WAIT_* site | EVENT_TRACK_* << 8, b: milliseconds so far; from the watchdog
+
+#define EVENT_SOURCE_RAM_TIER       (0)
+#define EVENT_SOURCE_PREFETCH       (1)
+#define EVENT_SOURCE_SD             (2)
+
+struct eventRecord {
+  uint32_t sequence;        // position in the log + 1, written last to publish the record
+  uint32_t time_us;
+  uint8_t event;
+  uint8_t kind;             // EVENT_INSTANT..EVENT_COMPLETE | EVENT_TRACK_* << 4
+  uint16_t a;
+  uint32_t b;
+};
+
+static_assert(sizeof(eventRecord) == 16, "event record layout changed");
+
+struct eventFormat {
+  uint8_t event;
+  const char * name;
+  const char * a;           // argument names, NULL when unused
+  const char * b;
+};
+
+// Shared with the host decoder (tools/logDecode.cpp)
+static const eventFormat eventFormats[] = {
+  { EVENT_LOG_DROPPED,          "log_dropped",    NULL,       "records" },
+  { EVENT_BLOCK_READ,           "block_read",     "source",   "block" },
+  { EVENT_SD_MISMATCH,          "sd_mismatch",    "attempt",  "block" },
+  { EVENT_BLOCK_INVALID,        "block_invalid",  NULL,       "sequence" },
+  { EVENT_SD_WRITE,             "sd_write",       "attempts", "block" },
+  { EVENT_SD_READ,              "sd_read",        NULL,       "block" },
+  { EVENT_SD_PREFETCH,          "sd_prefetch",    "blocks",   "block" },
+  { EVENT_SD_ERASE,             "sd_erase",       "blocks",   "block" },
+  { EVENT_TX_BEACON,            "tx_beacon",      NULL,       NULL },
+  { EVENT_TX_PACKET,            "tx_packet",      "flag",     "bytes" },
+  { EVENT_TX_VERIFIED,          "tx_verified",    "flag",     "us" },
+  { EVENT_TX_LINK_LOST,         "tx_link_lost",   "flag",     NULL },
+  { EVENT_TX_RESET_REQUEST,     "tx_reset",       NULL,       NULL },
+  { EVENT_TX_SEARCH,            "tx_search",      "found",    NULL },
+  { EVENT_TX_PREAMBLE,          "tx_preamble",    NULL,       NULL },
+  { EVENT_TX_FRAME,             "tx_frame",       "flag",     NULL },
+  { EVENT_TX_ACK_WAIT,          "tx_ack_wait",    "verified", "wait_us" },
+  { EVENT_TX_RETRANSMIT,        "tx_retransmit",  "flag",     "attempt" },
+  { EVENT_RX_BEACON,            "rx_beacon",      NULL,       NULL },
+  { EVENT_RX_PACKET_DETECTED,   "rx_detected",    NULL,       NULL },
+  { EVENT_RX_WAIT,              "rx_wait",        "flag",     NULL },
+  { EVENT_RX_PACKET,            "rx_packet",      "flag",     "bytes" },
+  { EVENT_AGC,                  "agc",            "load",     "gain" },
+  { EVENT_RX_RECEIVE,           "rx_receive",     NULL,       NULL },
+  { EVENT_LINK_RESET,           "link_reset",     NULL,       NULL },
+  { EVENT_LINK_PROFILE,         "link_profile",   "index",    "hz" },
+  { EVENT_INGEST_PASS,          "ingest",         NULL,       "us" },
+  { EVENT_LINK_PASS,            "link",           NULL,       NULL },
+  { EVENT_WAIT_EXPIRED,         "wait_expired",   "site",     "us" },
+  { EVENT_WAIT_STALL,           "wait_stall",     "site",     "ms" },
+};
+
+static const char * const eventTracks[] = { "other", "ingest", "sd_writer", "tx_framer", "link", "host_emitter" };
+
+/**
+ * Lock-free binary event log. Any task appends a 16-byte record with a
+ * compare-and-swap on the head and never waits: when the ring is full the
+ * record is dropped and counted. A single low-priority task drains the
+ * records in order and ships them to the debug port, where the host
+ * decoder turns them back into text.
+ */
+class eventLog {
+  private: eventRecord records[EVENT_LOG_RECORDS];
+  private: uint32_t head = 0;
+  private: uint32_t tail = 0;
+
+  private: uint32_t dropped = 0;
+  private: uint32_t dropped_reported = 0;
+
+  public: void log(uint8_t event, uint8_t kind, uint16_t a, uint32_t b) {
+    uint32_t slot = __atomic_load_n(&this->head, __ATOMIC_RELAXED);
+
+    do {
+      if(slot - __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE) >= EVENT_LOG_RECORDS) {
+        __atomic_fetch_add(&this->dropped, 1, __ATOMIC_RELAXED);
+
+        return;
+      }
+    } while(!__atomic_compare_exchange_n(&this->head, &slot, slot + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    eventRecord &record = this->records[slot & (EVENT_LOG_RECORDS - 1)];
+
+    record.time_us = micros();
+    record.event = event;
+    record.kind = kind;
+    record.a = a;
+    record.b = b;
+
+    __atomic_store_n(&record.sequence, slot + 1, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Copy up to max published records, oldest first. Only one task may
+   * drain. A record still being written stops the drain until next time.
+   */
+  public: size_t drain(eventRecord * dst, size_t max) {
+    size_t count = 0;
+    uint32_t lost = __atomic_load_n(&this->dropped, __ATOMIC_RELAXED);
+
+    if(lost != this->dropped_reported) {
+      this->log(EVENT_LOG_DROPPED, EVENT_INSTANT, 0, lost - this->dropped_reported);
+      this->dropped_reported = lost;
+    }
+
+    while(count < max) {
+      eventRecord &record = this->records[this->tail & (EVENT_LOG_RECORDS - 1)];
+
+      if(__atomic_load_n(&record.sequence, __ATOMIC_ACQUIRE) != this->tail + 1) {
+        break;
+      }
+
+      dst[count++] = record;
+
+      __atomic_store_n(&this->tail, this->tail + 1, __ATOMIC_RELEASE);
+    }
+
+    return count;
+  }
+
+  public: uint32_t lost() {
+    return __atomic_load_n(&this->dropped, __ATOMIC_RELAXED);
+  }
+
+};
+
+eventLog systemLog;
@@ -0,0 +1,125 @@
+#pragma once
+
+#ifdef ARDUINO
+#include <esp_task_wdt.h>
+#endif
+
+#include "latencyHistogram.class.h"
+#include "eventLog.class.h"
+#include "waitMonitor.class.h"
+
+// Stages sleep until notified, or at most this long so timers still advance
+#define CONTROLLER_POLL_MS          (10)
+
+/**
+ * A pipeline stage task. notified_at holds the time of the first notification
+ * since the task last woke (0 = none pending), so wake-up latency can be recorded.
+ */
+struct pipelineStage {
+  TaskHandle_t task;
+  volatile uint32_t notified_at;
+  latencyHistogram wake;
+};
+
+pipelineStage ingestStage;      // host UART -> front buffer
+pipelineStage sdWriterStage;    // completed blocks -> RAM tier / SD
+pipelineStage txFramerStage;    // backlog read-ahead for the transmitter
+pipelineStage linkStage;        // optical TX/RX state machine
+pipelineStage hostEmitterStage; // received data, status and receipts -> host UART
+
+// Task watchdog check-in inside a long stage pass; only for tasks main.cpp subscribed
+void feedWatchdog() {
+  #ifdef ARDUINO
+  esp_task_wdt_reset();
+  #endif
+}
+
+void notifyStage(pipelineStage &stage) {
+  if(stage.task == NULL) {
+    return;
+  }
+
+  if(stage.notified_at == 0) {
+    stage.notified_at = micros() | 1;
+  }
+
+  xTaskNotifyGive(stage.task);
+}
+
+void awaitStage(pipelineStage &stage, uint32_t timeout_ms = CONTROLLER_POLL_MS) {
+  if(ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout_ms)) > 0 && stage.notified_at != 0) {
+    stage.wake.record(micros() - stage.notified_at);
+  }
+
+  stage.notified_at = 0;
+}
+
+// Timeline track of the calling task
+uint8_t eventTrack() {
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+  if(task == NULL) {
+    return EVENT_TRACK_OTHER;
+  }
+
+  if(task == linkStage.task) {
+    return EVENT_TRACK_LINK;
+  }
+
+  if(task == sdWriterStage.task) {
+    return EVENT_TRACK_SD_WRITER;
+  }
+
+  if(task == txFramerStage.task) {
+    return EVENT_TRACK_TX_FRAMER;
+  }
+
+  if(task == ingestStage.task) {
+    return EVENT_TRACK_INGEST;
+  }
+
+  if(task == hostEmitterStage.task) {
+    return EVENT_TRACK_HOST_EMITTER;
+  }
+
+  return EVENT_TRACK_OTHER;
+}
+
+void logEvent(uint8_t event, uint16_t a = 0, uint32_t b = 0) {
+  systemLog.log(event, EVENT_INSTANT | (eventTrack() << 4), a, b);
+}
+
+void logBegin(uint8_t event) {
+  systemLog.log(event, EVENT_BEGIN | (eventTrack() << 4), 0, 0);
+}
+
+void logEnd(uint8_t event, uint16_t a = 0, uint32_t b = 0) {
+  systemLog.log(event, EVENT_END | (eventTrack() << 4), a, b);
+}
+
+// A span logged once it is over, from its start time in micros()
+void logComplete(uint8_t event, unsigned long start) {
+  systemLog.log(event, EVENT_COMPLETE | (eventTrack() << 4), 0, micros() - start);
+}
+
+waitMonitor waits;
+
+void waitBegin(uint8_t site) {
+  waits.enter(eventTrack(), site, micros());
+}
+
+// expired: the deadline ended the wait and the caller takes its recovery path
+void waitEnd(bool expired = false) {
+  uint8_t track = eventTrack();
+  uint8_t site = waitTraceRecord.tracks[track].site;
+  uint32_t elapsed = waits.leave(track, expired, micros());
+
+  if(expired) {
+    logEvent(EVENT_WAIT_EXPIRED, site, elapsed);
+  }
+}
+
+// UART receive callback: host data arrived
+void notifyIngest() {
+  notifyStage(ingestStage);
+}
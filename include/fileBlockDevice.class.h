@@ -0,0 +1,128 @@
+using namespace std;
+
+#pragma once
+
+#ifndef ARDUINO
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "blockDevice.class.h"
+
+/**
+ * Host (Linux) block device backed by a memory-mapped image file, or by an
+ * anonymous RAM image when no path is given. The mapping is sparse, so a full
+ * size ring buffer costs only the pages that are actually touched.
+ */
+class fileBlockDevice : public blockDevice {
+  private: const char * path;
+  private: uint32_t blocks;
+  private: int fd = -1;
+  private: uint8_t * image = NULL;
+
+  public: fileBlockDevice(const char * path, uint32_t blocks) : path(path), blocks(blocks) {}
+
+  public: ~fileBlockDevice() {
+    if(this->image != NULL) {
+      munmap(this->image, this->imageSize());
+    }
+
+    if(this->fd >= 0) {
+      close(this->fd);
+    }
+  }
+
+  public: bool begin() {
+    int flags = MAP_SHARED | MAP_NORESERVE;
+
+    if(this->image != NULL) {
+      return true;
+    }
+
+    if(this->path != NULL) {
+      this->fd = open(this->path, O_RDWR | O_CREAT, 0644);
+
+      if(this->fd < 0 || ftruncate(this->fd, (off_t) this->imageSize()) != 0) {
+        return false;
+      }
+    } else {
+      flags |= MAP_ANONYMOUS;
+    }
+
+    void * mapping = mmap(NULL, this->imageSize(), PROT_READ | PROT_WRITE, flags, this->fd, 0);
+
+    if(mapping == MAP_FAILED) {
+      return false;
+    }
+
+    this->image = (uint8_t *) mapping;
+
+    return true;
+  }
+
+  public: const char * name() {
+    return this->path != NULL ? "file" : "ram";
+  }
+
+  public: uint32_t blockCount() {
+    return this->blocks;
+  }
+
+  public: bool readBlock(uint32_t block, uint8_t * dst) {
+    return this->readBlocks(block, dst, 1);
+  }
+
+  public: bool writeBlock(uint32_t block, const uint8_t * src) {
+    return this->writeBlocks(block, src, 1);
+  }
+
+  public: bool readBlocks(uint32_t block, uint8_t * dst, size_t count) {
+    if(!this->inRange(block, count)) {
+      return false;
+    }
+
+    memcpy(dst, this->image + this->offset(block), count * BLOCK_DEVICE_BLOCK_SIZE);
+
+    return true;
+  }
+
+  public: bool writeBlocks(uint32_t block, const uint8_t * src, size_t count) {
+    if(!this->inRange(block, count)) {
+      return false;
+    }
+
+    memcpy(this->image + this->offset(block), src, count * BLOCK_DEVICE_BLOCK_SIZE);
+
+    return true;
+  }
+
+  public: bool erase(uint32_t first, uint32_t last) {
+    if(last < first || !this->inRange(first, (size_t) (last - first) + 1)) {
+      return false;
+    }
+
+    // Erased blocks read back as zeroes
+    size_t length = ((size_t) (last - first) + 1) * BLOCK_DEVICE_BLOCK_SIZE;
+
+    memset(this->image + this->offset(first), 0, length);
+
+    return true;
+  }
+
+  private: size_t imageSize() {
+    return (size_t) this->blocks * BLOCK_DEVICE_BLOCK_SIZE;
+  }
+
+  private: size_t offset(uint32_t block) {
+    return (size_t) block * BLOCK_DEVICE_BLOCK_SIZE;
+  }
+
+  private: bool inRange(uint32_t block, size_t count) {
+    return this->image != NULL && (uint64_t) block + count <= this->blocks;
+  }
+
+};
+
+#endif
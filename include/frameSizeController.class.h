@@ -0,0 +1,109 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+// Frame payload size bounds (powers of two)
+#define FRAME_SIZE_MIN_BYTES        (64)
+#define FRAME_SIZE_MAX_BYTES        (2048)
+
+// Smoothing of the frame error rate and how often the size is re-evaluated
+#define FRAME_SIZE_EWMA_WEIGHT      (0.0625f)
+#define FRAME_SIZE_EVAL_ATTEMPTS    (8)
+
+// Initial per-byte error estimate before any outcome is known
+#define FRAME_SIZE_INITIAL_BER      (0.00001f)
+
+/**
+ * Picks the frame payload size that maximizes expected goodput.
+ *
+ * Each transmission attempt either gets verified or is streamed again. The
+ * smoothed failure rate at the current size is converted into a per-byte
+ * error probability p, and for every candidate size L the expected goodput
+ * L * (1 - p)^(L + exposed) / (L + exposed + fixed) is compared, where
+ * `exposed` counts wrapper bytes that can be corrupted and `fixed` the
+ * per-attempt cost of preamble, postamble and the verification wait.
+ */
+class frameSizeController {
+  private: uint16_t frame_size;
+  private: uint16_t exposed_bytes;
+  private: uint16_t fixed_bytes;
+
+  private: float frame_error_rate;
+  private: float byte_error_rate = FRAME_SIZE_INITIAL_BER;
+  private: uint16_t attempts = 0;
+
+  public: uint32_t successes = 0;
+  public: uint32_t failures = 0;
+
+  public: frameSizeController(uint16_t initial_size, uint16_t exposed_bytes, uint16_t fixed_bytes)
+    : frame_size(initial_size), exposed_bytes(exposed_bytes), fixed_bytes(fixed_bytes) {
+    this->frame_error_rate = this->frameErrorRate(this->frame_size);
+  }
+
+  public: uint16_t size() {
+    return this->frame_size;
+  }
+
+  // Smoothed share of attempts at the current size that were not verified
+  public: float frameErrorRate() {
+    return this->frame_error_rate;
+  }
+
+  public: float byteErrorRate() {
+    return this->byte_error_rate;
+  }
+
+  public: void recordAttempt(bool verified) {
+    if(verified) {
+      this->successes++;
+    } else {
+      this->failures++;
+    }
+
+    this->frame_error_rate += FRAME_SIZE_EWMA_WEIGHT * ((verified ? 0.0f : 1.0f) - this->frame_error_rate);
+
+    // Invert FER = 1 - (1 - p)^n for the bytes exposed at the current size
+    float n = (float) (this->frame_size + this->exposed_bytes);
+    float survival = 1.0f - this->frame_error_rate;
+
+    this->byte_error_rate = survival > 0.0f ? 1.0f - powf(survival, 1.0f / n) : 1.0f;
+
+    if(++this->attempts >= FRAME_SIZE_EVAL_ATTEMPTS) {
+      this->attempts = 0;
+      this->resize();
+    }
+  }
+
+  private: void resize() {
+    uint16_t best = this->frame_size;
+    float best_goodput = this->goodput(best);
+
+    for(uint32_t candidate = FRAME_SIZE_MIN_BYTES; candidate <= FRAME_SIZE_MAX_BYTES; candidate <<= 1) {
+      float goodput = this->goodput(candidate);
+
+      if(goodput > best_goodput) {
+        best = candidate;
+        best_goodput = goodput;
+      }
+    }
+
+    if(best != this->frame_size) {
+      this->frame_size = best;
+      this->frame_error_rate = this->frameErrorRate(best);
+    }
+  }
+
+  private: float goodput(uint32_t size) {
+    float success = 1.0f - this->frameErrorRate(size);
+
+    return (float) size * success / (float) (size + this->exposed_bytes + this->fixed_bytes);
+  }
+
+  private: float frameErrorRate(uint32_t size) {
+    return 1.0f - powf(1.0f - this->byte_error_rate, (float) (size + this->exposed_bytes));
+  }
+
+};
@@ -0,0 +1,171 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Framed host protocol: every frame is COBS encoded and terminated by 0x00.
+ * The decoded frame is [type][payload...]. Multi-byte fields are little endian.
+ */
+
+// Host -> OCP
+#define FRAME_DATA                  (0x01) // payload is appended to the outgoing buffer
+#define FRAME_STATUS_REQUEST        (0x02) // no payload, answered with FRAME_STATUS
+#define FRAME_FLUSH                 (0x03) // discard the untransmitted backlog
+#define FRAME_PRIORITY              (0x04) // payload: uint8_t TX_PRIORITY_*
+#define FRAME_CAPTURE               (0x05) // payload: uint8_t PULSE_CAPTURE_* mode, uint16_t edges; trace goes to the debug port
+#define FRAME_LINK_PROFILE          (0x06) // payload: uint8_t index into linkProfiles, answered once applied
+
+// OCP -> host
+#define FRAME_RX_DATA               (0x81) // data received over the optical link
+#define FRAME_STATUS                (0x82) // payload: hostStatus
+#define FRAME_RECEIPT               (0x83) // payload: hostReceipt
+#define FRAME_FLOW                  (0x84) // payload: uint8_t 1 = paused, 0 = resumed
+#define FRAME_ACK                   (0x85) // payload: uint8_t type of the accepted command
+#define FRAME_NAK                   (0x86) // payload: uint8_t type of the rejected command
+
+// OCP -> debug port
+#define FRAME_LOG                   (0x87) // payload: eventRecord[], see eventLog.class.h
+
+// Transmit priorities
+#define TX_PRIORITY_BATCH           (0) // wait for TRANS_DELAY_MS of host silence before transmitting
+#define TX_PRIORITY_IMMEDIATE       (1) // start transmitting as soon as data is buffered
+
+#define FRAME_MAX_PAYLOAD           (512)
+#define FRAME_MAX_DECODED           (FRAME_MAX_PAYLOAD + 1)
+#define FRAME_MAX_ENCODED           (FRAME_MAX_DECODED + FRAME_MAX_DECODED / 254 + 2)
+
+struct __attribute__((packed)) hostStatus {
+  uint64_t backlog_bytes;
+  uint32_t backlog_blocks;
+  uint8_t operational_mode;
+  uint8_t transmission_mode;
+  uint8_t flow_paused;
+  uint8_t priority;
+  uint64_t delivered_bytes;
+  uint32_t delivered_packets;
+  uint32_t throughput_bps;
+  uint32_t overflow_blocked;
+  uint32_t overflow_dropped_oldest;
+  uint32_t overflow_dropped_newest;
+  uint16_t frame_size;
+  uint32_t frame_error_ppm;
+  uint32_t ack_rtt_us;          // smoothed verification round trip, 0 before the first sample
+  uint32_t ack_rtt_var_us;
+  uint32_t ack_timeout_us;
+  uint32_t packet_timeout_us;
+  uint32_t beacon_timeout_us;
+  uint8_t verify_repeats;
+};
+
+struct __attribute__((packed)) hostReceipt {
+  uint64_t delivered_bytes;
+  uint32_t delivered_packets;
+};
+
+class hostProtocol {
+  private: uint8_t frame[FRAME_MAX_ENCODED];
+  private: size_t frame_length = 0;
+  private: bool frame_overrun = false;
+
+  public: uint32_t frames_received = 0;
+  public: uint32_t frames_dropped = 0;
+
+  /**
+   * Feed one received byte. Returns the decoded frame length once a
+   * terminator completes a valid frame, 0 otherwise.
+   */
+  public: size_t receive(uint8_t byte, uint8_t * decoded) {
+    size_t length;
+
+    if(byte != 0x00) {
+      if(this->frame_length < FRAME_MAX_ENCODED) {
+        this->frame[this->frame_length++] = byte;
+      } else {
+        this->frame_overrun = true;
+      }
+
+      return 0;
+    }
+
+    length = this->frame_overrun ? 0 : this->decode(this->frame, this->frame_length, decoded);
+
+    if(this->frame_length > 0) {
+      if(length > 0) {
+        this->frames_received++;
+      } else {
+        this->frames_dropped++;
+      }
+    }
+
+    this->frame_length = 0;
+    this->frame_overrun = false;
+
+    return length;
+  }
+
+  // COBS encode `length` bytes into dst, appending the 0x00 terminator. Returns the encoded size.
+  public: size_t encode(const uint8_t * src, size_t length, uint8_t * dst) {
+    size_t read = 0, write = 1, code_index = 0;
+    uint8_t code = 1;
+
+    while(read < length) {
+      if(src[read] == 0x00) {
+        dst[code_index] = code;
+        code = 1;
+        code_index = write++;
+        read++;
+
+        continue;
+      }
+
+      dst[write++] = src[read++];
+      code++;
+
+      if(code == 0xFF) {
+        dst[code_index] = code;
+        code = 1;
+        code_index = write++;
+      }
+    }
+
+    dst[code_index] = code;
+    dst[write++] = 0x00;
+
+    return write;
+  }
+
+  // COBS decode a frame without its terminator. Returns 0 on malformed input.
+  public: size_t decode(const uint8_t * src, size_t length, uint8_t * dst) {
+    size_t read = 0, write = 0;
+
+    while(read < length) {
+      uint8_t code = src[read++];
+
+      if(code == 0x00 || read + code - 1 > length) {
+        return 0;
+      }
+
+      for(uint8_t i=1; i<code; i++) {
+        if(write >= FRAME_MAX_DECODED) {
+          return 0;
+        }
+
+        dst[write++] = src[read++];
+      }
+
+      if(code < 0xFF && read < length) {
+        if(write >= FRAME_MAX_DECODED) {
+          return 0;
+        }
+
+        dst[write++] = 0x00;
+      }
+    }
+
+    return write;
+  }
+
+};
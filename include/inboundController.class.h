@@ -1,20 +1,30 @@
-using namespace std;
-
-// #include "uartInterface.class.h"
-// #include "dataManager.class.h"
-// #include "opticalInterface.class.h"
-
-class inboundController {
-  public: void run(uartInterface &portUart, dataManager &dataManager, opticalInterface &opticalInterface) {
-    /**
-     * Packetize data and module over optical beam
-     */
-    opticalInterface.processOutgoing(dataManager, portUart);
-
-    /**
-     * Listen for incoming data
-     */
-    opticalInterface.processIncoming(dataManager, portUart);
-  }
-  
-};
+using namespace std;
+
+// #include "uartInterface.class.h"
+// #include "dataManager.class.h"
+// #include "opticalInterface.class.h"
+
+class inboundController {
+  public: void run(uartInterface &portUart, dataManager &dataManager, opticalInterface &opticalInterface) {
+    /**
+     * Pulse-trace capture requested by the host
+     */
+    opticalInterface.processCapture(portUart);
+
+    /**
+     * Link profile switch requested by the host
+     */
+    opticalInterface.processProfile(portUart);
+
+    /**
+     * Packetize data and module over optical beam
+     */
+    opticalInterface.processOutgoing(dataManager, portUart);
+
+    /**
+     * Listen for incoming data
+     */
+    opticalInterface.processIncoming(dataManager, portUart);
+  }
+  
+};
@@ -1,5 +1,6 @@
-bool _spi_in_use = false;
-bool _data_manager_in_operation = false;
+// SPI_OP and DATA_OP locks; mutexes, so a waiting task lends its priority to the holder
+SemaphoreHandle_t _spi_mutex = xSemaphoreCreateMutex();
+SemaphoreHandle_t _data_mutex = xSemaphoreCreateMutex();
 
 void print_uint64_t(HardwareSerial HS, uint64_t num) {
   char rev[128]; 
@@ -0,0 +1,173 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <esp_timer.h>
+#endif
+
+// Outputs driven by the engine
+#define INDICATOR_RED               (0)
+#define INDICATOR_BUZZER            (1)
+#define INDICATOR_OUTPUTS           (2)
+
+// Patterns waiting per output; posts to a full queue are dropped
+#ifndef INDICATOR_QUEUE_PATTERNS
+#define INDICATOR_QUEUE_PATTERNS    (8)
+#endif
+
+// Activity flashes: at most one per interval, however many packets pass
+#ifndef INDICATOR_ACTIVITY_MS
+#define INDICATOR_ACTIVITY_MS       (50)
+#endif
+
+#define INDICATOR_ACTIVITY_FLASH_MS (20)
+#define INDICATOR_ACTIVITY_CLICK_MS (1)
+
+/**
+ * Repeat `times`: output on for on_ms, then off for off_ms
+ */
+struct indicatorPattern {
+  uint8_t times;
+  uint16_t on_ms;
+  uint16_t off_ms;
+};
+
+struct indicatorLane {
+  uint8_t pin;
+  QueueHandle_t queue;
+  indicatorPattern pattern;
+  bool playing;
+  bool on;
+  uint8_t remaining;
+  int64_t next_edge_us;
+};
+
+/**
+ * Plays LED and buzzer patterns from an esp_timer, so callers on the data
+ * path only post and never wait. Each output has its own FIFO of patterns;
+ * the timer is armed for the next edge of any output and stays idle when
+ * nothing plays. Lane state belongs to the timer callback; post() only
+ * touches the queues.
+ */
+class indicator {
+  private: indicatorLane lanes[INDICATOR_OUTPUTS];
+  private: esp_timer_handle_t timer = NULL;
+  private: volatile uint32_t last_activity = 0;
+
+  public: uint32_t dropped = 0;
+  public: uint32_t merged = 0;
+
+  public: bool begin(uint8_t red_pin, uint8_t buzzer_pin) {
+    esp_timer_create_args_t args = {};
+
+    this->lanes[INDICATOR_RED].pin = red_pin;
+    this->lanes[INDICATOR_BUZZER].pin = buzzer_pin;
+
+    for(uint8_t o=0; o<INDICATOR_OUTPUTS; o++) {
+      this->lanes[o].queue = xQueueCreate(INDICATOR_QUEUE_PATTERNS, sizeof(indicatorPattern));
+      this->lanes[o].playing = false;
+      this->lanes[o].on = false;
+    }
+
+    args.callback = indicator::onTimer;
+    args.arg = this;
+    args.name = "indicator";
+
+    return esp_timer_create(&args, &this->timer) == ESP_OK;
+  }
+
+  public: void post(uint8_t output, uint8_t times, uint16_t on_ms, uint16_t off_ms) {
+    indicatorPattern pattern = { times, on_ms, off_ms };
+
+    if(this->timer == NULL || xQueueSend(this->lanes[output].queue, &pattern, 0) != pdTRUE) {
+      this->dropped++;
+
+      return;
+    }
+
+    // Run the player now; it re-arms itself for the next edge of every lane
+    esp_timer_stop(this->timer);
+    esp_timer_start_once(this->timer, 0);
+  }
+
+  // Flash and click for traffic, merged into one per INDICATOR_ACTIVITY_MS
+  public: void activity() {
+    uint32_t now = millis();
+
+    if(now - this->last_activity < INDICATOR_ACTIVITY_MS) {
+      this->merged++;
+
+      return;
+    }
+
+    this->last_activity = now;
+
+    this->post(INDICATOR_RED, 1, INDICATOR_ACTIVITY_FLASH_MS, 0);
+    this->post(INDICATOR_BUZZER, 1, INDICATOR_ACTIVITY_CLICK_MS, 0);
+  }
+
+  private: static void onTimer(void * arg) {
+    ((indicator *) arg)->step();
+  }
+
+  private: void step() {
+    int64_t now = esp_timer_get_time();
+    int64_t next = 0;
+
+    for(uint8_t o=0; o<INDICATOR_OUTPUTS; o++) {
+      indicatorLane &lane = this->lanes[o];
+
+      this->play(lane, now);
+
+      if(lane.playing && (next == 0 || lane.next_edge_us < next)) {
+        next = lane.next_edge_us;
+      }
+    }
+
+    if(next != 0) {
+      esp_timer_start_once(this->timer, (uint64_t) (next > now ? next - now : 0));
+    }
+  }
+
+  // Take every edge of the lane that is due, starting queued patterns as the previous one ends
+  private: void play(indicatorLane &lane, int64_t now) {
+    while(true) {
+      if(!lane.playing) {
+        if(xQueueReceive(lane.queue, &lane.pattern, 0) != pdTRUE) {
+          return;
+        }
+
+        lane.playing = true;
+        lane.remaining = lane.pattern.times;
+        lane.next_edge_us = now;
+      }
+
+      if(now < lane.next_edge_us) {
+        return;
+      }
+
+      if(lane.on) {
+        lane.on = false;
+        digitalWrite(lane.pin, LOW);
+        lane.next_edge_us += (int64_t) lane.pattern.off_ms * 1000;
+
+        continue;
+      }
+
+      if(lane.remaining == 0) {
+        lane.playing = false;
+
+        continue;
+      }
+
+      lane.remaining--;
+      lane.on = true;
+      digitalWrite(lane.pin, HIGH);
+      lane.next_edge_us += (int64_t) lane.pattern.on_ms * 1000;
+    }
+  }
+
+};
@@ -0,0 +1,103 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Log-linear latency histogram in microseconds: every power of two is split
+ * into 4 sub-buckets, so reported percentiles are within 25% of the truth.
+ */
+#define LATENCY_HISTOGRAM_BUCKETS   (124)
+
+class latencyHistogram {
+  private: uint32_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+
+  public: uint32_t count = 0;
+  public: uint32_t max = 0;
+  public: uint64_t sum = 0;
+
+  public: latencyHistogram() {
+    this->clear();
+  }
+
+  public: void clear() {
+    memset(this->buckets, 0, sizeof(this->buckets));
+
+    this->count = 0;
+    this->max = 0;
+    this->sum = 0;
+  }
+
+  public: void record(uint32_t us) {
+    this->buckets[this->bucket(us)]++;
+
+    this->count++;
+    this->sum += us;
+
+    if(us > this->max) {
+      this->max = us;
+    }
+  }
+
+  public: uint32_t mean() {
+    return this->count > 0 ? (uint32_t) (this->sum / this->count) : 0;
+  }
+
+  // Upper bound of the bucket holding the given percentile (0-100)
+  public: uint32_t percentile(uint8_t p) {
+    uint64_t target = ((uint64_t) this->count * p + 99) / 100;
+    uint64_t seen = 0;
+
+    if(this->count == 0) {
+      return 0;
+    }
+
+    for(uint8_t b=0; b<LATENCY_HISTOGRAM_BUCKETS; b++) {
+      seen += this->buckets[b];
+
+      if(seen >= target && this->buckets[b] > 0) {
+        uint32_t upper = this->upperBound(b);
+
+        return upper < this->max ? upper : this->max;
+      }
+    }
+
+    return this->max;
+  }
+
+  #ifdef ARDUINO
+  public: void report(const char * name) {
+    Serial.println((String) name + ": n=" + (String) this->count
+      + " mean=" + (String) this->mean() + "us p50=" + (String) this->percentile(50)
+      + "us p99=" + (String) this->percentile(99) + "us max=" + (String) this->max + "us");
+  }
+  #endif
+
+  private: uint8_t bucket(uint32_t us) {
+    uint8_t msb;
+
+    if(us < 4) {
+      return (uint8_t) us;
+    }
+
+    msb = 31 - __builtin_clz(us);
+
+    return 4 + (msb - 2) * 4 + ((us >> (msb - 2)) & 3);
+  }
+
+  private: uint32_t upperBound(uint8_t b) {
+    uint8_t msb, sub;
+
+    if(b < 4) {
+      return b;
+    }
+
+    msb = (b - 4) / 4 + 2;
+    sub = (b - 4) % 4;
+
+    return (((uint32_t) 4 + sub) << (msb - 2)) + ((uint32_t) 1 << (msb - 2)) - 1;
+  }
+
+};
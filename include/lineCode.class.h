@@ -0,0 +1,141 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "packetCodec.class.h"
+
+// Line coding of packets between PRE_PACKET and POST_PACKET, per link profile
+#define LINE_CODE_NONE              (0)
+#define LINE_CODE_6B8B              (1) // 6 bits per balanced UART character
+
+// Line characters carrying `bytes` bytes
+#define LINE_CODE_6B8B_CHARS(bytes) (((bytes) * 8 + 5) / 6)
+
+#define LINE_CODE_INVALID           (0xFF)
+
+/**
+ * Characters with four data bits set, so with the start and stop bits every
+ * character on the line is five ones and five zeros, and no run is longer
+ * than four bits. RESPONSE_BEACON is the one balanced byte left out; the
+ * other line bytes are unbalanced and never codewords.
+ */
+static const uint8_t lineCodeSymbols[64] = {
+  0x0F, 0x17, 0x1B, 0x1D, 0x1E, 0x27, 0x2B, 0x2D,
+  0x2E, 0x33, 0x35, 0x36, 0x39, 0x3A, 0x3C, 0x47,
+  0x4B, 0x4D, 0x4E, 0x53, 0x56, 0x59, 0x5A, 0x5C,
+  0x63, 0x65, 0x66, 0x69, 0x6A, 0x6C, 0x71, 0x72,
+  0x74, 0x78, 0x87, 0x8B, 0x8D, 0x8E, 0x93, 0x95,
+  0x96, 0x99, 0x9A, 0x9C, 0xA3, 0xA5, 0xA6, 0xA9,
+  0xAA, 0xAC, 0xB1, 0xB2, 0xB4, 0xB8, 0xC3, 0xC5,
+  0xC6, 0xC9, 0xCA, 0xCC, 0xD1, 0xD2, 0xD4, 0xD8,
+};
+
+// Six bit value of every line character, LINE_CODE_INVALID for non-codewords
+static const uint8_t lineCodeValues[256] = {
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0xFF, 0xFF, 0xFF, 0x02, 0xFF, 0x03, 0x04, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x05, 0xFF, 0xFF, 0xFF, 0x06, 0xFF, 0x07, 0x08, 0xFF,
+  0xFF, 0xFF, 0xFF, 0x09, 0xFF, 0x0A, 0x0B, 0xFF, 0xFF, 0x0C, 0x0D, 0xFF, 0x0E, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F, 0xFF, 0xFF, 0xFF, 0x10, 0xFF, 0x11, 0x12, 0xFF,
+  0xFF, 0xFF, 0xFF, 0x13, 0xFF, 0xFF, 0x14, 0xFF, 0xFF, 0x15, 0x16, 0xFF, 0x17, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0x18, 0xFF, 0x19, 0x1A, 0xFF, 0xFF, 0x1B, 0x1C, 0xFF, 0x1D, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x1E, 0x1F, 0xFF, 0x20, 0xFF, 0xFF, 0xFF, 0x21, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x22, 0xFF, 0xFF, 0xFF, 0x23, 0xFF, 0x24, 0x25, 0xFF,
+  0xFF, 0xFF, 0xFF, 0x26, 0xFF, 0x27, 0x28, 0xFF, 0xFF, 0x29, 0x2A, 0xFF, 0x2B, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0x2C, 0xFF, 0x2D, 0x2E, 0xFF, 0xFF, 0x2F, 0x30, 0xFF, 0x31, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x32, 0x33, 0xFF, 0x34, 0xFF, 0xFF, 0xFF, 0x35, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0x36, 0xFF, 0x37, 0x38, 0xFF, 0xFF, 0x39, 0x3A, 0xFF, 0x3B, 0xFF, 0xFF, 0xFF,
+  0xFF, 0x3C, 0x3D, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+/**
+ * DC-balanced line code for the 8N1 optical UART. The UART frames every
+ * character itself, so instead of 8b/10b on a raw bit stream, packet bytes
+ * are cut into six bit groups and each group is sent as one balanced
+ * character: four line characters per three bytes, 75% of the plain rate.
+ *
+ * Encoding and decoding are one table lookup per character and work on a
+ * packet in pieces, keeping the bits left over between calls. Characters
+ * that are not codewords are skipped: PRE_PACKET bytes of the preamble
+ * quietly, anything else counted in `invalid`. A lost or corrupted
+ * character misaligns the rest of the packet, which then fails its
+ * checksum and is repeated like any other damaged packet.
+ */
+class lineCode {
+  private: uint32_t tx_bits = 0;
+  private: uint8_t tx_count = 0;
+  private: uint32_t rx_bits = 0;
+  private: uint8_t rx_count = 0;
+
+  public: uint32_t invalid = 0;
+
+  public: void beginEncode() {
+    this->tx_count = 0;
+  }
+
+  // Returns the characters written to line, LINE_CODE_6B8B_CHARS(length) at most
+  public: size_t encode(const uint8_t * data, size_t length, uint8_t * line) {
+    uint8_t * start = line;
+
+    for(size_t n=0; n<length; n++) {
+      this->tx_bits = (this->tx_bits << 8) | data[n];
+      this->tx_count += 8;
+
+      while(this->tx_count >= 6) {
+        this->tx_count -= 6;
+        *line++ = lineCodeSymbols[(this->tx_bits >> this->tx_count) & 0x3F];
+      }
+    }
+
+    return line - start;
+  }
+
+  // Last bits of the packet, padded with zeros; returns 0 or 1 character
+  public: size_t finishEncode(uint8_t * line) {
+    if(this->tx_count == 0) {
+      return 0;
+    }
+
+    *line = lineCodeSymbols[(this->tx_bits << (6 - this->tx_count)) & 0x3F];
+    this->tx_count = 0;
+
+    return 1;
+  }
+
+  public: void beginDecode() {
+    this->rx_count = 0;
+  }
+
+  // Returns the bytes written to data, (6 * length + 6) / 8 at most; padding bits are dropped
+  public: size_t decode(const uint8_t * line, size_t length, uint8_t * data) {
+    uint8_t * start = data;
+
+    for(size_t n=0; n<length; n++) {
+      uint8_t value = lineCodeValues[line[n]];
+
+      if(value == LINE_CODE_INVALID) {
+        if(line[n] != PRE_PACKET) {
+          this->invalid++;
+        }
+
+        continue;
+      }
+
+      this->rx_bits = (this->rx_bits << 6) | value;
+      this->rx_count += 6;
+
+      if(this->rx_count >= 8) {
+        this->rx_count -= 8;
+        *data++ = (uint8_t) (this->rx_bits >> this->rx_count);
+      }
+    }
+
+    return data - start;
+  }
+
+};
@@ -0,0 +1,432 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frameSizeController.class.h"
+
+// Bonded links and frames in flight between sender and receiver
+#define BOND_MAX_LINKS              (4)
+#define BOND_WINDOW                 (16)
+#define BOND_PAYLOAD_MAX            (FRAME_SIZE_MAX_BYTES)
+
+// Bond header: uint32_t sequence, uint16_t length (little endian)
+#define BOND_HEADER_BYTES           (6)
+#define BOND_FRAME_MAX              (BOND_HEADER_BYTES + BOND_PAYLOAD_MAX)
+
+// A link is taken out of rotation after this many failed attempts in a row
+// and probed again with a single frame every BOND_LINK_PROBE_MS
+#define BOND_LINK_DOWN_FAILURES     (4)
+#define BOND_LINK_PROBE_MS          (500)
+
+// Outcome of the frame a channel is sending
+#define BOND_PENDING                (0)
+#define BOND_VERIFIED               (1)
+#define BOND_FAILED                 (2)
+
+/**
+ * One physical transceiver. send() starts a frame; poll() reports whether
+ * the remote unit verified it, and must report BOND_FAILED once the
+ * channel's own verification timeout passes. Each channel runs its own AGC.
+ * A received frame is verified to its sender unless the receiver calls
+ * decline() before taking the next one.
+ */
+class linkChannel {
+  public: virtual ~linkChannel() {}
+
+  // Raw line rate in bytes per second
+  public: virtual uint32_t rate() = 0;
+
+  public: virtual bool send(const uint8_t * frame, size_t length) = 0;
+
+  public: virtual uint8_t poll() = 0;
+
+  // Next frame received from the remote unit, 0 if none
+  public: virtual size_t receive(uint8_t * frame) = 0;
+
+  // Leave the frame receive() just returned unverified, so the remote unit repeats it
+  public: virtual void decline() = 0;
+};
+
+struct bondLink {
+  linkChannel * channel;
+  float error_rate;         // smoothed share of failed attempts
+  int16_t slot;             // window slot in flight, -1 when idle
+  uint32_t busy_until;      // expected completion of the frame in flight
+  uint8_t failures;         // consecutive failed attempts
+  bool up;
+  uint32_t probe_at;
+  uint32_t frames;
+  uint64_t bytes;
+};
+
+struct bondSlot {
+  uint32_t sequence;
+  uint16_t length;
+  bool used;
+  bool in_flight;
+  uint8_t * frame;
+};
+
+/**
+ * Stripes frames across up to BOND_MAX_LINKS channels. An idle link takes
+ * the next frame only if it would get it verified before the other up
+ * links could drain the frames still waiting, using each link's rate
+ * discounted by its smoothed frame error rate, so load follows measured
+ * quality and slow links stay out of the tail of a burst. Frames on a failed attempt go back to the
+ * front of the queue for whichever link is free next. At most BOND_WINDOW
+ * frames are outstanding, which bounds the receiver's reorder buffer.
+ */
+class bondSender {
+  private: bondLink links[BOND_MAX_LINKS];
+  private: uint8_t link_count = 0;
+
+  private: bondSlot slots[BOND_WINDOW];
+  private: uint8_t * storage = NULL;
+  private: uint32_t next_sequence = 0;
+  private: uint32_t oldest_sequence = 0;
+
+  public: uint32_t failovers = 0;
+
+  public: bool begin() {
+    this->storage = (uint8_t *) malloc((size_t) BOND_WINDOW * BOND_FRAME_MAX);
+
+    if(this->storage == NULL) {
+      return false;
+    }
+
+    for(uint8_t s=0; s<BOND_WINDOW; s++) {
+      this->slots[s].used = false;
+      this->slots[s].in_flight = false;
+      this->slots[s].frame = this->storage + (size_t) s * BOND_FRAME_MAX;
+    }
+
+    return true;
+  }
+
+  public: bool addLink(linkChannel * channel) {
+    if(this->link_count >= BOND_MAX_LINKS) {
+      return false;
+    }
+
+    bondLink &link = this->links[this->link_count++];
+
+    link.channel = channel;
+    link.error_rate = 0.0f;
+    link.slot = -1;
+    link.busy_until = 0;
+    link.failures = 0;
+    link.up = true;
+    link.probe_at = 0;
+    link.frames = 0;
+    link.bytes = 0;
+
+    return true;
+  }
+
+  public: uint8_t linkCount() {
+    return this->link_count;
+  }
+
+  public: bondLink &link(uint8_t index) {
+    return this->links[index];
+  }
+
+  public: bool full() {
+    return this->next_sequence - this->oldest_sequence >= BOND_WINDOW;
+  }
+
+  // Frames queued or in flight
+  public: uint32_t outstanding() {
+    return this->next_sequence - this->oldest_sequence;
+  }
+
+  public: bool push(const uint8_t * data, size_t length) {
+    if(this->full() || length > BOND_PAYLOAD_MAX) {
+      return false;
+    }
+
+    bondSlot &slot = this->slots[this->next_sequence % BOND_WINDOW];
+
+    slot.sequence = this->next_sequence++;
+    slot.length = (uint16_t) length;
+    slot.used = true;
+    slot.in_flight = false;
+
+    slot.frame[0] = slot.sequence & 0xFF;
+    slot.frame[1] = (slot.sequence >> 8) & 0xFF;
+    slot.frame[2] = (slot.sequence >> 16) & 0xFF;
+    slot.frame[3] = (slot.sequence >> 24) & 0xFF;
+    slot.frame[4] = length & 0xFF;
+    slot.frame[5] = (length >> 8) & 0xFF;
+
+    memcpy(slot.frame + BOND_HEADER_BYTES, data, length);
+
+    return true;
+  }
+
+  public: void service(uint32_t now) {
+    for(uint8_t l=0; l<this->link_count; l++) {
+      this->collect(this->links[l], now);
+    }
+
+    for(uint8_t l=0; l<this->link_count; l++) {
+      this->dispatch(l, now);
+    }
+
+    // Slide the window past verified frames
+    while(this->oldest_sequence != this->next_sequence && !this->slots[this->oldest_sequence % BOND_WINDOW].used) {
+      this->oldest_sequence++;
+    }
+  }
+
+  // Effective throughput in bytes per second
+  public: uint32_t goodput(uint8_t index) {
+    bondLink &link = this->links[index];
+
+    return (uint32_t) ((float) link.channel->rate() * (1.0f - link.error_rate));
+  }
+
+  private: void collect(bondLink &link, uint32_t now) {
+    uint8_t outcome;
+
+    if(link.slot < 0) {
+      return;
+    }
+
+    outcome = link.channel->poll();
+
+    if(outcome == BOND_PENDING) {
+      return;
+    }
+
+    bondSlot &slot = this->slots[link.slot];
+
+    link.error_rate += FRAME_SIZE_EWMA_WEIGHT * ((outcome == BOND_VERIFIED ? 0.0f : 1.0f) - link.error_rate);
+    slot.in_flight = false;
+    link.slot = -1;
+
+    if(outcome == BOND_VERIFIED) {
+      // A verified probe brings the link back with a fresh error estimate
+      if(!link.up) {
+        link.up = true;
+        link.error_rate = 0.0f;
+      }
+
+      slot.used = false;
+      link.failures = 0;
+      link.frames++;
+      link.bytes += slot.length;
+
+      return;
+    }
+
+    if(++link.failures >= BOND_LINK_DOWN_FAILURES && link.up) {
+      link.up = false;
+      this->failovers++;
+    }
+
+    if(!link.up) {
+      link.probe_at = now + BOND_LINK_PROBE_MS;
+    }
+  }
+
+  private: void dispatch(uint8_t index, uint32_t now) {
+    bondLink &link = this->links[index];
+    int16_t slot;
+    uint32_t cost, waiting, transfer, soonest = UINT32_MAX, fastest = UINT32_MAX;
+    float drain = 0.0f, backlog;
+
+    if(link.slot >= 0 || (!link.up && (int32_t) (now - link.probe_at) < 0)) {
+      return;
+    }
+
+    slot = this->nextSlot();
+
+    if(slot < 0) {
+      return;
+    }
+
+    cost = this->transferTime(link, this->slots[slot].length);
+
+    // Leave the frame to the other links if they would drain the backlog sooner (probes always go)
+    if(link.up) {
+      waiting = this->waiting();
+
+      for(uint8_t l=0; l<this->link_count; l++) {
+        bondLink &other = this->links[l];
+
+        if(l == index || !other.up) {
+          continue;
+        }
+
+        uint32_t remaining = other.slot >= 0 && (int32_t) (other.busy_until - now) > 0 ? other.busy_until - now : 0;
+
+        transfer = this->transferTime(other, this->slots[slot].length);
+
+        if(remaining < soonest) {
+          soonest = remaining;
+        }
+
+        if(remaining + transfer < fastest) {
+          fastest = remaining + transfer;
+        }
+
+        drain += 1.0f / (float) transfer;
+      }
+
+      // No quicker than the fastest single transfer, however many links share the backlog
+      backlog = drain > 0.0f ? (float) soonest + (float) waiting / drain : 0.0f;
+
+      if(drain > 0.0f && (float) cost > (backlog > (float) fastest ? backlog : (float) fastest)) {
+        return;
+      }
+    }
+
+    if(!link.channel->send(this->slots[slot].frame, BOND_HEADER_BYTES + this->slots[slot].length)) {
+      return;
+    }
+
+    this->slots[slot].in_flight = true;
+    link.slot = slot;
+    link.busy_until = now + cost;
+  }
+
+  // Oldest frame that is neither verified nor on a link
+  private: int16_t nextSlot() {
+    for(uint32_t sequence=this->oldest_sequence; sequence!=this->next_sequence; sequence++) {
+      bondSlot &slot = this->slots[sequence % BOND_WINDOW];
+
+      if(slot.used && !slot.in_flight) {
+        return (int16_t) (sequence % BOND_WINDOW);
+      }
+    }
+
+    return -1;
+  }
+
+  private: uint32_t waiting() {
+    uint32_t count = 0;
+
+    for(uint32_t sequence=this->oldest_sequence; sequence!=this->next_sequence; sequence++) {
+      bondSlot &slot = this->slots[sequence % BOND_WINDOW];
+
+      if(slot.used && !slot.in_flight) {
+        count++;
+      }
+    }
+
+    return count;
+  }
+
+  // Expected milliseconds to get a frame verified on this link
+  private: uint32_t transferTime(bondLink &link, uint16_t length) {
+    uint32_t rate = link.channel->rate();
+    float success = 1.0f - link.error_rate;
+
+    if(rate == 0 || success <= 0.0f) {
+      return UINT32_MAX / 2;
+    }
+
+    return (uint32_t) ((float) (BOND_HEADER_BYTES + length) * 1000.0f / ((float) rate * success)) + 1;
+  }
+
+};
+
+/**
+ * Puts frames arriving on any link back in sequence order. Frames already
+ * delivered are dropped, so a frame whose verification was lost and that
+ * was resent on another link arrives only once.
+ */
+class bondReceiver {
+  private: bondSlot slots[BOND_WINDOW];
+  private: uint8_t * storage = NULL;
+  private: uint32_t next_sequence = 0;
+
+  public: uint32_t duplicates = 0;
+  public: uint32_t reordered = 0;
+  public: uint32_t out_of_window = 0;
+
+  public: bool begin() {
+    this->storage = (uint8_t *) malloc((size_t) BOND_WINDOW * BOND_PAYLOAD_MAX);
+
+    if(this->storage == NULL) {
+      return false;
+    }
+
+    for(uint8_t s=0; s<BOND_WINDOW; s++) {
+      this->slots[s].used = false;
+      this->slots[s].frame = this->storage + (size_t) s * BOND_PAYLOAD_MAX;
+    }
+
+    return true;
+  }
+
+  public: void accept(const uint8_t * frame, size_t length) {
+    uint32_t sequence;
+    uint16_t payload;
+
+    if(length < BOND_HEADER_BYTES) {
+      return;
+    }
+
+    sequence = frame[0] | (frame[1] << 8) | (frame[2] << 16) | ((uint32_t) frame[3] << 24);
+    payload = frame[4] | (frame[5] << 8);
+
+    if(payload > BOND_PAYLOAD_MAX || (size_t) (BOND_HEADER_BYTES + payload) > length) {
+      return;
+    }
+
+    if((int32_t) (sequence - this->next_sequence) < 0) {
+      this->duplicates++;
+
+      return;
+    }
+
+    if(sequence - this->next_sequence >= BOND_WINDOW) {
+      this->out_of_window++;
+
+      return;
+    }
+
+    bondSlot &slot = this->slots[sequence % BOND_WINDOW];
+
+    if(slot.used) {
+      this->duplicates++;
+
+      return;
+    }
+
+    if(sequence != this->next_sequence) {
+      this->reordered++;
+    }
+
+    slot.sequence = sequence;
+    slot.length = payload;
+    slot.used = true;
+
+    memcpy(slot.frame, frame + BOND_HEADER_BYTES, payload);
+  }
+
+  // Next in-order payload, 0 while it has not arrived
+  public: size_t pop(uint8_t * dst) {
+    bondSlot &slot = this->slots[this->next_sequence % BOND_WINDOW];
+    size_t length;
+
+    if(!slot.used) {
+      return 0;
+    }
+
+    length = slot.length;
+    memcpy(dst, slot.frame, length);
+
+    slot.used = false;
+    this->next_sequence++;
+
+    return length;
+  }
+
+};
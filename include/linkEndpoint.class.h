@@ -0,0 +1,320 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "frameSizeController.class.h"
+#include "linkSession.class.h"
+#include "packetCodec.class.h"
+#include "rttEstimator.class.h"
+
+// PRE_PACKET / POST_PACKET bytes around each packet. A byte link has no beam to acquire, so a few will do
+#ifndef ENDPOINT_PREAMBLE_BYTES
+#define ENDPOINT_PREAMBLE_BYTES     (8)
+#endif
+
+// Verification pairs per accepted packet, and for the reset packet, after which the receiver may leave
+#define ENDPOINT_VERIFY_REPEAT      (4)
+#define ENDPOINT_RESET_VERIFY_REPEAT (32)
+
+// Longest wrapper packetCodec::build() puts around a payload, terminator included
+#define ENDPOINT_WRAPPER_BYTES      (160)
+#define ENDPOINT_PACKET_BYTES       (FRAME_SIZE_MAX_BYTES + ENDPOINT_WRAPPER_BYTES)
+
+// Wrapper bytes exposed to bit errors, as PACKET_HEADER_BYTES on the device
+#define ENDPOINT_HEADER_BYTES       (118)
+
+// Line output queue: one framed packet plus room for verifications
+#define ENDPOINT_OUTPUT_BYTES       (2 * ENDPOINT_PACKET_BYTES)
+
+// First verification wait beyond the time a full packet takes on the line, then measured (rttEstimator)
+#ifndef ENDPOINT_ACK_SLACK_MS
+#define ENDPOINT_ACK_SLACK_MS       (50)
+#endif
+
+#define ENDPOINT_ACK_MIN_MS         (5)
+#define ENDPOINT_ACK_MAX_MS         (5000)
+
+/**
+ * Receives payloads of packets that passed validation and were not seen
+ * before. Returning false withholds the verification, so the sender repeats
+ * the packet.
+ */
+class linkEndpointSink {
+  public: virtual ~linkEndpointSink() {}
+
+  public: virtual bool deliver(const uint8_t * data, size_t length) = 0;
+};
+
+/**
+ * The optical protocol for a plain byte link (a UART, a tty or a pty):
+ * packets framed by packetCodec, stop-and-wait ARQ with flags pairing each
+ * packet with its verification, linkSession offsets so repeats are verified
+ * but delivered once, and frameSizeController picking the payload size.
+ *
+ * It does no I/O. The owner feeds received bytes to receive(), drains
+ * output() to the line, offers payloads through send() while idle() and
+ * calls poll() periodically to drive retransmission. Times are in microseconds.
+ */
+class linkEndpoint {
+  public: linkSession session;
+  public: frameSizeController frameSize = frameSizeController(FRAME_SIZE_MAX_BYTES, ENDPOINT_HEADER_BYTES,
+    2 * ENDPOINT_PREAMBLE_BYTES + 2 * ENDPOINT_VERIFY_REPEAT);
+
+  // Line rate in bits per second, for the first verification timeout; set before begin()
+  public: uint32_t line_bps = 115200;
+
+  // Packet leaving the output queue to its verification
+  public: rttEstimator ackTimer = rttEstimator(ENDPOINT_ACK_SLACK_MS * 1000, ENDPOINT_ACK_MIN_MS * 1000, ENDPOINT_ACK_MAX_MS * 1000);
+
+  public: uint32_t packets_sent = 0;
+  public: uint32_t retransmits = 0;
+  public: uint64_t bytes_verified = 0;
+  public: uint32_t packets_received = 0;
+  public: uint32_t packets_invalid = 0;
+  public: uint64_t bytes_delivered = 0;
+  public: bool reset_received = false;
+
+  private: linkEndpointSink * sink = NULL;
+
+  // Packet in flight until verified
+  private: uint8_t tx_packet[ENDPOINT_PACKET_BYTES];
+  private: size_t tx_packet_length = 0;
+  private: bool pending = false;
+  private: uint8_t flag = 0;
+  private: uint64_t pending_offset = 0;
+  private: size_t pending_length = 0;
+  private: uint32_t sent_at = 0;           // when the packet left the output queue
+  private: size_t tx_queued = 0;           // output bytes up to the end of the packet
+  private: uint32_t attempts = 0;
+
+  private: uint8_t out[ENDPOINT_OUTPUT_BYTES];
+  private: size_t out_start = 0;
+  private: size_t out_end = 0;
+
+  private: uint8_t rx[ENDPOINT_PACKET_BYTES];
+  private: size_t rx_length = 0;
+  private: bool rx_active = false;
+  private: bool rx_overrun = false;
+  private: uint8_t previous = 0;
+
+  public: void begin(linkEndpointSink * sink, blockDevice * state, uint32_t id) {
+    uint64_t bits = (uint64_t) (ENDPOINT_PACKET_BYTES + 2 * ENDPOINT_PREAMBLE_BYTES + 2 * ENDPOINT_VERIFY_REPEAT) * 10;
+
+    this->sink = sink;
+    this->session.begin(state, id);
+
+    this->ackTimer = rttEstimator(ENDPOINT_ACK_SLACK_MS * 1000 + (uint32_t) (bits * 1000000 / this->line_bps),
+      ENDPOINT_ACK_MIN_MS * 1000, ENDPOINT_ACK_MAX_MS * 1000);
+  }
+
+  // Whether the previous payload was verified and send() takes the next one
+  public: bool idle() {
+    return !this->pending;
+  }
+
+  /**
+   * Frame up to frameSize.size() bytes as the next packet. A reset packet
+   * ends the stream. Fails if busy or the payload cannot be framed.
+   */
+  public: bool send(const uint8_t * data, size_t length, bool reset, uint32_t now) {
+    packetFields packet;
+
+    if(this->pending || length > this->frameSize.size() || !packetCodec::representable(data, length)) {
+      return false;
+    }
+
+    this->flag = this->flag >= 128 ? 1 : this->flag + 1;
+
+    packet.flag = this->flag;
+    packet.session = this->session.id;
+    packet.offset = this->session.frame(length);
+    packet.data = data;
+    packet.length = length;
+    packet.reset = reset;
+
+    this->tx_packet_length = packetCodec::build(packet, this->tx_packet, sizeof(this->tx_packet));
+
+    if(this->tx_packet_length == 0) {
+      return false;
+    }
+
+    this->pending = true;
+    this->pending_offset = packet.offset;
+    this->pending_length = length;
+    this->attempts = 0;
+    this->packets_sent++;
+
+    this->stream(now);
+
+    return true;
+  }
+
+  // Stream the unverified packet again once its verification is overdue
+  public: void poll(uint32_t now) {
+    if(!this->pending) {
+      return;
+    }
+
+    // The timeout runs from when the packet left the queue
+    if(this->tx_queued > 0) {
+      return;
+    }
+
+    if(now - this->sent_at < this->ackTimer.timeout()) {
+      return;
+    }
+
+    this->ackTimer.backoff();
+    this->frameSize.recordAttempt(false);
+    this->retransmits++;
+    this->attempts++;
+
+    this->stream(now);
+  }
+
+  // Bytes waiting for the line; report what was written with written()
+  public: size_t output(const uint8_t * &bytes) {
+    bytes = this->out + this->out_start;
+
+    return this->out_end - this->out_start;
+  }
+
+  public: void written(size_t count, uint32_t now) {
+    this->out_start += count;
+
+    if(this->tx_queued > 0) {
+      this->tx_queued = count < this->tx_queued ? this->tx_queued - count : 0;
+
+      if(this->tx_queued == 0) {
+        this->sent_at = now;
+      }
+    }
+
+    if(this->out_start >= this->out_end) {
+      this->out_start = this->out_end = 0;
+    }
+  }
+
+  public: void receive(const uint8_t * bytes, size_t count, uint32_t now) {
+    for(size_t n=0; n<count; n++) {
+      uint8_t byte = bytes[n];
+
+      if(this->rx_active) {
+        if(byte == POST_PACKET) {
+          this->rx_active = false;
+          this->accept();
+        } else if(this->rx_length < sizeof(this->rx)) {
+          this->rx[this->rx_length++] = byte;
+        } else {
+          this->rx_overrun = true;
+        }
+
+        continue;
+      }
+
+      // A flag after RESPONSE_VERIFICATION may take any value, PRE_PACKET included
+      if(this->previous == RESPONSE_VERIFICATION) {
+        this->previous = 0;
+
+        if(this->pending && byte == this->flag) {
+          this->verified(now);
+        }
+
+        continue;
+      }
+
+      if(byte == PRE_PACKET) {
+        this->rx_active = true;
+        this->rx_overrun = false;
+        this->rx_length = 0;
+      }
+
+      this->previous = byte;
+    }
+  }
+
+  private: void stream(uint32_t now) {
+    if(!this->room(this->tx_packet_length + 2 * ENDPOINT_PREAMBLE_BYTES)) {
+      return;
+    }
+
+    memset(this->out + this->out_end, PRE_PACKET, ENDPOINT_PREAMBLE_BYTES);
+    this->out_end += ENDPOINT_PREAMBLE_BYTES;
+
+    memcpy(this->out + this->out_end, this->tx_packet, this->tx_packet_length);
+    this->out_end += this->tx_packet_length;
+
+    memset(this->out + this->out_end, POST_PACKET, ENDPOINT_PREAMBLE_BYTES);
+    this->out_end += ENDPOINT_PREAMBLE_BYTES;
+
+    this->tx_queued = this->out_end;
+    this->sent_at = now;
+  }
+
+  private: void verified(uint32_t now) {
+    // Only an unrepeated packet times the round trip (Karn)
+    if(this->attempts == 0) {
+      this->ackTimer.sample(now - this->sent_at);
+    }
+
+    this->pending = false;
+    this->session.acknowledged(this->pending_offset, this->pending_length);
+    this->frameSize.recordAttempt(true);
+    this->bytes_verified += this->pending_length;
+  }
+
+  private: void accept() {
+    packetFields packet;
+
+    if(this->rx_overrun || !packetCodec::parse(this->rx, this->rx_length, FRAME_SIZE_MAX_BYTES, packet)) {
+      this->packets_invalid++;
+
+      return;
+    }
+
+    this->packets_received++;
+
+    if(!this->session.duplicate(packet.session, packet.offset, packet.length)) {
+      // Straight from the receive buffer; committed before the packet is verified
+      if(this->sink != NULL && !this->sink->deliver(packet.data, packet.length)) {
+        return;
+      }
+
+      this->session.commit(packet.offset, packet.length);
+      this->bytes_delivered += packet.length;
+    }
+
+    if(packet.reset) {
+      this->reset_received = true;
+    }
+
+    this->verify(packet.flag, packet.reset ? ENDPOINT_RESET_VERIFY_REPEAT : ENDPOINT_VERIFY_REPEAT);
+  }
+
+  private: void verify(uint8_t flag, uint8_t times) {
+    if(!this->room(2 * times)) {
+      return;
+    }
+
+    for(uint8_t n=0; n<times; n++) {
+      this->out[this->out_end++] = RESPONSE_VERIFICATION;
+      this->out[this->out_end++] = flag;
+    }
+  }
+
+  // Make room for `bytes` more output, moving what is left to the front
+  private: bool room(size_t bytes) {
+    if(this->out_start > 0) {
+      memmove(this->out, this->out + this->out_start, this->out_end - this->out_start);
+      this->out_end -= this->out_start;
+      this->out_start = 0;
+    }
+
+    return this->out_end + bytes <= sizeof(this->out);
+  }
+
+};
@@ -0,0 +1,75 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+
+#include "pulseDetector.class.h"
+#include "frameSizeController.class.h"
+#include "lineCode.class.h"
+
+// Line code of the default profile; both ends must agree
+#ifndef LINK_LINE_CODE
+#define LINK_LINE_CODE              LINE_CODE_NONE
+#endif
+
+/**
+ * Link rate, framing and detection thresholds, resolved at compile time.
+ * Both ends of the link must run the same profile.
+ */
+struct linkProfile {
+  uint32_t frequency;               // optical clock in Hz
+  uint32_t baud;                    // frequency*2
+  uint16_t frame_size;              // initial payload size
+  uint8_t preamble_ms;              // pre/post packet duration
+  uint32_t pulse_timeout_us;        // pulseIn timeout, two clock periods
+  pulseDetector detector;           // windows in 1/16 us
+  uint16_t attempt_overhead_bytes;  // link time per attempt outside the packet, in byte times
+  uint8_t load_increment;           // AGC load step
+  uint8_t line_code;                // LINE_CODE_*, applied to packets
+
+  constexpr linkProfile(uint32_t frequency, uint16_t frame_size, uint8_t preamble_ms, uint8_t line_code = LINE_CODE_NONE)
+    : frequency(frequency), baud(frequency * 2), frame_size(frame_size), preamble_ms(preamble_ms),
+      pulse_timeout_us(2000000UL / frequency),
+      detector(pulseDetector::period(frequency)),
+      attempt_overhead_bytes((uint16_t) ((2 * preamble_ms + PACKET_VERIFICATION_WAIT_MS) * (frequency * 2 / 10) / 1000)),
+      load_increment((uint8_t) agcSearch::loadIncrement(frequency)),
+      line_code(line_code) {}
+
+  // Line characters a packet of `bytes` takes
+  constexpr size_t lineBytes(size_t bytes) const {
+    return this->line_code == LINE_CODE_6B8B ? LINE_CODE_6B8B_CHARS(bytes) : bytes;
+  }
+
+  constexpr bool consistent() const {
+    return this->detector.lower > 0
+        && this->detector.lower < this->detector.upper
+        && this->detector.lower_valid < this->detector.upper_valid
+        && this->detector.measurable()
+        && this->frame_size >= FRAME_SIZE_MIN_BYTES
+        && this->frame_size <= FRAME_SIZE_MAX_BYTES
+        && this->load_increment > 0
+        && this->line_code <= LINE_CODE_6B8B;
+  }
+};
+
+constexpr linkProfile linkProfiles[] = {
+  linkProfile(FREQUENCY, PACKET_DATA_SIZE_BYTES, PRE_POST_PACKET_DURATION_MS, LINK_LINE_CODE), // 0: default
+  linkProfile(50000, 256, 8),                                                   // 1: long range
+  linkProfile(250000, 1024, 3),                                                 // 2: fast
+  linkProfile(500000, 2048, 2),                                                 // 3: short range
+  linkProfile(500000, 2048, 2, LINE_CODE_6B8B),                                 // 4: short range, DC balanced
+};
+
+#define LINK_PROFILE_COUNT          (sizeof(linkProfiles) / sizeof(linkProfiles[0]))
+
+#ifndef LINK_PROFILE_DEFAULT
+#define LINK_PROFILE_DEFAULT        (0)
+#endif
+
+constexpr bool linkProfilesConsistent(uint8_t index = 0) {
+  return index >= LINK_PROFILE_COUNT || (linkProfiles[index].consistent() && linkProfilesConsistent(index + 1));
+}
+
+static_assert(linkProfilesConsistent(), "link profile thresholds or frame size out of range");
+static_assert(LINK_PROFILE_DEFAULT < LINK_PROFILE_COUNT, "LINK_PROFILE_DEFAULT is not a link profile");
@@ -0,0 +1,285 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blockDevice.class.h"
+#include "blockHeader.class.h"
+#include "linkBonding.class.h"
+
+// Relay frames carry the bond header (uint32_t sequence, uint16_t length), so a hop can tell a repeat
+#define RELAY_FRAME_MAX             (BOND_FRAME_MAX)
+
+// Frames held in RAM while the outbound link is busy, before they spill to the store
+#ifndef RELAY_RAM_FRAMES
+#define RELAY_RAM_FRAMES            (8)
+#endif
+
+// Store blocks per spilled frame: block header and frame
+#define RELAY_SLOT_BLOCKS           ((BLOCK_HEADER_BYTES + RELAY_FRAME_MAX + BLOCK_DEVICE_BLOCK_SIZE - 1) / BLOCK_DEVICE_BLOCK_SIZE)
+
+/**
+ * Forwards frames arriving on one optical port out of another, for a unit
+ * in the middle of a chain. A unit with two ports runs one relay per
+ * direction, each with its own store region.
+ *
+ * A frame that arrives while the outbound link is idle and nothing is
+ * queued goes straight from the receive buffer to the link (cut-through).
+ * Otherwise it waits in RAM, and once RELAY_RAM_FRAMES are waiting, in
+ * fixed slots of the store, sealed with a blockHeader so a torn slot is
+ * recognised when it is read back. Frames leave in arrival order.
+ *
+ * Acks are per hop: a frame is verified upstream once the relay kept it,
+ * and is kept and repeated until the next unit verifies it. A frame the
+ * store could not take is declined, and the upstream unit repeats it.
+ * receive() is only called while there is room, so a full relay holds
+ * the upstream unit off rather than dropping. Each hop is stop-and-wait in
+ * order, so a repeat of a frame whose verification was lost always has the
+ * sequence of the frame before it and is dropped here.
+ */
+class linkRelay {
+  private: linkChannel * from = NULL;
+  private: linkChannel * to = NULL;
+
+  private: blockDevice * store = NULL;
+  private: uint32_t first_block = 0;
+  private: uint32_t slot_count = 0;
+  private: uint32_t store_head = 0;
+  private: uint32_t store_count = 0;
+
+  private: uint8_t * storage = NULL;
+  private: uint8_t * ram = NULL;
+  private: uint16_t ram_length[RELAY_RAM_FRAMES];
+  private: uint8_t ram_head = 0;
+  private: uint8_t ram_count = 0;
+
+  // Block image of a store slot, frame after the header
+  private: uint8_t * slot = NULL;
+
+  // Frame taken by cut-through or read back from the store
+  private: uint8_t * current = NULL;
+
+  // Frame owned by the outbound link until verified; NULL when idle
+  private: const uint8_t * outgoing = NULL;
+  private: size_t outgoing_length = 0;
+  private: bool outgoing_ram = false;
+  private: bool sending = false;
+
+  private: uint32_t last_sequence = 0;
+  private: bool seen = false;
+
+  public: uint32_t cut_through = 0;
+  public: uint32_t queued = 0;
+  public: uint32_t spilled = 0;
+  public: uint32_t forwarded = 0;
+  public: uint32_t retries = 0;
+  public: uint32_t duplicates = 0;
+  public: uint32_t invalid = 0;
+  public: uint32_t declined = 0;       // store write failed: left unverified upstream
+  public: uint32_t lost = 0;           // slot read back torn
+
+  /**
+   * Relay frames from one channel to the other. Spilled frames use
+   * blocks first_block.. of store, up to `blocks` of them; without a store
+   * the relay holds only RELAY_RAM_FRAMES.
+   */
+  public: bool begin(linkChannel * from, linkChannel * to, blockDevice * store, uint32_t first_block, uint32_t blocks) {
+    this->from = from;
+    this->to = to;
+    this->store = store;
+    this->first_block = first_block;
+    this->slot_count = store != NULL ? blocks / RELAY_SLOT_BLOCKS : 0;
+
+    this->storage = (uint8_t *) malloc((size_t) (RELAY_RAM_FRAMES + 1) * RELAY_FRAME_MAX
+      + RELAY_SLOT_BLOCKS * BLOCK_DEVICE_BLOCK_SIZE);
+
+    if(this->storage == NULL) {
+      return false;
+    }
+
+    this->ram = this->storage;
+    this->current = this->ram + (size_t) RELAY_RAM_FRAMES * RELAY_FRAME_MAX;
+    this->slot = this->current + RELAY_FRAME_MAX;
+
+    return true;
+  }
+
+  // Frames taken from upstream and not yet verified downstream
+  public: uint32_t held() {
+    return this->ram_count + this->store_count + (this->outgoing != NULL && !this->outgoing_ram ? 1 : 0);
+  }
+
+  public: void service(uint32_t now) {
+    this->forward();
+    this->take(now);
+  }
+
+  private: void forward() {
+    if(this->sending) {
+      uint8_t outcome = this->to->poll();
+
+      if(outcome == BOND_PENDING) {
+        return;
+      }
+
+      this->sending = false;
+
+      if(outcome == BOND_FAILED) {
+        this->retries++;
+      } else {
+        if(this->outgoing_ram) {
+          this->ram_head = (this->ram_head + 1) % RELAY_RAM_FRAMES;
+          this->ram_count--;
+        }
+
+        this->outgoing = NULL;
+        this->forwarded++;
+      }
+    }
+
+    if(this->outgoing == NULL && !this->dequeue()) {
+      return;
+    }
+
+    this->sending = this->to->send(this->outgoing, this->outgoing_length);
+  }
+
+  private: void take(uint32_t now) {
+    for(;;) {
+      bool cut = this->outgoing == NULL && this->ram_count == 0 && this->store_count == 0;
+      bool in_ram = !cut && this->ram_count < RELAY_RAM_FRAMES && this->store_count == 0;
+      uint8_t * frame;
+      size_t length;
+      uint32_t sequence;
+
+      if(cut) {
+        frame = this->current;
+      } else if(in_ram) {
+        frame = this->ram + (size_t) ((this->ram_head + this->ram_count) % RELAY_RAM_FRAMES) * RELAY_FRAME_MAX;
+      } else if(this->store_count < this->slot_count) {
+        frame = this->slot + BLOCK_HEADER_BYTES;
+      } else {
+        // Full: frames stay upstream until there is room
+        return;
+      }
+
+      length = this->from->receive(frame);
+
+      if(length == 0) {
+        return;
+      }
+
+      if(!this->check(frame, length, sequence)) {
+        this->invalid++;
+
+        continue;
+      }
+
+      if(this->seen && sequence == this->last_sequence) {
+        this->duplicates++;
+
+        continue;
+      }
+
+      // Not kept, so not verified: the repeat is not a duplicate either
+      if(!cut && !in_ram && !this->spill(length, sequence, now)) {
+        this->from->decline();
+        this->declined++;
+
+        return;
+      }
+
+      this->seen = true;
+      this->last_sequence = sequence;
+
+      if(cut) {
+        this->outgoing = this->current;
+        this->outgoing_length = length;
+        this->outgoing_ram = false;
+        this->cut_through++;
+
+        this->sending = this->to->send(this->outgoing, this->outgoing_length);
+      } else if(in_ram) {
+        this->ram_length[(this->ram_head + this->ram_count) % RELAY_RAM_FRAMES] = (uint16_t) length;
+        this->ram_count++;
+        this->queued++;
+      }
+    }
+  }
+
+  // Write a received frame to the next free store slot; false if the store did not take it
+  private: bool spill(size_t length, uint32_t sequence, uint32_t now) {
+    blockHeader header;
+    uint32_t index = (this->store_head + this->store_count) % this->slot_count;
+
+    header.queue = BLOCK_QUEUE_RELAY;
+    header.length = (uint16_t) length;
+    header.sequence = sequence;
+    header.timestamp = now;
+    header.seal(this->slot);
+
+    if(!this->store->writeBlocks(this->first_block + index * RELAY_SLOT_BLOCKS, this->slot, RELAY_SLOT_BLOCKS)) {
+      return false;
+    }
+
+    this->store_count++;
+    this->spilled++;
+
+    return true;
+  }
+
+  // Oldest waiting frame onto the outbound link: RAM first, it only fills while the store is empty
+  private: bool dequeue() {
+    blockHeader header;
+
+    if(this->ram_count > 0) {
+      this->outgoing = this->ram + (size_t) this->ram_head * RELAY_FRAME_MAX;
+      this->outgoing_length = this->ram_length[this->ram_head];
+      this->outgoing_ram = true;
+
+      return true;
+    }
+
+    while(this->store_count > 0) {
+      uint32_t block = this->first_block + this->store_head * RELAY_SLOT_BLOCKS;
+
+      this->store_head = (this->store_head + 1) % this->slot_count;
+      this->store_count--;
+
+      if(!this->store->readBlocks(block, this->slot, RELAY_SLOT_BLOCKS)
+          || !blockHeader::read(this->slot, RELAY_SLOT_BLOCKS * BLOCK_DEVICE_BLOCK_SIZE, header)
+          || header.queue != BLOCK_QUEUE_RELAY) {
+        this->lost++;
+
+        continue;
+      }
+
+      memcpy(this->current, this->slot + BLOCK_HEADER_BYTES, header.length);
+
+      this->outgoing = this->current;
+      this->outgoing_length = header.length;
+      this->outgoing_ram = false;
+
+      return true;
+    }
+
+    return false;
+  }
+
+  private: static bool check(const uint8_t * frame, size_t length, uint32_t &sequence) {
+    uint16_t payload;
+
+    if(length < BOND_HEADER_BYTES) {
+      return false;
+    }
+
+    sequence = frame[0] | (frame[1] << 8) | (frame[2] << 16) | ((uint32_t) frame[3] << 24);
+    payload = frame[4] | (frame[5] << 8);
+
+    return payload <= BOND_PAYLOAD_MAX && (size_t) (BOND_HEADER_BYTES + payload) == length;
+  }
+
+};
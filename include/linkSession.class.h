@@ -0,0 +1,185 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "blockDevice.class.h"
+
+// Reserved block below the ring buffer holding the receiver's session record
+#ifndef SESSION_RECORD_BLOCK
+#define SESSION_RECORD_BLOCK        (BUFFER_OUTGOING_START - 1)
+#endif
+
+#define SESSION_RECORD_MAGIC        (0x5350434F) // "OCPS"
+
+// Sender: no verification within this many attempts at the frame's line time means the beam was lost
+#define SESSION_LINK_LOSS_ATTEMPTS  (4)
+
+// ...and never in less than this, so short frames still ride out a brief interruption
+#define SESSION_LINK_LOSS_MS        (250)
+
+// Receiver: no packet for this long means the sender is gone (must exceed TRANS_DELAY_MS)
+#define SESSION_IDLE_TIMEOUT_MS     (TRANS_DELAY_MS * 2)
+
+struct __attribute__((packed)) linkSessionRecord {
+  uint32_t magic;
+  uint32_t peer_id;
+  uint64_t rx_committed;
+  uint32_t check;
+};
+
+/**
+ * Session state on both ends of the link.
+ *
+ * Every packet carries the sender's session id and the stream offset of its
+ * first byte. The sender keeps an unverified packet until it is confirmed,
+ * across link loss, and streams it again after reacquisition. The receiver
+ * stores how far into the peer's stream it has committed data before it
+ * verifies a packet, so a repeated packet is confirmed but not delivered twice,
+ * even after a receiver restart.
+ *
+ * A deferred session leaves the store to persistPending(), called from
+ * another task, so card latency stays off the link. The record then trails
+ * the link by one call, and a restart may deliver the packets since again.
+ */
+class linkSession {
+  // sender side
+  public: uint32_t id = 0;
+  public: uint64_t tx_offset = 0;
+  public: uint64_t tx_acked = 0;
+  public: uint32_t resumes = 0;
+
+  // receiver side
+  public: uint32_t peer_id = 0;
+  public: uint64_t rx_committed = 0;
+  public: uint32_t duplicates = 0;
+
+  private: blockDevice * device = NULL;
+  private: uint8_t record[BLOCK_DEVICE_BLOCK_SIZE];
+
+  // Deferred: record waiting for persistPending(), odd pending_sequence while commit() writes it
+  private: bool deferred = false;
+  private: linkSessionRecord pending;
+  private: uint32_t pending_sequence = 0;
+  private: uint32_t persisted_sequence = 0;
+
+  public: void begin(blockDevice * device, uint32_t id, bool deferred = false) {
+    linkSessionRecord stored;
+
+    this->device = device;
+    this->id = id;
+    this->deferred = deferred;
+
+    if(this->device == NULL || !this->device->readBlock(SESSION_RECORD_BLOCK, this->record)) {
+      return;
+    }
+
+    memcpy(&stored, this->record, sizeof(stored));
+
+    if(stored.magic == SESSION_RECORD_MAGIC && stored.check == this->check(stored)) {
+      this->peer_id = stored.peer_id;
+      this->rx_committed = stored.rx_committed;
+    }
+  }
+
+  // Stream offset for the next packet of `length` bytes
+  public: uint64_t frame(size_t length) {
+    uint64_t offset = this->tx_offset;
+
+    this->tx_offset += length;
+
+    return offset;
+  }
+
+  public: void acknowledged(uint64_t offset, size_t length) {
+    this->tx_acked = offset + length;
+  }
+
+  /**
+   * Whether the receiver already committed this packet. A packet from an
+   * unknown session starts a new one at its offset.
+   */
+  public: bool duplicate(uint32_t peer_id, uint64_t offset, size_t length) {
+    if(peer_id != this->peer_id) {
+      this->peer_id = peer_id;
+      this->rx_committed = offset;
+
+      return false;
+    }
+
+    if(offset + length <= this->rx_committed) {
+      this->duplicates++;
+
+      return true;
+    }
+
+    return false;
+  }
+
+  public: void commit(uint64_t offset, size_t length) {
+    this->rx_committed = offset + length;
+
+    if(!this->deferred) {
+      this->persist(this->peer_id, this->rx_committed);
+
+      return;
+    }
+
+    __atomic_add_fetch(&this->pending_sequence, 1, __ATOMIC_ACQ_REL);
+
+    this->pending.peer_id = this->peer_id;
+    this->pending.rx_committed = this->rx_committed;
+
+    __atomic_add_fetch(&this->pending_sequence, 1, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Store the latest commit() of a deferred session, if it was not stored
+   * yet. Returns whether the card was written.
+   */
+  public: bool persistPending() {
+    uint32_t sequence;
+    uint32_t peer_id;
+    uint64_t rx_committed;
+
+    do {
+      sequence = __atomic_load_n(&this->pending_sequence, __ATOMIC_ACQUIRE);
+
+      peer_id = this->pending.peer_id;
+      rx_committed = this->pending.rx_committed;
+    } while((sequence & 1) != 0 || sequence != __atomic_load_n(&this->pending_sequence, __ATOMIC_ACQUIRE));
+
+    if(sequence == this->persisted_sequence) {
+      return false;
+    }
+
+    this->persisted_sequence = sequence;
+
+    return this->persist(peer_id, rx_committed);
+  }
+
+  private: bool persist(uint32_t peer_id, uint64_t rx_committed) {
+    linkSessionRecord stored;
+
+    if(this->device == NULL) {
+      return false;
+    }
+
+    stored.magic = SESSION_RECORD_MAGIC;
+    stored.peer_id = peer_id;
+    stored.rx_committed = rx_committed;
+    stored.check = this->check(stored);
+
+    memset(this->record, 0, sizeof(this->record));
+    memcpy(this->record, &stored, sizeof(stored));
+
+    return this->device->writeBlock(SESSION_RECORD_BLOCK, this->record);
+  }
+
+  private: uint32_t check(linkSessionRecord &stored) {
+    return ~(stored.magic ^ stored.peer_id ^ (uint32_t) stored.rx_committed ^ (uint32_t) (stored.rx_committed >> 32));
+  }
+
+};
@@ -0,0 +1,118 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * MD5 (RFC 1321) for packet checksums, in plain C++ so the packet codec
+ * builds the same on the ESP32 and on Linux.
+ */
+class md5Digest {
+  private: uint32_t state[4];
+  private: uint64_t total = 0;
+  private: uint8_t buffer[64];
+
+  public: md5Digest() {
+    this->begin();
+  }
+
+  public: void begin() {
+    this->state[0] = 0x67452301;
+    this->state[1] = 0xEFCDAB89;
+    this->state[2] = 0x98BADCFE;
+    this->state[3] = 0x10325476;
+    this->total = 0;
+  }
+
+  public: void add(const uint8_t * data, size_t length) {
+    size_t used = (size_t) (this->total % 64);
+
+    this->total += length;
+
+    while(length > 0) {
+      size_t chunk = 64 - used < length ? 64 - used : length;
+
+      memcpy(this->buffer + used, data, chunk);
+
+      used += chunk;
+      data += chunk;
+      length -= chunk;
+
+      if(used == 64) {
+        this->transform(this->buffer);
+        used = 0;
+      }
+    }
+  }
+
+  // Finish and write the digest as 32 lowercase hex characters (not terminated)
+  public: void hex(char * out) {
+    static const char digits[] = "0123456789abcdef";
+    uint8_t padding[72] = { 0x80 };
+    uint64_t bits = this->total * 8;
+    size_t used = (size_t) (this->total % 64);
+    size_t pad = used < 56 ? 56 - used : 120 - used;
+
+    for(uint8_t b=0; b<8; b++) {
+      padding[pad + b] = (uint8_t) (bits >> (8 * b));
+    }
+
+    this->add(padding, pad + 8);
+
+    for(uint8_t n=0; n<16; n++) {
+      uint8_t byte = (uint8_t) (this->state[n / 4] >> (8 * (n % 4)));
+
+      out[2 * n] = digits[byte >> 4];
+      out[2 * n + 1] = digits[byte & 0x0F];
+    }
+  }
+
+  private: static uint32_t rotate(uint32_t x, uint8_t c) {
+    return (x << c) | (x >> (32 - c));
+  }
+
+  private: void transform(const uint8_t * block) {
+    static const uint32_t k[64] = {
+      0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+      0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+      0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+      0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+      0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+      0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+      0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+      0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+    };
+    static const uint8_t r[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+    uint32_t m[16], a = this->state[0], b = this->state[1], c = this->state[2], d = this->state[3];
+
+    for(uint8_t n=0; n<16; n++) {
+      m[n] = block[4 * n] | (block[4 * n + 1] << 8) | (block[4 * n + 2] << 16) | ((uint32_t) block[4 * n + 3] << 24);
+    }
+
+    for(uint8_t n=0; n<64; n++) {
+      uint32_t f, g;
+
+      switch(n / 16) {
+        case 0:  f = (b & c) | (~b & d); g = n; break;
+        case 1:  f = (d & b) | (~d & c); g = (5 * n + 1) % 16; break;
+        case 2:  f = b ^ c ^ d;          g = (3 * n + 5) % 16; break;
+        default: f = c ^ (b | ~d);       g = (7 * n) % 16; break;
+      }
+
+      f += a + k[n] + m[g];
+      a = d;
+      d = c;
+      c = b;
+      b += md5Digest::rotate(f, r[(n / 16) * 4 + n % 4]);
+    }
+
+    this->state[0] += a;
+    this->state[1] += b;
+    this->state[2] += c;
+    this->state[3] += d;
+  }
+
+};
@@ -1,764 +1,1406 @@
-using namespace std;
-
-#pragma once
-
-// Pin allocations
-#define DATA_PIN                    (32)
-#define LASER_PIN                   (27)
-#define GAIN_PIN                    (33)
-#define LOAD_PIN                    (25)
-
-// Define optical interface clock frequency in Hz. Baud rate = frequency*2
-#define FREQUENCY                   (100000)
-#define INCOMING_BUFFER_DEPTH       (16384)
-
-// Signal pulse bounds
-#define LOWER_DETECTABLE            period/2 - period/16;
-#define UPPER_DETECTABLE            period/2 + period/16;
-#define LOWER_VALID                 period/4 + period/16;
-#define UPPER_VALID                 period/2 + (3*period)/16;
-
-// Operational modes
-#define OP_MODE_IDLE                (0) // Idle (default)
-#define OP_MODE_TRANSMITTING        (1) // Tranmission mode
-#define OP_MODE_PENDING             (2) // Checking for subsequent packets
-#define OP_MODE_RECEIVING           (3) // Receiving mode
-
-// Transmission modes/stages (in order)
-#define MODE_IDLE                   (0) // Idle (default)
-#define MODE_BEACON                 (1) // Stream square wave beacon
-#define MODE_STREAM                 (2) // Stream packet and await verification
-
-// Response types
-#define RESPONSE_BEACON             (0x55)
-#define RESPONSE_VERIFICATION       (0xA7)
-#define PRE_PACKET                  (0x5E)
-#define POST_PACKET                 (0x7C)
-
-// Packet sizing
-#define PACKET_DATA_SIZE_BYTES      (512)
-#define PACKET_WRAPPER_SIZE_BYTES   (256)
-
-// Packet pulsing
-#define TRANS_DELAY_MS              (1000)
-#define BEACON_TIMEOUT_MS           (500)
-#define PACKET_TIMEOUT_MS           (100)
-#define PULSE_TIMEOUT_MS            (20)
-#define RESPONSE_TIMEOUT_MS         (30000)
-#define PRE_POST_PACKET_DURATION_MS (5)
-
-long pulse1, pulse2;
-
-class opticalInterface {
-  private: char flag_packet_header[7] PROGMEM         = "[flag]";
-  private: char data_packet_header[7] PROGMEM         = "[data]";
-  private: char checksum_packet_header[11] PROGMEM    = "[checksum]";
-  private: char length_packet_header[9] PROGMEM       = "[length]";
-  private: char packet_footer[9] PROGMEM              = "[footer]";
-  private: char packet_reset[6] PROGMEM               = "[rst]";
-
-  private: uint8_t operational_mode = OP_MODE_IDLE;
-  private: uint8_t transmission_mode = MODE_IDLE;
-  private: uint64_t completion = 0;
-
-  private: double period = 1000000 / FREQUENCY;
-  private: long baud = FREQUENCY * 2;
-
-  private: double lower = LOWER_DETECTABLE;
-  private: double upper = UPPER_DETECTABLE;
-  private: double lower_valid = LOWER_VALID;
-  private: double upper_valid = UPPER_VALID;
-
-  private: size_t packet_buffer_size = (size_t) (PACKET_DATA_SIZE_BYTES + PACKET_WRAPPER_SIZE_BYTES + 512);
-  private: size_t data_buffer_size = (size_t) 768;
-  private: uint8_t packet_buffer[(size_t) (PACKET_DATA_SIZE_BYTES + PACKET_WRAPPER_SIZE_BYTES + 512)];
-  private: uint8_t data_buffer[(size_t) 768];
-
-  public: uint32_t outgoingBlockPointer;
-  private: uint8_t _outgoingPacketFlag = 0;
-  private: uint8_t _incomingPacketFlag = 0;
-  private: uint8_t _expectingIncomingPacketFlag = 1;
-
-  private: bool remote_unit_responding = false;
-  private: long last_remote_unit_response = 0;
-  private: bool received_packet_verification = false;
-  private: bool incoming_packet_detected = false;
-  private: bool expecting_incoming_packet = false;
-
-  private: bool data_ready = false;
-  private: String incomingData;
-
-  private: bool notified = true;
-  private: bool _reset = false;
-
-  public: void initialize(dataManager &dataManager, uartInterface &portUart) {
-    // Optical interface pins
-    pinMode(DATA_PIN, INPUT);
-    pinMode(LASER_PIN, OUTPUT);
-
-    // Digital potentiometers
-    pinMode(GAIN_PIN, OUTPUT);
-    pinMode(LOAD_PIN, OUTPUT);
-
-    this->outgoingBlockPointer = dataManager.outgoingBlockPointer;
-
-    size_t buffer_depth = INCOMING_BUFFER_DEPTH;
-
-    // Initialize optical interface
-    opticalLink.begin(this->baud, SERIAL_8N1, DATA_PIN, LASER_PIN, true);
-    opticalLink.setRxBufferSize(buffer_depth);
-
-    // Allow cooldown time before continuing
-    delay(100);
-  }
-
-  private: bool dataAvailableForTransmission(dataManager &dataManager) {
-    return dataManager.outgoingBytePointer > 0
-        || dataManager.outgoingBlockPointer != this->outgoingBlockPointer;
-  }
-
-  private: bool dataAvailableBufferBlocks(dataManager &dataManager) {
-    return dataManager.outgoingBlockPointer != this->outgoingBlockPointer;
-  }
-
-  public: void processOutgoing(dataManager &dataManager, uartInterface &portUart) {
-    bool packet_verification_detected;
-
-    if(this->operational_mode == OP_MODE_RECEIVING) {
-      return;
-    }
-
-    if(this->operational_mode == OP_MODE_IDLE || this->operational_mode == OP_MODE_PENDING) {
-      if(portUart.data_available && ((millis() - portUart.last_data_available) > TRANS_DELAY_MS)) {
-        if(this->dataAvailableForTransmission(dataManager)) {
-          this->activateTransmission(dataManager, portUart);
-        } else {
-          this->operational_mode = OP_MODE_IDLE;
-          this->transmission_mode = MODE_IDLE;
-        }
-      } else {
-        this->operational_mode = OP_MODE_IDLE;
-        this->transmission_mode = MODE_IDLE;
-      }
-    }
-    
-    if(this->operational_mode != OP_MODE_TRANSMITTING) {
-      return;
-    }
-
-    switch (this->transmission_mode) {
-      case MODE_IDLE:
-        this->transmission_mode = MODE_BEACON;
-      break;
-    
-      case MODE_BEACON:
-        #ifdef DEBUG
-        Serial.println(PROGMEM "T: emitting beacon");
-        #endif
-        
-        this->emitBeacon();
-
-        this->transmission_mode = this->searchBeacon() ? MODE_STREAM : MODE_BEACON;
-      break;
-
-      case MODE_STREAM:
-        #ifdef DEBUG
-        Serial.print(PROGMEM "T: Streaming packet (" + (String) this->_outgoingPacketFlag + ")");
-        #endif
-
-        packet_verification_detected = false;
-
-        while(!packet_verification_detected) {
-          this->streamPacket();
-
-          delayMicroseconds(50);
-
-          packet_verification_detected = this->expectPacketVerification();
-        }
-
-        #ifdef DEBUG
-        Serial.println(PROGMEM " -- received verification");
-        #endif
-
-        if(this->_reset) {
-          this->reset();
-          
-          return;
-        }
-
-        this->operational_mode = OP_MODE_PENDING;
-        this->transmission_mode = MODE_IDLE;
-      break;
-    }
-  }
-
-  private: void emitBeacon(uint length = 7000) {
-    for(uint n=0; n<length; n++) {
-      opticalLink.write((char) RESPONSE_BEACON);
-    }
-  }
-
-  public: void processIncoming(dataManager &dataManager, uartInterface &portUart) {
-    char read;
-
-    bool packet_complete = false;
-    bool packet_detected = false;
-    bool pre_packet_detected = false;
-
-    size_t buffer_pointer = 0;
-    
-    if(this->operational_mode == OP_MODE_TRANSMITTING || this->operational_mode == OP_MODE_PENDING) {
-      return;
-    }
-
-    if(this->operational_mode == OP_MODE_IDLE) {
-      if(this->searchBeacon()) {
-        #ifdef DEBUG
-        Serial.println(PROGMEM "R: Incoming beacon detected");
-        #endif
-
-        while(!packet_detected) {
-          this->emitBeacon(21000);
-
-          packet_detected = this->detectIncomingPacket();
-        }
-
-        #ifdef DEBUG
-        Serial.println(PROGMEM "R: Detected incoming packet");
-        #endif
-
-        this->operational_mode = OP_MODE_RECEIVING;
-
-        #ifdef DEBUG
-        Serial.println(PROGMEM "R: Reception mode activated");
-        #endif
-      }
-    }
-
-    if(this->operational_mode == OP_MODE_RECEIVING) {
-      this->flush();
-
-      packet_complete = false;
-      pre_packet_detected = false;
-
-      memset(this->packet_buffer, 0, this->packet_buffer_size);
-      buffer_pointer = (size_t) 0;
-
-      #ifdef DEBUG
-      Serial.println(PROGMEM "R: Looking up for new packet");
-      #endif
-
-      if(this->_incomingPacketFlag > 0) {
-        while(!opticalLink.available()) {
-          this->streamPacketVerification(5);
-        }
-      }
-
-      while(!packet_complete) {
-        if(opticalLink.available()) {
-          read = opticalLink.read();
-
-          if(read == PRE_PACKET) {
-            pre_packet_detected = true;
-          }
-
-          if(pre_packet_detected) {
-            this->packet_buffer[buffer_pointer++] = read;
-          }
-
-          if(pre_packet_detected && read == POST_PACKET) {
-            packet_complete = true;
-          }
-        }
-      }
-
-      #ifdef DEBUG
-      Serial.println(PROGMEM "R: Packet reception complete");
-      #endif
-      
-      this->parsePacketAndValidateIntegrity(dataManager);
-
-      if(this->_reset) {
-        this->streamPacketVerification(100);
-        this->reset();
-
-        return;
-      }
-
-      if(this->_incomingPacketFlag > 0) {
-        this->streamPacketVerification(5);
-      }
-    }
-  }
-
-  private: void reset() {
-    this->operational_mode = OP_MODE_IDLE;
-    this->transmission_mode = MODE_IDLE;
-    this->_reset = false;
-
-    this->_outgoingPacketFlag = 0;
-    this->_incomingPacketFlag = 0;
-    this->_expectingIncomingPacketFlag = 1;
-
-    #ifdef DEBUG
-    Serial.println("reseting...");
-    #endif
-
-    red(true);
-    ring(3, 2);
-    red(false);
-    delay(1000);
-    blue(false);
-  }
-
-  private: void streamPacketVerification(uint times) {
-    for(int e=0; e<=times; e++) {
-      opticalLink.write(RESPONSE_VERIFICATION);
-      delayMicroseconds(50);
-
-      opticalLink.write(this->_incomingPacketFlag);
-      delayMicroseconds(50);
-    }
-
-    delayMicroseconds(50);
-  }
-
-  private: bool expectPacketVerification() {
-    char read, prev = 0x00;
-
-    bool verification_detected = false;
-
-    long start = millis();
-    
-    while((millis() - start) < 5) {
-      if(opticalLink.available()) {
-        read = opticalLink.read();
-
-        if(read == (char) this->_outgoingPacketFlag) {
-          if(prev == (char) RESPONSE_VERIFICATION) {
-            verification_detected = true;
-          }
-        }
-
-        prev = read;
-      }
-    }
-
-    if(verification_detected) {
-      this->notified = false;
-    }
-
-    return verification_detected;
-  }
-
-  private: bool parsePacketAndValidateIntegrity(dataManager &dataManager) {
-    char data_buffer[513];
-
-    memset(data_buffer, 0, (size_t) 513);
-
-    if(strlen((char*) this->packet_buffer) <= 0) {
-      return false;
-    }
-
-    String packet = (char*) this->packet_buffer;
-    String flag = dataManager.midString(packet, this->flag_packet_header, this->checksum_packet_header);
-    
-    if(flag.toInt() != this->_expectingIncomingPacketFlag) {
-      return false;
-    }
-
-    this->_incomingPacketFlag = (uint8_t) flag.toInt();
-    this->expectIncomingPacketFlag(this->_incomingPacketFlag);
-
-    this->incomingData = dataManager.midString(packet, this->data_packet_header, this->packet_reset);
-
-    String length = dataManager.midString(packet, this->length_packet_header, this->data_packet_header);
-
-    if(length.toInt() != this->incomingData.length()) {
-      return false;
-    }
-
-    String checksum = dataManager.midString(packet, this->checksum_packet_header, this->length_packet_header);
-    this->incomingData.toCharArray(data_buffer, 513);
-
-    String md5 = dataManager.md5((char*) data_buffer).toString();
-
-    if(checksum != md5) {
-      return false;
-    }
-
-    this->_reset = dataManager.midString(packet, this->packet_reset, this->packet_footer) == "1";
-
-    while(this->data_ready);
-    this->data_ready = true;
-
-    return true;
-  }
-
-  private: bool detectIncomingPacket() {
-    char read;
-    uint pre_packet_count = 0;
-
-    this->flush();
-
-    long start = millis();
-
-    while((millis() - start) < PACKET_TIMEOUT_MS) {
-      if(opticalLink.available()) {
-        read = opticalLink.read();
-
-        pre_packet_count = read == PRE_PACKET ? (pre_packet_count + 1) : 0;
-      }
-
-      if(pre_packet_count >= 4) {
-        this->flush();
-
-        return true;
-      }
-    }
-
-    return false;
-  }
-
-  private: bool detectIncomingPulse() {
-    pulse1 = pulseIn(DATA_PIN, HIGH, period*2);
-    pulse2 = pulseIn(DATA_PIN, HIGH, period*2);
-
-    if(pulse1 <= 0 || pulse2 <= 0) {
-      return false;
-    }
-    
-    return pulse1 > lower && pulse1 < upper
-        && pulse2 > lower && pulse2 < upper;
-  }
-
-  public: bool detectValidPulse() {
-    pulse1 = pulseIn(DATA_PIN, HIGH, period*2);
-    pulse2 = pulseIn(DATA_PIN, HIGH, period*2);
-
-    if(pulse1 <= 0 || pulse2 <= 0) {
-      return false;
-    }
-    
-    return pulse1 > lower_valid && pulse1 < upper_valid
-        && pulse2 > lower_valid && pulse2 < upper_valid;
-  }
-
-  private: void setGain(uint8_t gain) {
-    SPI_OP_BEGIN();
-
-    digitalWrite(GAIN_PIN, LOW);
-
-    SPI.transfer(0x00);
-    SPI.transfer(gain);
-    
-    digitalWrite(GAIN_PIN, HIGH);
-    
-    SPI_OP_END();
-  }
-
-  private: void setLoad(uint8_t load) {
-    SPI_OP_BEGIN();
-
-    digitalWrite(LOAD_PIN, LOW);
-
-    SPI.transfer(0x11);
-    SPI.transfer(load);
-
-    digitalWrite(LOAD_PIN, HIGH);
-
-    SPI_OP_END();
-  }
-
-  public: void runAGC() {
-    int long_gain = 0;
-    int long_load = 0;
-    int long_pulse = 1;
-
-    int pulse_count = 0;
-    int e, i;
-    bool pulse;
-
-    int load_increments = FREQUENCY >= 250000 ? map(FREQUENCY, 250000, 400000, 4, 1) : 5;
-
-    #ifdef DEBUG
-    long start, end;
-    start = millis();
-    #endif
-
-    for(e=0; e<=255; e+=load_increments) { // for frequencies >250kHz load increments should be as low as 1
-      pulse_count = 0;
-      this->setLoad(e);
-
-      for(i=128; i>=0; i-=1) {
-        this->setGain(i);
-
-        pulse = this->detectIncomingPulse();
-
-        if(!pulse) {
-          pulse_count = 0;
-        } else {
-          pulse_count++;
-          
-          if(pulse_count >= long_pulse) {
-            long_pulse = pulse_count;
-            long_gain = i + (pulse_count*4)/2 + 4;
-            long_load = e;
-          }
-        }
-      }
-    }
-
-    if(long_pulse > 1) {
-      setLoad(long_load);
-      setGain(long_gain);
-
-      #ifdef DEBUG
-      end = millis() - start;
-      Serial.print(PROGMEM "R: AGC has resolved optimum load (");
-      Serial.print(long_load);
-      Serial.print(PROGMEM ") and gain (");
-      Serial.print(long_gain);
-      Serial.print(PROGMEM ") in ");
-      Serial.print(end);
-      Serial.println(PROGMEM "ms");
-      #endif
-
-      ring(1, 1);
-    }
-  }
-
-  private: bool searchBeacon() {
-    bool signal = this->detectValidPulse();
-
-    if(signal) {
-      blue(true);
-
-      return true;
-    }
-
-    blue(false);
-
-    long start = millis();
-
-    while(!signal && (start + BEACON_TIMEOUT_MS) > millis()) {
-      this->runAGC();
-
-      signal = this->detectValidPulse();
-    }
-
-    blue(signal);
-
-    return signal;
-  }
-
-  private: bool perhapsWeShouldReset(dataManager &dataManager, uartInterface &portUart) {
-    if(!this->dataAvailableForTransmission(dataManager)) {
-      portUart.data_available = false;
-      this->_reset = true;
-      
-      #ifdef DEBUG
-      Serial.println(PROGMEM "T: We should reset");
-      #endif
-
-      return true;
-    }
-
-    return false;
-  }
-
-  private: bool activateTransmission(dataManager &dataManager, uartInterface &portUart) {
-    if(this->buildDataPacket(dataManager)) {
-      #ifdef DEBUG
-      Serial.print(PROGMEM "data_buffer: ");
-      Serial.println((char*) this->data_buffer);
-      #endif
-
-      if(this->buildPacket(dataManager, this->perhapsWeShouldReset(dataManager, portUart))) {
-        #ifdef DEBUG
-        Serial.print(PROGMEM "packet_buffer: ");
-        Serial.println((char*) this->packet_buffer);
-        #endif
-
-        this->transmission_mode = this->operational_mode == OP_MODE_PENDING ? MODE_STREAM : MODE_IDLE;
-        this->operational_mode = OP_MODE_TRANSMITTING;
-
-        #ifdef DEBUG
-        Serial.println(PROGMEM "T: Transmission mode activated");
-        #endif
-
-        return true;
-      }
-    }
-
-    return false;
-  }
-
-  private: uint32_t returnOutgoingBlockPointer(dataManager &dataManager) {
-    this->outgoingBlockPointer++;
-    
-    if(this->outgoingBlockPointer > (dataManager.outgoingBlockStart + BUFFER_MAX_SIZE_BLOCKS)) {
-      this->outgoingBlockPointer = dataManager.outgoingBlockStart;
-    }
-
-    return this->outgoingBlockPointer;
-  }
-
-  private: uint32_t peekOutgoingBlockPointer(dataManager &dataManager) {
-    uint32_t pointer = this->outgoingBlockPointer + 1;
-    
-    if(pointer > (dataManager.outgoingBlockStart + BUFFER_MAX_SIZE_BLOCKS)) {
-      pointer = dataManager.outgoingBlockStart;
-    }
-
-    return pointer;
-  }
-
-  private: bool buildDataPacket(dataManager &dataManager) {
-    uint32_t block;
-
-    memset(this->data_buffer, 0, this->data_buffer_size);
-
-    if(this->peekOutgoingBlockPointer(dataManager) <= dataManager.outgoingBlockPointer) {
-      DATA_OP_BEGIN();
-      block = this->returnOutgoingBlockPointer(dataManager);
-      dataManager.copy(dataManager.returnOutgoingBlock(block), this->data_buffer, (int) PACKET_DATA_SIZE_BYTES);
-      DATA_OP_END();
-
-      this->data_buffer[(size_t) PACKET_DATA_SIZE_BYTES] = (uint8_t) 0x00;
-
-      return true;
-    }
-
-    if(dataManager.outgoingBytePointer > 0) {
-      dataManager.copy(dataManager.returnOutgoingDataExcess(), this->data_buffer, (int) PACKET_DATA_SIZE_BYTES);
-      this->data_buffer[(size_t) dataManager.outgoingBytePointer] = (uint8_t) 0x00;
-
-      dataManager.frontBufferFlush();
-
-      return true;
-    }
-
-    return false;
-  }
-
-  private: bool buildPacket(dataManager &dataManager, bool reset = false) {
-    char checksum[32], flag_buf[4], length_buf[4];
-
-    memset(this->packet_buffer, 0, this->packet_buffer_size);
-
-    dataManager.md5((char*) this->data_buffer).getChars(checksum);
-
-    String flag = (String) this->outgoingPacketFlag();
-    flag.toCharArray(flag_buf, 4);
-
-    String data_length = (String) strlen((char*) this->data_buffer);
-    data_length.toCharArray(length_buf, 4);
-
-    dataManager.copy((uint8_t*) this->flag_packet_header, this->packet_buffer, 6);
-    dataManager.copy((uint8_t*) flag_buf, this->packet_buffer + strlen((char*) this->packet_buffer), strlen((char*) flag_buf));
-
-    dataManager.copy((uint8_t*) this->checksum_packet_header, this->packet_buffer + strlen((char*) this->packet_buffer), 10);
-    dataManager.copy((uint8_t*) checksum, this->packet_buffer + strlen((char*) this->packet_buffer), 32);
-
-    dataManager.copy((uint8_t*) this->length_packet_header, this->packet_buffer + strlen((char*) this->packet_buffer), 8);
-    dataManager.copy((uint8_t*) length_buf, this->packet_buffer + strlen((char*) this->packet_buffer), strlen((char*) length_buf));
-
-    dataManager.copy((uint8_t*) this->data_packet_header, this->packet_buffer + strlen((char*) this->packet_buffer), 6);
-    dataManager.copy(this->data_buffer, this->packet_buffer + strlen((char*) this->packet_buffer), strlen((char*) this->data_buffer));
-
-    dataManager.copy((uint8_t*) this->packet_reset, this->packet_buffer + strlen((char*) this->packet_buffer), 5);
-    dataManager.copy((uint8_t*) (reset ? "1" : "0"), this->packet_buffer + strlen((char*) this->packet_buffer), 1);
-
-    dataManager.copy((uint8_t*) this->packet_footer, this->packet_buffer + strlen((char*) this->packet_buffer), 8);
-
-    return strlen((char*) this->packet_buffer) > 0;
-  }
-
-  private: uint8_t outgoingPacketFlag() {
-    this->_outgoingPacketFlag++;
-    
-    if(this->_outgoingPacketFlag > 128) {
-      this->_outgoingPacketFlag = 1;
-    }
-
-    return this->_outgoingPacketFlag;
-  }
-
-  private: uint8_t expectIncomingPacketFlag(uint8_t current) {
-    this->_expectingIncomingPacketFlag = current + 1;
-    
-    if(this->_expectingIncomingPacketFlag > 128) {
-      this->_expectingIncomingPacketFlag = 1;
-    }
-
-    return this->_expectingIncomingPacketFlag;
-  }
-
-  private: void streamPacket() {
-    long start = millis();
-
-    while((millis() - start) < PRE_POST_PACKET_DURATION_MS) {
-      opticalLink.write(PRE_PACKET);
-      
-      delayMicroseconds(100);
-    }
-
-    delayMicroseconds(100);
-    
-    opticalLink.write((char*) this->packet_buffer);
-
-    start = millis();
-
-    while((millis() - start) < PRE_POST_PACKET_DURATION_MS) {
-      opticalLink.write(POST_PACKET);
-      
-      delayMicroseconds(100);
-    }
-  }
-
-  public: void emitIncomingData() {
-    if(this->data_ready) {
-      platformInterface.print(this->incomingData);
-
-      this->data_ready = false;
-
-      redToggle();
-      ringMicroseconds(1, 50);
-    }
-
-    if(!this->notified) {
-      redToggle();
-      ringMicroseconds(1, 50);
-
-      this->notified = true;
-    }
-  }
-
-  private: void flush() {
-    while(opticalLink.available() > 0) {
-      opticalLink.read();
-    }
-  }
-
-  private: void remoteUnitResponds(bool condition = true) {
-    // this->remote_unit_responding = condition;
-    
-    // this->last_remote_unit_response = condition ? millis() : 0;
-  }
-
-  private: bool remoteUnitResponding() {
-    // if(!this->remote_unit_responding) {
-    //   return false;
-    // }
-
-    // if(this->last_remote_unit_response > millis()) {
-    //   return false;
-    // }
-
-    // return (millis() - this->last_remote_unit_response) < RESPONSE_TIMEOUT_MS;
-
-    return true;
-  }
-  
-};
+using namespace std;
+
+#pragma once
+
+#include <esp_task_wdt.h>
+#include "frameSizeController.class.h"
+#include "linkSession.class.h"
+#include "packetCodec.class.h"
+#include "pulseCapture.class.h"
+#include "rttEstimator.class.h"
+
+// Pin allocations
+#define DATA_PIN                    (32)
+#define LASER_PIN                   (27)
+#define GAIN_PIN                    (33)
+#define LOAD_PIN                    (25)
+
+// Optical interface clock frequency in Hz of the default link profile. Baud rate = frequency*2
+#define FREQUENCY                   (100000)
+#define INCOMING_BUFFER_DEPTH       (16384)
+
+// Operational modes
+#define OP_MODE_IDLE                (0) // Idle (default)
+#define OP_MODE_TRANSMITTING        (1) // Tranmission mode
+#define OP_MODE_PENDING             (2) // Checking for subsequent packets
+#define OP_MODE_RECEIVING           (3) // Receiving mode
+
+// Transmission modes/stages (in order)
+#define MODE_IDLE                   (0) // Idle (default)
+#define MODE_BEACON                 (1) // Stream square wave beacon
+#define MODE_STREAM                 (2) // Stream packet and await verification
+
+// Packet sizing. Payloads adapt between FRAME_SIZE_MIN_BYTES and PACKET_DATA_MAX_BYTES, starting at PACKET_DATA_SIZE_BYTES
+#define PACKET_DATA_SIZE_BYTES      (512)
+#define PACKET_DATA_MAX_BYTES       (FRAME_SIZE_MAX_BYTES)
+#define PACKET_WRAPPER_SIZE_BYTES   (256)
+
+// Wrapper bytes exposed to bit errors: headers, flag, session, offset, checksum, length, reset and footer
+#define PACKET_HEADER_BYTES         (118)
+
+// Received packets queued between the link and the host emitter stage
+#define RX_QUEUE_PACKETS            (4)
+
+// Frames the tx framer builds ahead while the link streams the current one
+#ifndef TX_FRAME_SLOTS
+#define TX_FRAME_SLOTS              (2)
+#endif
+
+// Line characters coded or decoded per UART write or read under a line code
+#define LINE_CODE_CHUNK_CHARS       (128)
+
+// Frame slot states
+#define TX_FRAME_FREE               (0)
+#define TX_FRAME_READY              (1) // built and checksummed, waiting for the link
+#define TX_FRAME_ACTIVE             (2) // on the line until verified
+
+// Packet pulsing. Beacon, packet and verification waits start at these values and follow the measured round trips
+#define TRANS_DELAY_MS              (1000)
+#define RESET_SETTLE_MS             (1000) // link left alone after a session ends
+#define BEACON_TIMEOUT_MS           (500)
+#define PACKET_TIMEOUT_MS           (100)
+#define PULSE_TIMEOUT_MS            (20)
+#define RESPONSE_TIMEOUT_MS         (30000)
+#define PRE_POST_PACKET_DURATION_MS (5)
+#define PACKET_VERIFICATION_WAIT_MS (5)
+
+// Bounds of the adaptive waits
+#define BEACON_TIMEOUT_MIN_MS       (50)
+#define BEACON_TIMEOUT_MAX_MS       (2000)
+#define PACKET_TIMEOUT_MIN_MS       (5)
+#define PACKET_TIMEOUT_MAX_MS       (1000)
+#define VERIFICATION_WAIT_MIN_US    (500)
+#define VERIFICATION_WAIT_MAX_MS    (50)
+
+// Receiver: beacon answered this long without a packet means the sender left
+#define RX_ANSWER_TIMEOUT_MS        (SESSION_IDLE_TIMEOUT_MS)
+
+// Receiver: a packet still arriving after twice its longest line time plus this is dropped unverified
+#define RX_PACKET_SLACK_MS          (PACKET_TIMEOUT_MAX_MS)
+
+// Receiver: a packet the host emitter has no room for within this is left unverified, and repeated
+#define RX_QUEUE_TIMEOUT_MS         (100)
+
+// Verification pairs per received packet: doubled when the sender repeats a packet, eased back on fresh ones
+#define VERIFY_REPEAT_MIN           (2)
+#define VERIFY_REPEAT_DEFAULT       (5)
+#define VERIFY_REPEAT_MAX           (32)
+#define VERIFY_RESET_FACTOR         (20) // the reset packet is verified this many times over before the receiver leaves
+
+#include "linkProfile.class.h"
+
+long pulse1, pulse2;
+
+struct rxPacket {
+  uint32_t received_at;
+  uint16_t length;
+  uint8_t data[PACKET_DATA_MAX_BYTES];
+};
+
+struct txFrame {
+  uint8_t state;            // TX_FRAME_*, handed between the tx framer and the link
+  uint8_t flag;
+  size_t length;            // packet bytes
+  size_t payload_length;
+  uint64_t offset;
+  uint32_t last_block;      // ring read pointer once the frame was built, acknowledged with it
+  uint32_t flushes;
+  uint8_t packet[PACKET_DATA_MAX_BYTES + PACKET_WRAPPER_SIZE_BYTES];
+};
+
+class opticalInterface {
+  private: uint8_t operational_mode = OP_MODE_IDLE;
+  private: uint8_t transmission_mode = MODE_IDLE;
+  private: uint64_t completion = 0;
+
+  private: const linkProfile * profile = &linkProfiles[LINK_PROFILE_DEFAULT];
+
+  // Current digital potentiometer settings
+  private: uint8_t gain = 0;
+  private: uint8_t load = 0;
+
+  // Receive buffer, hashed while the packet arrives
+  private: size_t packet_buffer_size = (size_t) (PACKET_DATA_MAX_BYTES + PACKET_WRAPPER_SIZE_BYTES + 512);
+  private: uint8_t packet_buffer[(size_t) (PACKET_DATA_MAX_BYTES + PACKET_WRAPPER_SIZE_BYTES + 512)];
+  private: packetDigest rx_digest;
+
+  // Line code state and the coded side of UART writes and reads
+  public: lineCode lineCoder;
+  private: uint8_t line_buffer[LINE_CODE_CHUNK_CHARS];
+
+  // Payload of the frame being built by the tx framer
+  private: uint8_t data_buffer[(size_t) (PACKET_DATA_MAX_BYTES + 256)];
+
+  // Built frames: the framer fills tx_build_slot while the link streams tx_frame
+  private: txFrame tx_frames[TX_FRAME_SLOTS];
+  private: uint8_t tx_build_slot = 0;
+  private: uint8_t tx_send_slot = 0;
+  private: volatile bool tx_building = false;
+  private: txFrame * tx_frame = &tx_frames[0];
+
+  // Ring block being cut into frames smaller than a block
+  private: uint8_t tx_block[BUFFER_BLOCK_SIZE_BYTES];
+  private: size_t tx_block_offset = 0;
+  private: size_t tx_block_length = 0;
+  private: uint32_t tx_block_flushes = 0;
+
+  // backlog blocks dropped because their header or CRC did not check out
+  public: uint32_t invalidBlocks = 0;
+
+  // Payload size follows the observed frame error rate
+  public: frameSizeController frameSize = frameSizeController(linkProfiles[LINK_PROFILE_DEFAULT].frame_size,
+    PACKET_HEADER_BYTES, linkProfiles[LINK_PROFILE_DEFAULT].attempt_overhead_bytes);
+
+  private: uint8_t _outgoingPacketFlag = 0;
+  private: uint8_t _incomingPacketFlag = 0;
+  private: uint8_t _expectingIncomingPacketFlag = 1;
+
+  private: bool remote_unit_responding = false;
+  private: long last_remote_unit_response = 0;
+  private: bool received_packet_verification = false;
+  private: bool incoming_packet_detected = false;
+  private: bool expecting_incoming_packet = false;
+
+  private: QueueHandle_t rxQueue = NULL;
+  private: rxPacket rx_packet;
+  private: rxPacket emit_packet;
+
+  private: bool _reset = false;
+  private: unsigned long settle_start = 0;
+
+  // tx_frame not yet verified by the remote unit; survives link loss
+  private: bool packet_pending = false;
+
+  public: linkSession session;
+
+  // delivery accounting for host receipts and status
+  public: uint64_t delivered_bytes = 0;
+  public: uint32_t delivered_packets = 0;
+  private: uint32_t receipt_packets = 0;
+  private: unsigned long receipt_time = 0;
+  private: uint64_t status_bytes = 0;
+  private: unsigned long status_time = 0;
+
+  // Adaptive waits: verification after a packet, packet after our beacon answer, remote beacon
+  public: rttEstimator ackTimer = rttEstimator(PACKET_VERIFICATION_WAIT_MS * 1000, VERIFICATION_WAIT_MIN_US, VERIFICATION_WAIT_MAX_MS * 1000);
+  public: rttEstimator packetTimer = rttEstimator(PACKET_TIMEOUT_MS * 1000, PACKET_TIMEOUT_MIN_MS * 1000, PACKET_TIMEOUT_MAX_MS * 1000);
+  public: rttEstimator beaconTimer = rttEstimator(BEACON_TIMEOUT_MS * 1000, BEACON_TIMEOUT_MIN_MS * 1000, BEACON_TIMEOUT_MAX_MS * 1000);
+  public: uint8_t verifyRepeats = VERIFY_REPEAT_DEFAULT;
+
+  // per-stage latency: packet build, stream until verified, packet reception, hand-off to the host
+  public: latencyHistogram buildLatency;
+  public: latencyHistogram txLatency;
+  public: latencyHistogram rxLatency;
+  public: latencyHistogram handoffLatency;
+
+  public: void initialize(dataManager &dataManager, uartInterface &portUart) {
+    // Optical interface pins
+    pinMode(DATA_PIN, INPUT);
+    pinMode(LASER_PIN, OUTPUT);
+
+    // Digital potentiometers
+    pinMode(GAIN_PIN, OUTPUT);
+    pinMode(LOAD_PIN, OUTPUT);
+
+    size_t buffer_depth = INCOMING_BUFFER_DEPTH;
+
+    this->rxQueue = xQueueCreate(RX_QUEUE_PACKETS, sizeof(rxPacket));
+
+    // The session record is stored from the SD writer stage (sdWriterTask)
+    this->session.begin(dataManager.storage(), esp_random(), true);
+
+    // Initialize optical interface
+    opticalLink.begin(this->profile->baud, SERIAL_8N1, DATA_PIN, LASER_PIN, true);
+    opticalLink.setRxBufferSize(buffer_depth);
+
+    // Allow cooldown time before continuing
+    delay(100);
+  }
+
+  private: bool dataAvailableForTransmission(dataManager &dataManager) {
+    return this->tx_block_offset < this->tx_block_length
+        || dataManager.outgoingBytePointer > 0
+        || dataManager.outgoingPendingBlocks() > 0
+        || this->dataAvailableBufferBlocks(dataManager);
+  }
+
+  private: bool dataAvailableBufferBlocks(dataManager &dataManager) {
+    return dataManager.outgoingBacklogBlocks() > 0;
+  }
+
+  public: void processOutgoing(dataManager &dataManager, uartInterface &portUart) {
+    bool packet_verification_detected;
+    unsigned long stream_start;
+    uint32_t attempts, link_loss_us;
+
+    if(this->operational_mode == OP_MODE_RECEIVING || this->settling()) {
+      return;
+    }
+
+    // Reacquire the link and stream the unverified packet again
+    if(this->operational_mode == OP_MODE_IDLE && this->packet_pending) {
+      this->operational_mode = OP_MODE_TRANSMITTING;
+      this->transmission_mode = MODE_IDLE;
+    }
+
+    if(this->operational_mode == OP_MODE_IDLE || this->operational_mode == OP_MODE_PENDING) {
+      if(this->takeOutgoingFrame(dataManager, portUart)) {
+        this->transmission_mode = this->operational_mode == OP_MODE_PENDING ? MODE_STREAM : MODE_IDLE;
+        this->operational_mode = OP_MODE_TRANSMITTING;
+      } else if(this->transmitAllowed(portUart) && this->dataAvailableForTransmission(dataManager)) {
+        // First frame of a burst: the framer has not caught up yet and wakes the link when it has
+        notifyStage(txFramerStage);
+      } else {
+        this->operational_mode = OP_MODE_IDLE;
+        this->transmission_mode = MODE_IDLE;
+      }
+    }
+    
+    if(this->operational_mode != OP_MODE_TRANSMITTING) {
+      return;
+    }
+
+    switch (this->transmission_mode) {
+      case MODE_IDLE:
+        this->transmission_mode = MODE_BEACON;
+      break;
+    
+      case MODE_BEACON:
+        logEvent(EVENT_TX_BEACON);
+        logBegin(EVENT_TX_SEARCH);
+
+        this->emitBeacon();
+
+        this->transmission_mode = this->searchBeacon() ? MODE_STREAM : MODE_BEACON;
+
+        logEnd(EVENT_TX_SEARCH, this->transmission_mode == MODE_STREAM);
+      break;
+
+      case MODE_STREAM:
+        logEvent(EVENT_TX_PACKET, this->tx_frame->flag, this->tx_frame->payload_length);
+
+        packet_verification_detected = false;
+        stream_start = micros();
+        attempts = 0;
+        link_loss_us = this->linkLossUs();
+
+        waitBegin(WAIT_TX_VERIFY);
+
+        while(!packet_verification_detected) {
+          if((micros() - stream_start) > link_loss_us) {
+            waitEnd(true);
+
+            logEvent(EVENT_TX_LINK_LOST, this->tx_frame->flag);
+
+            this->suspend();
+
+            return;
+          }
+
+          this->streamPacket();
+
+          delayMicroseconds(50);
+
+          packet_verification_detected = this->expectPacketVerification(attempts == 0);
+
+          this->frameSize.recordAttempt(packet_verification_detected);
+
+          if(!packet_verification_detected) {
+            logEvent(EVENT_TX_RETRANSMIT, this->tx_frame->flag, ++attempts);
+          }
+        }
+
+        waitEnd();
+
+        logEvent(EVENT_TX_VERIFIED, this->tx_frame->flag, micros() - stream_start);
+
+        this->txLatency.record(micros() - stream_start);
+
+        this->packet_pending = false;
+        this->session.acknowledged(this->tx_frame->offset, this->tx_frame->payload_length);
+
+        this->delivered_bytes += this->tx_frame->payload_length;
+        this->delivered_packets++;
+
+        dataManager.acknowledgeBlocks(this->tx_frame->last_block, this->tx_frame->flushes);
+
+        this->releaseOutgoingFrame();
+
+        // Receipts, the next frame, prefetch and RAM tier retirement all follow a verified packet
+        notifyStage(txFramerStage);
+        notifyStage(hostEmitterStage);
+
+        if(this->_reset) {
+          this->reset();
+          
+          return;
+        }
+
+        this->operational_mode = OP_MODE_PENDING;
+        this->transmission_mode = MODE_IDLE;
+      break;
+    }
+  }
+
+  private: void emitBeacon(uint length = 7000) {
+    for(uint n=0; n<length; n++) {
+      opticalLink.write((char) RESPONSE_BEACON);
+    }
+  }
+
+  public: void processIncoming(dataManager &dataManager, uartInterface &portUart) {
+    char read;
+    size_t chunk;
+    uint8_t * end;
+
+    bool packet_complete = false;
+    bool packet_detected = false;
+    bool pre_packet_detected = false;
+
+    size_t buffer_pointer = 0;
+    
+    if(this->operational_mode == OP_MODE_TRANSMITTING || this->operational_mode == OP_MODE_PENDING || this->settling()) {
+      return;
+    }
+
+    if(this->operational_mode == OP_MODE_IDLE) {
+      if(this->searchBeacon()) {
+        logEvent(EVENT_RX_BEACON);
+
+        unsigned long answer_start = millis();
+
+        waitBegin(WAIT_RX_ANSWER);
+
+        for(uint32_t tries=0; !packet_detected; tries++) {
+          // A beacon that was not meant for us, or a sender that gave up
+          if((millis() - answer_start) > RX_ANSWER_TIMEOUT_MS) {
+            waitEnd(true);
+
+            this->suspend();
+
+            return;
+          }
+
+          this->emitBeacon(21000);
+
+          packet_detected = this->detectIncomingPacket(tries == 0);
+        }
+
+        waitEnd();
+
+        logEvent(EVENT_RX_PACKET_DETECTED);
+
+        this->operational_mode = OP_MODE_RECEIVING;
+      }
+    }
+
+    if(this->operational_mode == OP_MODE_RECEIVING) {
+      this->flush();
+
+      packet_complete = false;
+      pre_packet_detected = false;
+
+      memset(this->packet_buffer, 0, this->packet_buffer_size);
+      buffer_pointer = (size_t) 0;
+
+      this->rx_digest.begin();
+
+      logEvent(EVENT_RX_WAIT, this->_expectingIncomingPacketFlag);
+
+      unsigned long wait_start = millis();
+
+      if(this->_incomingPacketFlag > 0) {
+        waitBegin(WAIT_RX_NEXT);
+
+        while(!opticalLink.available()) {
+          if((millis() - wait_start) > SESSION_IDLE_TIMEOUT_MS) {
+            waitEnd(true);
+
+            this->suspend();
+
+            return;
+          }
+
+          this->streamPacketVerification(this->verifyRepeats);
+        }
+
+        waitEnd();
+      }
+
+      unsigned long receive_start = micros();
+      unsigned long last_byte = millis();
+      uint32_t receive_limit = 2 * (uint32_t) this->profile->lineBytes(this->packet_buffer_size) * this->byteTimeUs() + RX_PACKET_SLACK_MS * 1000;
+
+      logBegin(EVENT_RX_RECEIVE);
+      waitBegin(WAIT_RX_PACKET);
+
+      while(!packet_complete) {
+        if((millis() - last_byte) > SESSION_IDLE_TIMEOUT_MS) {
+          waitEnd(true);
+          logEnd(EVENT_RX_RECEIVE);
+
+          this->suspend();
+
+          return;
+        }
+
+        // Bytes keep coming but POST_PACKET does not: end here, the packet fails validation and is repeated
+        if((micros() - receive_start) > receive_limit) {
+          break;
+        }
+
+        if(!opticalLink.available()) {
+          continue;
+        }
+
+        last_byte = millis();
+
+        if(!pre_packet_detected) {
+          read = opticalLink.read();
+
+          if(read == PRE_PACKET) {
+            pre_packet_detected = true;
+
+            this->lineCoder.beginDecode();
+
+            this->packet_buffer[buffer_pointer++] = read;
+          }
+
+          continue;
+        }
+
+        // Take whatever has arrived in one go and hash the payload while the rest is on the line
+        if(this->profile->line_code != LINE_CODE_NONE) {
+          buffer_pointer += this->readCodedChunk(buffer_pointer, packet_complete);
+        } else {
+          chunk = (size_t) opticalLink.available();
+
+          if(chunk > this->packet_buffer_size - 1 - buffer_pointer) {
+            chunk = this->packet_buffer_size - 1 - buffer_pointer;
+          }
+
+          chunk = opticalLink.readBytes(this->packet_buffer + buffer_pointer, chunk);
+
+          end = (uint8_t *) memchr(this->packet_buffer + buffer_pointer, POST_PACKET, chunk);
+
+          // Bytes after the first POST_PACKET are postamble, flushed before the next packet
+          if(end != NULL) {
+            memset(end + 1, 0, this->packet_buffer + buffer_pointer + chunk - (end + 1));
+            chunk = end + 1 - (this->packet_buffer + buffer_pointer);
+            packet_complete = true;
+          }
+
+          buffer_pointer += chunk;
+        }
+
+        // An overlong packet ends here and fails validation
+        if(buffer_pointer >= this->packet_buffer_size - 1) {
+          packet_complete = true;
+        }
+
+        this->rx_digest.update(this->packet_buffer, buffer_pointer);
+      }
+
+      waitEnd(!packet_complete);
+
+      this->rxLatency.record(micros() - receive_start);
+
+      logEnd(EVENT_RX_RECEIVE);
+
+      this->parsePacketAndValidateIntegrity(dataManager, buffer_pointer);
+
+      logEvent(EVENT_RX_PACKET, this->_incomingPacketFlag, buffer_pointer);
+
+      if(this->_reset) {
+        this->streamPacketVerification(this->verifyRepeats * VERIFY_RESET_FACTOR);
+        this->reset();
+
+        return;
+      }
+
+      if(this->_incomingPacketFlag > 0) {
+        this->streamPacketVerification(this->verifyRepeats);
+      }
+    }
+  }
+
+  /**
+   * Link lost mid-session: return to idle without the end-of-session
+   * indication. Flags and session state are kept, and a pending packet is
+   * streamed again once the link is reacquired.
+   */
+  private: void suspend() {
+    this->operational_mode = OP_MODE_IDLE;
+    this->transmission_mode = MODE_IDLE;
+
+    if(this->packet_pending) {
+      this->session.resumes++;
+    }
+
+    blue(false);
+  }
+
+  private: void reset() {
+    this->operational_mode = OP_MODE_IDLE;
+    this->transmission_mode = MODE_IDLE;
+    this->_reset = false;
+
+    this->_incomingPacketFlag = 0;
+    this->_expectingIncomingPacketFlag = 1;
+
+    logEvent(EVENT_LINK_RESET);
+
+    flash();
+    ring(3, 2);
+    blue(false);
+
+    this->settle_start = millis() | 1;
+  }
+
+  // Quiet period after reset(), waited out by skipping link passes instead of blocking in them
+  private: bool settling() {
+    if(this->settle_start != 0 && millis() - this->settle_start < RESET_SETTLE_MS) {
+      return true;
+    }
+
+    this->settle_start = 0;
+
+    return false;
+  }
+
+  /**
+   * Read what has arrived of a line coded packet and decode it into the
+   * receive buffer at buffer_pointer. POST_PACKET ends the packet and is
+   * kept after the decoded bytes, as in an uncoded packet; line characters
+   * after it are postamble. Returns the bytes added.
+   */
+  private: size_t readCodedChunk(size_t buffer_pointer, bool &packet_complete) {
+    size_t room = this->packet_buffer_size - 1 - buffer_pointer;
+    size_t chars = (size_t) opticalLink.available();
+    size_t added;
+    uint8_t * end;
+
+    // Three characters per four bytes of room leaves space for the bits carried over and POST_PACKET
+    if(chars > room * 3 / 4) {
+      chars = room * 3 / 4;
+    }
+
+    if(chars > LINE_CODE_CHUNK_CHARS) {
+      chars = LINE_CODE_CHUNK_CHARS;
+    }
+
+    // An overlong packet ends here and fails validation
+    if(chars == 0) {
+      packet_complete = true;
+
+      return 0;
+    }
+
+    chars = opticalLink.readBytes(this->line_buffer, chars);
+
+    end = (uint8_t *) memchr(this->line_buffer, POST_PACKET, chars);
+
+    if(end != NULL) {
+      chars = end - this->line_buffer;
+    }
+
+    added = this->lineCoder.decode(this->line_buffer, chars, this->packet_buffer + buffer_pointer);
+
+    if(end != NULL) {
+      this->packet_buffer[buffer_pointer + added++] = POST_PACKET;
+      packet_complete = true;
+    }
+
+    return added;
+  }
+
+  // Packet onto the line through the profile's line code, a chunk at a time
+  private: void writeCodedPacket(const uint8_t * packet, size_t length) {
+    size_t chunk;
+
+    this->lineCoder.beginEncode();
+
+    // Every three bytes become four characters
+    for(size_t offset=0; offset<length; offset+=chunk) {
+      chunk = length - offset < LINE_CODE_CHUNK_CHARS / 4 * 3 ? length - offset : LINE_CODE_CHUNK_CHARS / 4 * 3;
+
+      opticalLink.write(this->line_buffer, this->lineCoder.encode(packet + offset, chunk, this->line_buffer));
+    }
+
+    opticalLink.write(this->line_buffer, this->lineCoder.finishEncode(this->line_buffer));
+  }
+
+  /**
+   * Unverified time after which the beam counts as lost:
+   * SESSION_LINK_LOSS_ATTEMPTS attempts of the current frame, each its
+   * preamble, line time, postamble and verification wait.
+   */
+  private: uint32_t linkLossUs() {
+    uint32_t attempt_us = (uint32_t) this->profile->lineBytes(this->tx_frame->length) * this->byteTimeUs()
+      + 2 * (uint32_t) this->profile->preamble_ms * 1000 + this->ackTimer.timeout();
+
+    if(SESSION_LINK_LOSS_ATTEMPTS * attempt_us < SESSION_LINK_LOSS_MS * 1000) {
+      return SESSION_LINK_LOSS_MS * 1000;
+    }
+
+    return SESSION_LINK_LOSS_ATTEMPTS * attempt_us;
+  }
+
+  // One byte time of the current profile, the spacing of verification bytes
+  private: uint32_t byteTimeUs() {
+    return 10000000UL / this->profile->baud;
+  }
+
+  private: void streamPacketVerification(uint times) {
+    uint32_t spacing = this->byteTimeUs();
+
+    for(int e=0; e<=times; e++) {
+      opticalLink.write(RESPONSE_VERIFICATION);
+      delayMicroseconds(spacing);
+
+      opticalLink.write(this->_incomingPacketFlag);
+      delayMicroseconds(spacing);
+    }
+
+    delayMicroseconds(spacing);
+  }
+
+  /**
+   * Wait up to ackTimer.timeout() for the verification of tx_frame. Only a
+   * first attempt is timed: a verification after a repeat may answer either.
+   */
+  private: bool expectPacketVerification(bool first_attempt) {
+    char read, prev = 0x00;
+
+    bool verification_detected = false;
+
+    unsigned long start = micros();
+    uint32_t wait = this->ackTimer.timeout();
+
+    logBegin(EVENT_TX_ACK_WAIT);
+
+    while(!verification_detected && (micros() - start) < wait) {
+      if(opticalLink.available()) {
+        read = opticalLink.read();
+
+        if(read == (char) this->tx_frame->flag) {
+          if(prev == (char) RESPONSE_VERIFICATION) {
+            verification_detected = true;
+          }
+        }
+
+        prev = read;
+      }
+    }
+
+    if(!verification_detected) {
+      this->ackTimer.backoff();
+    } else if(first_attempt) {
+      this->ackTimer.sample(micros() - start);
+    }
+
+    logEnd(EVENT_TX_ACK_WAIT, verification_detected, this->ackTimer.timeout());
+
+    if(verification_detected) {
+      activity();
+    }
+
+    return verification_detected;
+  }
+
+  // The `length` bytes received into packet_buffer; the payload may hold 0x00
+  private: bool parsePacketAndValidateIntegrity(dataManager &dataManager, size_t length) {
+    if(length == 0) {
+      return false;
+    }
+
+    packetFields packet;
+
+    if(!packetCodec::parse(this->packet_buffer, length, PACKET_DATA_MAX_BYTES, packet, &this->rx_digest)) {
+      return false;
+    }
+
+    if(this->session.duplicate(packet.session, packet.offset, packet.length)) {
+      // The sender missed our verification: answer louder
+      this->verifyRepeats = this->verifyRepeats * 2 > VERIFY_REPEAT_MAX ? VERIFY_REPEAT_MAX : this->verifyRepeats * 2;
+    } else {
+      if(this->verifyRepeats > VERIFY_REPEAT_MIN) {
+        this->verifyRepeats--;
+      }
+
+      this->rx_packet.received_at = micros();
+      this->rx_packet.length = packet.length;
+      memcpy(this->rx_packet.data, packet.data, this->rx_packet.length);
+
+      // Waits only while the host emitter stage is RX_QUEUE_PACKETS behind; past the deadline the packet is not verified
+      waitBegin(WAIT_RX_QUEUE);
+
+      if(xQueueSend(this->rxQueue, &this->rx_packet, pdMS_TO_TICKS(RX_QUEUE_TIMEOUT_MS)) != pdTRUE) {
+        waitEnd(true);
+
+        return false;
+      }
+
+      waitEnd();
+
+      // Committed before the packet is verified to the sender
+      this->session.commit(packet.offset, this->rx_packet.length);
+
+      notifyStage(hostEmitterStage);
+    }
+
+    // Duplicates are judged by stream offset, so flags only pair packets with their verification
+    this->_incomingPacketFlag = packet.flag;
+    this->expectIncomingPacketFlag(this->_incomingPacketFlag);
+
+    this->_reset = packet.reset;
+
+    return true;
+  }
+
+  /**
+   * Wait up to packetTimer.timeout() for a preamble after our beacon. Only
+   * the first wait is timed, a later one may see a packet started earlier.
+   */
+  private: bool detectIncomingPacket(bool first_wait) {
+    char read;
+    uint pre_packet_count = 0;
+
+    this->flush();
+
+    unsigned long start = micros();
+    uint32_t wait = this->packetTimer.timeout();
+
+    while((micros() - start) < wait) {
+      if(opticalLink.available()) {
+        read = opticalLink.read();
+
+        pre_packet_count = read == PRE_PACKET ? (pre_packet_count + 1) : 0;
+      }
+
+      if(pre_packet_count >= 4) {
+        if(first_wait) {
+          this->packetTimer.sample(micros() - start);
+        }
+
+        this->flush();
+
+        return true;
+      }
+    }
+
+    this->packetTimer.backoff();
+
+    return false;
+  }
+
+  private: bool detectIncomingPulse() {
+    pulse1 = pulseIn(DATA_PIN, HIGH, this->profile->pulse_timeout_us);
+    pulse2 = pulseIn(DATA_PIN, HIGH, this->profile->pulse_timeout_us);
+
+    return this->profile->detector.detectable(pulse1, pulse2);
+  }
+
+  public: bool detectValidPulse() {
+    pulse1 = pulseIn(DATA_PIN, HIGH, this->profile->pulse_timeout_us);
+    pulse2 = pulseIn(DATA_PIN, HIGH, this->profile->pulse_timeout_us);
+
+    return this->profile->detector.valid(pulse1, pulse2);
+  }
+
+  private: void setGain(uint8_t gain) {
+    SPI_OP_BEGIN();
+
+    digitalWrite(GAIN_PIN, LOW);
+
+    SPI.transfer(0x00);
+    SPI.transfer(gain);
+
+    this->gain = gain;
+    
+    digitalWrite(GAIN_PIN, HIGH);
+    
+    SPI_OP_END();
+  }
+
+  private: void setLoad(uint8_t load) {
+    SPI_OP_BEGIN();
+
+    digitalWrite(LOAD_PIN, LOW);
+
+    SPI.transfer(0x11);
+    SPI.transfer(load);
+
+    this->load = load;
+
+    digitalWrite(LOAD_PIN, HIGH);
+
+    SPI_OP_END();
+  }
+
+  public: void runAGC() {
+    agcSearch search;
+    int e, i;
+
+    int load_increments = this->profile->load_increment;
+
+    logBegin(EVENT_AGC);
+
+    for(e=0; e<=AGC_LOAD_MAX; e+=load_increments) { // for frequencies >250kHz load increments should be as low as 1
+      search.beginLoad();
+      this->setLoad(e);
+
+      for(i=AGC_GAIN_START; i>=0; i-=1) {
+        this->setGain(i);
+
+        search.observe(e, i, this->detectIncomingPulse());
+      }
+    }
+
+    if(search.resolved()) {
+      setLoad(search.load());
+      setGain(search.gain());
+
+      logEnd(EVENT_AGC, search.load(), search.gain());
+
+      ring(1, 1);
+
+      return;
+    }
+
+    logEnd(EVENT_AGC);
+  }
+
+  /**
+   * Run a capture requested with FRAME_CAPTURE while the link is idle and
+   * dump the trace on the debug port for the host pulse analyzer. A dump
+   * at 115200 baud outlasts the task watchdog, so the capture and dump
+   * loops feed it as the link pass would.
+   */
+  public: void processCapture(uartInterface &portUart) {
+    pulseCapture capture;
+
+    if(!portUart.capture_requested || this->operational_mode != OP_MODE_IDLE) {
+      return;
+    }
+
+    portUart.capture_requested = false;
+
+    if(!capture.begin(DATA_PIN, portUart.capture_mode == PULSE_CAPTURE_SWEEP ? PULSE_CAPTURE_SWEEP_EDGES : portUart.capture_edges)) {
+      Serial.println(PROGMEM "# pulse-trace unavailable");
+
+      capture.end();
+
+      return;
+    }
+
+    if(portUart.capture_mode == PULSE_CAPTURE_SWEEP) {
+      this->captureSweep(capture);
+    } else {
+      this->captureFixed(capture);
+    }
+
+    capture.end();
+  }
+
+  private: void captureFixed(pulseCapture &capture) {
+    unsigned long start = millis();
+
+    capture.start();
+
+    while(!capture.full() && (millis() - start) < PULSE_CAPTURE_TIMEOUT_MS) {
+      esp_task_wdt_reset();
+      delay(1);
+    }
+
+    capture.stop();
+
+    Serial.printf("# pulse-trace v1 mode=fixed frequency=%u load=%d gain=%d\n", (unsigned) this->profile->frequency, this->load, this->gain);
+
+    for(uint32_t n=0; n<capture.captured(); n++) {
+      esp_task_wdt_reset();
+
+      Serial.printf("%c %u\n", (capture.edge(n) & PULSE_CAPTURE_HIGH) ? 'H' : 'L', (unsigned) pulseCapture::nanoseconds(capture.edge(n)));
+    }
+
+    Serial.println(PROGMEM "# end");
+  }
+
+  // Same gain/load order as runAGC, so the analyzer can replay the search
+  private: void captureSweep(pulseCapture &capture) {
+    int load_increments = this->profile->load_increment;
+    uint8_t restore_gain = this->gain;
+    uint8_t restore_load = this->load;
+    uint32_t high[2];
+    uint8_t found;
+
+    Serial.printf("# pulse-trace v1 mode=sweep frequency=%u load_step=%d\n", (unsigned) this->profile->frequency, load_increments);
+
+    for(int e=0; e<=AGC_LOAD_MAX; e+=load_increments) {
+      this->setLoad(e);
+
+      for(int i=AGC_GAIN_START; i>=0; i-=1) {
+        esp_task_wdt_reset();
+
+        this->setGain(i);
+
+        capture.start();
+        delayMicroseconds(PULSE_CAPTURE_STEP_US);
+        capture.stop();
+
+        high[0] = high[1] = 0;
+        found = 0;
+
+        for(uint32_t n=0; n<capture.captured() && found < 2; n++) {
+          if(capture.edge(n) & PULSE_CAPTURE_HIGH) {
+            high[found++] = pulseCapture::nanoseconds(capture.edge(n));
+          }
+        }
+
+        Serial.printf("S %d %d %u %u\n", e, i, (unsigned) high[0], (unsigned) high[1]);
+      }
+    }
+
+    this->setLoad(restore_load);
+    this->setGain(restore_gain);
+
+    Serial.println(PROGMEM "# end");
+  }
+
+  /**
+   * Switch to the link profile requested with FRAME_LINK_PROFILE while the
+   * link is idle. The remote unit has to be switched to the same profile.
+   */
+  public: void processProfile(uartInterface &portUart) {
+    uint8_t type = FRAME_LINK_PROFILE;
+
+    if(!portUart.profile_requested || this->operational_mode != OP_MODE_IDLE) {
+      return;
+    }
+
+    portUart.profile_requested = false;
+
+    portUart.sendFrame(this->useProfile(portUart.profile_index) ? FRAME_ACK : FRAME_NAK, &type, 1);
+  }
+
+  public: bool useProfile(uint8_t index) {
+    if(index >= LINK_PROFILE_COUNT) {
+      return false;
+    }
+
+    this->profile = &linkProfiles[index];
+    this->frameSize = frameSizeController(this->profile->frame_size, PACKET_HEADER_BYTES, this->profile->attempt_overhead_bytes);
+
+    // Round trips measured at the old rate no longer apply
+    this->ackTimer = rttEstimator(PACKET_VERIFICATION_WAIT_MS * 1000, VERIFICATION_WAIT_MIN_US, VERIFICATION_WAIT_MAX_MS * 1000);
+    this->packetTimer = rttEstimator(PACKET_TIMEOUT_MS * 1000, PACKET_TIMEOUT_MIN_MS * 1000, PACKET_TIMEOUT_MAX_MS * 1000);
+    this->beaconTimer = rttEstimator(BEACON_TIMEOUT_MS * 1000, BEACON_TIMEOUT_MIN_MS * 1000, BEACON_TIMEOUT_MAX_MS * 1000);
+
+    opticalLink.updateBaudRate(this->profile->baud);
+
+    logEvent(EVENT_LINK_PROFILE, index, this->profile->frequency);
+
+    return true;
+  }
+
+  private: bool searchBeacon() {
+    bool signal = this->detectValidPulse();
+
+    if(signal) {
+      blue(true);
+
+      return true;
+    }
+
+    blue(false);
+
+    unsigned long start = micros();
+    uint32_t wait = this->beaconTimer.timeout();
+
+    while(!signal && (micros() - start) < wait) {
+      this->runAGC();
+
+      signal = this->detectValidPulse();
+    }
+
+    if(signal) {
+      this->beaconTimer.sample(micros() - start);
+    } else {
+      this->beaconTimer.backoff();
+    }
+
+    blue(signal);
+
+    return signal;
+  }
+
+  private: bool perhapsWeShouldReset(dataManager &dataManager, uartInterface &portUart) {
+    uint8_t next = (this->tx_send_slot + 1) % TX_FRAME_SLOTS;
+
+    if(!this->dataAvailableForTransmission(dataManager) && !this->tx_building
+        && __atomic_load_n(&this->tx_frames[next].state, __ATOMIC_ACQUIRE) != TX_FRAME_READY) {
+      portUart.data_available = false;
+      this->_reset = true;
+      
+      logEvent(EVENT_TX_RESET_REQUEST);
+
+      return true;
+    }
+
+    return false;
+  }
+
+  private: bool transmitAllowed(uartInterface &portUart) {
+    return portUart.data_available && (portUart.priority == TX_PRIORITY_IMMEDIATE
+        || (millis() - portUart.last_data_available) > TRANS_DELAY_MS);
+  }
+
+  /**
+   * Start streaming the next built frame. Whether it ends the session is
+   * decided now rather than when it was built: the reset field is outside
+   * the checksum, so the frame is patched in place.
+   */
+  private: bool takeOutgoingFrame(dataManager &dataManager, uartInterface &portUart) {
+    txFrame &frame = this->tx_frames[this->tx_send_slot];
+
+    if(__atomic_load_n(&frame.state, __ATOMIC_ACQUIRE) != TX_FRAME_READY) {
+      return false;
+    }
+
+    frame.state = TX_FRAME_ACTIVE;
+
+    this->tx_frame = &frame;
+    this->packet_pending = true;
+
+    packetCodec::markReset(frame.packet, frame.length, this->perhapsWeShouldReset(dataManager, portUart));
+
+    return true;
+  }
+
+  private: void releaseOutgoingFrame() {
+    __atomic_store_n(&this->tx_frame->state, TX_FRAME_FREE, __ATOMIC_RELEASE);
+
+    this->tx_send_slot = (this->tx_send_slot + 1) % TX_FRAME_SLOTS;
+  }
+
+  /**
+   * Build frames into the free slots ahead of the link: block reads, copy,
+   * checksum and header all happen while the current frame is on the line,
+   * so a verified frame is followed by the next one straight away.
+   */
+  public: void prepareOutgoingFrames(dataManager &dataManager, uartInterface &portUart) {
+    size_t length;
+
+    while(this->transmitAllowed(portUart)) {
+      txFrame &frame = this->tx_frames[this->tx_build_slot];
+      unsigned long build_start = micros();
+
+      if(__atomic_load_n(&frame.state, __ATOMIC_ACQUIRE) != TX_FRAME_FREE) {
+        return;
+      }
+
+      this->tx_building = true;
+
+      if(!this->dataAvailableForTransmission(dataManager) || (length = this->buildDataPacket(dataManager)) == 0
+        || !this->buildPacket(frame, length)) {
+        this->tx_building = false;
+
+        return;
+      }
+
+      frame.last_block = dataManager.outgoingReadPointer;
+      frame.flushes = dataManager.flushes;
+
+      __atomic_store_n(&frame.state, TX_FRAME_READY, __ATOMIC_RELEASE);
+
+      this->tx_building = false;
+      this->tx_build_slot = (this->tx_build_slot + 1) % TX_FRAME_SLOTS;
+
+      this->buildLatency.record(micros() - build_start);
+
+      notifyStage(linkStage);
+    }
+  }
+
+  /**
+   * Retire sent blocks from the RAM tier and read ahead the backlog blocks
+   * that follow the one currently on the wire
+   */
+  public: void prefetchOutgoingData(dataManager &dataManager) {
+    dataManager.serviceRamTier();
+
+    dataManager.prefetchOutgoingBlocks();
+  }
+
+  /**
+   * Fill data_buffer with up to frameSize.size() bytes and return how many.
+   * The payload may hold 0x00, so its length is never taken from the data.
+   * Whole ring blocks are
+   * copied straight in; a block only partly used by a smaller frame is kept
+   * in tx_block and its remainder starts the next frame.
+   */
+  private: size_t buildDataPacket(dataManager &dataManager) {
+    size_t frame_size = this->frameSize.size();
+    size_t filled = 0;
+    size_t chunk;
+    uint32_t block;
+    uint8_t * excess;
+
+    // A host flush also discards the rest of a partly sent block
+    if(this->tx_block_flushes != dataManager.flushes) {
+      this->tx_block_flushes = dataManager.flushes;
+      this->tx_block_length = 0;
+    }
+
+    while(filled < frame_size) {
+      if(this->tx_block_offset < this->tx_block_length) {
+        chunk = this->tx_block_length - this->tx_block_offset;
+
+        if(chunk > frame_size - filled) {
+          chunk = frame_size - filled;
+        }
+
+        dataManager.copy(this->tx_block + this->tx_block_offset, this->data_buffer + filled, (int) chunk);
+
+        this->tx_block_offset += chunk;
+        filled += chunk;
+
+        continue;
+      }
+
+      if(this->dataAvailableBufferBlocks(dataManager)) {
+        DATA_OP_BEGIN();
+        block = dataManager.advanceOutgoingReadPointer();
+        DATA_OP_END();
+
+        filled += this->takeBlock(dataManager, dataManager.returnOutgoingBlock(block), filled, frame_size);
+
+        continue;
+      }
+
+      // Partial data goes last, after every block still queued for the SD writer
+      if(filled == 0 && (excess = dataManager.takeOutgoingDataExcess()) != NULL) {
+        filled += this->takeBlock(dataManager, excess, filled, frame_size);
+
+        continue;
+      }
+
+      break;
+    }
+
+    return filled;
+  }
+
+  /**
+   * Copy the payload of a backlog block into the frame if it fits whole,
+   * otherwise stage it in tx_block. Returns the bytes added to the frame.
+   * The length comes from the block header, so padding is never sent; a
+   * block failing its header check is dropped, as is one a flush discarded.
+   */
+  private: size_t takeBlock(dataManager &dataManager, uint8_t * block, size_t filled, size_t frame_size) {
+    blockHeader header;
+
+    if(block == NULL) {
+      return 0;
+    }
+
+    if(!blockHeader::read(block, BUFFER_BLOCK_SIZE_BYTES, header)) {
+      this->invalidBlocks++;
+
+      logEvent(EVENT_BLOCK_INVALID, 0, header.sequence);
+
+      return 0;
+    }
+
+    if(frame_size - filled >= header.length) {
+      dataManager.copy(block + BLOCK_HEADER_BYTES, this->data_buffer + filled, (int) header.length);
+
+      return header.length;
+    }
+
+    dataManager.copy(block + BLOCK_HEADER_BYTES, this->tx_block, (int) header.length);
+    this->tx_block_offset = 0;
+    this->tx_block_length = header.length;
+
+    return 0;
+  }
+
+  // Frame the first `length` bytes of data_buffer into the slot; the reset field is set when the link takes it
+  private: bool buildPacket(txFrame &frame, size_t length) {
+    packetFields packet;
+
+    frame.flag = this->outgoingPacketFlag();
+    frame.payload_length = length;
+    frame.offset = this->session.frame(frame.payload_length);
+
+    packet.flag = frame.flag;
+    packet.session = this->session.id;
+    packet.offset = frame.offset;
+    packet.data = this->data_buffer;
+    packet.length = frame.payload_length;
+    packet.reset = false;
+
+    frame.length = packetCodec::build(packet, frame.packet, sizeof(frame.packet));
+
+    return frame.length > 0;
+  }
+
+  // Owned by the tx framer. Flags keep counting across a reset: the receiver answers with whichever flag it got
+  private: uint8_t outgoingPacketFlag() {
+    this->_outgoingPacketFlag++;
+    
+    if(this->_outgoingPacketFlag > 128) {
+      this->_outgoingPacketFlag = 1;
+    }
+
+    return this->_outgoingPacketFlag;
+  }
+
+  private: uint8_t expectIncomingPacketFlag(uint8_t current) {
+    this->_expectingIncomingPacketFlag = current + 1;
+    
+    if(this->_expectingIncomingPacketFlag > 128) {
+      this->_expectingIncomingPacketFlag = 1;
+    }
+
+    return this->_expectingIncomingPacketFlag;
+  }
+
+  private: void streamPacket() {
+    long start = millis();
+
+    logBegin(EVENT_TX_PREAMBLE);
+
+    while((millis() - start) < this->profile->preamble_ms) {
+      opticalLink.write(PRE_PACKET);
+      
+      delayMicroseconds(100);
+    }
+
+    delayMicroseconds(100);
+
+    logEnd(EVENT_TX_PREAMBLE);
+    logBegin(EVENT_TX_FRAME);
+
+    if(this->profile->line_code != LINE_CODE_NONE) {
+      this->writeCodedPacket(this->tx_frame->packet, this->tx_frame->length);
+    } else {
+      opticalLink.write(this->tx_frame->packet, this->tx_frame->length);
+    }
+
+    start = millis();
+
+    while((millis() - start) < this->profile->preamble_ms) {
+      opticalLink.write(POST_PACKET);
+      
+      delayMicroseconds(100);
+    }
+
+    logEnd(EVENT_TX_FRAME, this->tx_frame->flag);
+  }
+
+  public: void emitIncomingData(uartInterface &portUart) {
+    while(xQueueReceive(this->rxQueue, &this->emit_packet, 0) == pdTRUE) {
+      portUart.sendData(this->emit_packet.data, this->emit_packet.length);
+
+      this->handoffLatency.record(micros() - this->emit_packet.received_at);
+
+      activity();
+    }
+  }
+
+  /**
+   * Answer a pending FRAME_STATUS_REQUEST from the host
+   */
+  public: void emitHostStatus(dataManager &dataManager, uartInterface &portUart) {
+    hostStatus status;
+    unsigned long now = millis();
+
+    if(!portUart.status_requested) {
+      return;
+    }
+
+    portUart.status_requested = false;
+
+    status.backlog_blocks = dataManager.outgoingBacklogBlocks();
+    status.backlog_bytes = (uint64_t) status.backlog_blocks * BUFFER_BLOCK_PAYLOAD_BYTES + dataManager.outgoingBytePointer;
+    status.operational_mode = this->operational_mode;
+    status.transmission_mode = this->transmission_mode;
+    status.flow_paused = portUart.flow_paused ? 1 : 0;
+    status.priority = portUart.priority;
+    status.delivered_bytes = this->delivered_bytes;
+    status.delivered_packets = this->delivered_packets;
+    status.throughput_bps = now > this->status_time
+      ? (uint32_t) (((this->delivered_bytes - this->status_bytes) * 8000) / (now - this->status_time)) : 0;
+    status.overflow_blocked = dataManager.overflowBlocked;
+    status.overflow_dropped_oldest = dataManager.overflowDroppedOldest;
+    status.overflow_dropped_newest = dataManager.overflowDroppedNewest;
+    status.frame_size = this->frameSize.size();
+    status.frame_error_ppm = (uint32_t) (this->frameSize.frameErrorRate() * 1000000.0f);
+    status.ack_rtt_us = this->ackTimer.srtt_us;
+    status.ack_rtt_var_us = this->ackTimer.rttvar_us;
+    status.ack_timeout_us = this->ackTimer.timeout();
+    status.packet_timeout_us = this->packetTimer.timeout();
+    status.beacon_timeout_us = this->beaconTimer.timeout();
+    status.verify_repeats = this->verifyRepeats;
+
+    this->status_bytes = this->delivered_bytes;
+    this->status_time = now;
+
+    portUart.sendFrame(FRAME_STATUS, &status, sizeof(status));
+  }
+
+  /**
+   * Tell the host how much of its data the remote unit has verified, batched
+   * to UART_RECEIPT_BATCH_PACKETS or UART_RECEIPT_INTERVAL_MS
+   */
+  public: void emitDeliveryReceipts(uartInterface &portUart) {
+    #if UART_PROTOCOL == UART_PROTOCOL_FRAMED
+    hostReceipt receipt;
+    uint32_t pending = this->delivered_packets - this->receipt_packets;
+
+    if(pending == 0) {
+      return;
+    }
+
+    if(pending < UART_RECEIPT_BATCH_PACKETS && (millis() - this->receipt_time) < UART_RECEIPT_INTERVAL_MS) {
+      return;
+    }
+
+    receipt.delivered_bytes = this->delivered_bytes;
+    receipt.delivered_packets = this->delivered_packets;
+
+    this->receipt_packets = receipt.delivered_packets;
+    this->receipt_time = millis();
+
+    portUart.sendFrame(FRAME_RECEIPT, &receipt, sizeof(receipt));
+    #endif
+  }
+
+  private: void flush() {
+    while(opticalLink.available() > 0) {
+      opticalLink.read();
+    }
+  }
+
+  private: void remoteUnitResponds(bool condition = true) {
+    // this->remote_unit_responding = condition;
+    
+    // this->last_remote_unit_response = condition ? millis() : 0;
+  }
+
+  private: bool remoteUnitResponding() {
+    // if(!this->remote_unit_responding) {
+    //   return false;
+    // }
+
+    // if(this->last_remote_unit_response > millis()) {
+    //   return false;
+    // }
+
+    // return (millis() - this->last_remote_unit_response) < RESPONSE_TIMEOUT_MS;
+
+    return true;
+  }
+  
+};
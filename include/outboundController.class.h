@@ -1,20 +1,40 @@
-using namespace std;
-
-#include "uartInterface.class.h"
-#include "dataManager.class.h"
-#include "opticalInterface.class.h"
-
-class outboundController {
-  public: void run(uartInterface &portUart, dataManager &dataManager, opticalInterface &opticalInterface) {
-    /**
-     * Process incoming UART data
-     */
-    portUart.processOutgoingData(dataManager);
-
-    /**
-     * Optical interface housekeeping activities
-     */
-    opticalInterface.emitIncomingData();
-  }
-
-};
+using namespace std;
+
+#include "uartInterface.class.h"
+#include "dataManager.class.h"
+#include "opticalInterface.class.h"
+
+class outboundController {
+  public: void runIngest(uartInterface &portUart, dataManager &dataManager) {
+    /**
+     * Process incoming UART data
+     */
+    portUart.processOutgoingData(dataManager);
+  }
+
+  public: void runTxFramer(uartInterface &portUart, dataManager &dataManager, opticalInterface &opticalInterface) {
+    /**
+     * Build the next frames while the current packet is on the wire
+     */
+    opticalInterface.prepareOutgoingFrames(dataManager, portUart);
+
+    /**
+     * Read ahead backlog blocks for the frames after them
+     */
+    opticalInterface.prefetchOutgoingData(dataManager);
+  }
+
+  public: void runHostEmitter(uartInterface &portUart, dataManager &dataManager, opticalInterface &opticalInterface) {
+    /**
+     * Optical interface housekeeping activities
+     */
+    opticalInterface.emitIncomingData(portUart);
+
+    /**
+     * Host status replies and batched delivery receipts
+     */
+    opticalInterface.emitHostStatus(dataManager, portUart);
+    opticalInterface.emitDeliveryReceipts(portUart);
+  }
+
+};
@@ -0,0 +1,277 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "md5Digest.class.h"
+
+// Line bytes around packets and in answers
+#define RESPONSE_BEACON             (0x55)
+#define RESPONSE_VERIFICATION       (0xA7) // followed by the flag of the verified packet
+#define PRE_PACKET                  (0x5E)
+#define POST_PACKET                 (0x7C)
+
+#define PACKET_MD5_CHARS            (32)
+
+// Digest phases while a packet arrives
+#define PACKET_DIGEST_HEADER        (0) // looking for [data]
+#define PACKET_DIGEST_DATA          (1) // hashing the payload, looking for [rst]
+#define PACKET_DIGEST_DONE          (2)
+
+/**
+ * Fields of one data packet. On the line a packet is text:
+ * [flag]N[session]8 hex[offset]N[checksum]md5 of data[length]N[data]...[rst]0|1[footer]
+ * preceded by PRE_PACKET bytes and followed by POST_PACKET bytes. The
+ * payload is found by its [length], so it may hold any byte but POST_PACKET,
+ * which ends the packet on the line.
+ */
+struct packetFields {
+  uint8_t flag;             // 1..128, pairs the packet with its verification
+  uint32_t session;         // sender session id
+  uint64_t offset;          // stream offset of the first payload byte
+  const uint8_t * data;
+  size_t length;
+  bool reset;               // last packet: the receiver resets once it is verified
+};
+
+/**
+ * Hashes the payload of a packet while it is still arriving. update() is
+ * called with the receive buffer each time bytes were appended; bytes are
+ * hashed once they are too far back to be part of the [rst] marker, so
+ * when POST_PACKET arrives only the header fields are left to check.
+ */
+class packetDigest {
+  private: md5Digest md5;
+  private: uint8_t phase = PACKET_DIGEST_HEADER;
+  private: size_t scanned = 0;
+  private: size_t hashed = 0;
+
+  public: size_t data_start = 0;
+  public: size_t data_end = 0;
+  public: char hex[PACKET_MD5_CHARS];
+
+  public: void begin() {
+    this->md5.begin();
+    this->phase = PACKET_DIGEST_HEADER;
+    this->scanned = 0;
+  }
+
+  public: bool complete() {
+    return this->phase == PACKET_DIGEST_DONE;
+  }
+
+  public: void update(const uint8_t * received, size_t length) {
+    while(this->scanned < length && this->phase != PACKET_DIGEST_DONE) {
+      size_t p = ++this->scanned;
+
+      if(this->phase == PACKET_DIGEST_HEADER) {
+        if(p >= 6 && memcmp(received + p - 6, "[data]", 6) == 0) {
+          this->phase = PACKET_DIGEST_DATA;
+          this->data_start = this->hashed = p;
+        }
+
+        continue;
+      }
+
+      if(p - this->data_start >= 5 && memcmp(received + p - 5, "[rst]", 5) == 0) {
+        this->data_end = p - 5;
+        this->md5.add(received + this->hashed, this->data_end - this->hashed);
+        this->md5.hex(this->hex);
+        this->phase = PACKET_DIGEST_DONE;
+      }
+    }
+
+    // Hash whole MD5 blocks that can no longer be part of [rst]
+    if(this->phase == PACKET_DIGEST_DATA && this->scanned >= this->hashed + 5 + 64) {
+      size_t ready = (this->scanned - 5 - this->hashed) & ~((size_t) 63);
+
+      this->md5.add(received + this->hashed, ready);
+      this->hashed += ready;
+    }
+  }
+};
+
+/**
+ * Packet framing and checksums, shared by the firmware and the Linux
+ * endpoint daemon (tools/ocpd.cpp).
+ */
+class packetCodec {
+  /**
+   * Write the packet to out as a terminated string. Returns its length
+   * without the terminator, 0 if it does not fit in capacity.
+   */
+  public: static size_t build(const packetFields &packet, uint8_t * out, size_t capacity) {
+    char checksum[PACKET_MD5_CHARS + 1];
+    md5Digest md5;
+    int written;
+
+    md5.add(packet.data, packet.length);
+    md5.hex(checksum);
+    checksum[PACKET_MD5_CHARS] = 0x00;
+
+    written = snprintf((char *) out, capacity, "[flag]%u[session]%08lx[offset]%llu[checksum]%s[length]%u[data]",
+      packet.flag, (unsigned long) packet.session, (unsigned long long) packet.offset, checksum, (unsigned int) packet.length);
+
+    if(written < 0 || (size_t) written + packet.length + sizeof("[rst]0[footer]") > capacity) {
+      return 0;
+    }
+
+    memcpy(out + written, packet.data, packet.length);
+    written += (int) packet.length;
+
+    written += snprintf((char *) out + written, capacity - written, "[rst]%c[footer]", packet.reset ? '1' : '0');
+
+    return (size_t) written;
+  }
+
+  /**
+   * Validate a received packet (leading PRE_PACKET bytes are ignored) and
+   * point packet.data into it. Fails on missing fields, a payload over
+   * max_length, a payload not followed by [rst] after [length] bytes or a
+   * bad checksum. A digest that followed the packet in saves hashing the
+   * payload again.
+   */
+  public: static bool parse(const uint8_t * received, size_t length, size_t max_length, packetFields &packet,
+      packetDigest * digest = NULL) {
+    const uint8_t * field;
+    size_t field_length;
+    uint64_t value;
+    char checksum[PACKET_MD5_CHARS];
+    md5Digest md5;
+
+    if(!packetCodec::field(received, length, "[flag]", "[session]", field, field_length)
+        || !packetCodec::number(field, field_length, 10, value) || value == 0 || value > 0xFF) {
+      return false;
+    }
+
+    packet.flag = (uint8_t) value;
+
+    if(!packetCodec::field(received, length, "[session]", "[offset]", field, field_length)
+        || !packetCodec::number(field, field_length, 16, value)) {
+      return false;
+    }
+
+    packet.session = (uint32_t) value;
+
+    if(!packetCodec::field(received, length, "[offset]", "[checksum]", field, field_length)
+        || !packetCodec::number(field, field_length, 10, packet.offset)) {
+      return false;
+    }
+
+    if(!packetCodec::field(received, length, "[length]", "[data]", field, field_length)
+        || !packetCodec::number(field, field_length, 10, value) || value > max_length) {
+      return false;
+    }
+
+    // The payload may contain the markers itself: only the one right after it counts
+    packet.data = field + field_length + strlen("[data]");
+    packet.length = (size_t) value;
+
+    if((size_t) (packet.data - received) + packet.length + strlen("[rst]") > length
+        || memcmp(packet.data + packet.length, "[rst]", strlen("[rst]")) != 0) {
+      return false;
+    }
+
+    if(!packetCodec::field(received, length, "[checksum]", "[length]", field, field_length)
+        || field_length != PACKET_MD5_CHARS) {
+      return false;
+    }
+
+    if(digest != NULL && digest->complete() && received + digest->data_start == packet.data
+        && digest->data_end - digest->data_start == packet.length) {
+      memcpy(checksum, digest->hex, PACKET_MD5_CHARS);
+    } else {
+      md5.add(packet.data, packet.length);
+      md5.hex(checksum);
+    }
+
+    if(memcmp(field, checksum, PACKET_MD5_CHARS) != 0) {
+      return false;
+    }
+
+    if(!packetCodec::field(packet.data + packet.length, length - (size_t) (packet.data + packet.length - received),
+        "[rst]", "[footer]", field, field_length)) {
+      return false;
+    }
+
+    packet.reset = field_length == 1 && field[0] == '1';
+
+    return true;
+  }
+
+  // Set the reset field of a built packet; it is not covered by the checksum
+  public: static void markReset(uint8_t * built, size_t length, bool reset) {
+    built[length - sizeof("[footer]")] = reset ? '1' : '0';
+  }
+
+  // Whether a payload survives the framing: no POST_PACKET, which would end the packet early
+  public: static bool representable(const uint8_t * data, size_t length) {
+    return memchr(data, POST_PACKET, length) == NULL;
+  }
+
+  // Bytes between the first `start` marker and the `finish` marker after it
+  private: static bool field(const uint8_t * received, size_t length, const char * start, const char * finish,
+      const uint8_t * &field, size_t &field_length) {
+    const uint8_t * begin = packetCodec::find(received, length, start);
+    const uint8_t * end;
+
+    if(begin == NULL) {
+      return false;
+    }
+
+    begin += strlen(start);
+    end = packetCodec::find(begin, length - (size_t) (begin - received), finish);
+
+    if(end == NULL) {
+      return false;
+    }
+
+    field = begin;
+    field_length = (size_t) (end - begin);
+
+    return true;
+  }
+
+  private: static const uint8_t * find(const uint8_t * haystack, size_t length, const char * needle) {
+    size_t needle_length = strlen(needle);
+
+    for(size_t n=0; n+needle_length<=length; n++) {
+      if(haystack[n] == (uint8_t) needle[0] && memcmp(haystack + n, needle, needle_length) == 0) {
+        return haystack + n;
+      }
+    }
+
+    return NULL;
+  }
+
+  private: static bool number(const uint8_t * text, size_t length, uint8_t base, uint64_t &value) {
+    value = 0;
+
+    if(length == 0 || length > 20) {
+      return false;
+    }
+
+    for(size_t n=0; n<length; n++) {
+      uint8_t c = text[n], digit;
+
+      if(c >= '0' && c <= '9') {
+        digit = c - '0';
+      } else if(base == 16 && c >= 'a' && c <= 'f') {
+        digit = c - 'a' + 10;
+      } else if(base == 16 && c >= 'A' && c <= 'F') {
+        digit = c - 'A' + 10;
+      } else {
+        return false;
+      }
+
+      value = value * base + digit;
+    }
+
+    return true;
+  }
+
+};
@@ -1,13 +1,17 @@
 #pragma once
 
+#include "indicator.class.h"
+
 #define LED_RED 13
 #define LED_BLUE 12
 #define BUZZER 21
 #define PIN_STATE 15
 
-bool condition_red = false;
 bool condition_blue = false;
 
+// Red LED and buzzer patterns, played off the data path
+indicator indication;
+
 void initializePeripherals() {
   // LEDs
   pinMode(LED_RED, OUTPUT);
@@ -22,12 +26,8 @@ void initializePeripherals() {
   // Set state pin to low by default
   delay(10);
   digitalWrite(PIN_STATE, LOW);
-}
-
-void red(bool condition = true) {
-  condition_red = condition;
 
-  digitalWrite(LED_RED, condition ? HIGH : LOW);
+  indication.begin(LED_RED, BUZZER);
 }
 
 void blue(bool condition = true) {
@@ -36,10 +36,6 @@ void blue(bool condition = true) {
   digitalWrite(LED_BLUE, condition ? HIGH : LOW);
 }
 
-void redToggle() {
-  red(!condition_red);
-}
-
 void blueToggle() {
   blue(!condition_blue);
 }
@@ -47,23 +43,16 @@ void blueToggle() {
 void ring(int times = 1, int intensity = 5, int delay_ms = 50) {
   // intensity: 5 = LOW; 50 = HIGH
 
-  for(int r=0; r<times; r++) {
-    delay(delay_ms);
-    digitalWrite(BUZZER, HIGH);
-
-    delay(intensity);
-    digitalWrite(BUZZER, LOW);
-  }
+  indication.post(INDICATOR_BUZZER, times, intensity, delay_ms);
 }
 
-void ringMicroseconds(int times = 1, int intensity = 50, int delay_us = 10) {
-  for(int r=0; r<times; r++) {
-    delayMicroseconds(delay_us);
-    digitalWrite(BUZZER, HIGH);
+void flash(int times = 1, int on_ms = 150, int off_ms = 150) {
+  indication.post(INDICATOR_RED, times, on_ms, off_ms);
+}
 
-    delayMicroseconds(intensity);
-    digitalWrite(BUZZER, LOW);
-  }
+// Packet passed: a red flash and a click, rate limited
+void activity() {
+  indication.activity();
 }
 
 void state(bool condition = true) {
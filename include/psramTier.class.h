@@ -0,0 +1,193 @@
+using namespace std;
+
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include <esp_heap_caps.h>
+#endif
+
+// Write-back RAM tier in front of the SD ring buffer (blocks of BUFFER_BLOCK_SIZE_BYTES)
+#ifndef PSRAM_TIER_BLOCKS
+#define PSRAM_TIER_BLOCKS         (4096)
+#endif
+
+// Unsent blocks older than this are spilled to SD for power-loss protection (0 = never)
+#ifndef PSRAM_TIER_FLUSH_MS
+#define PSRAM_TIER_FLUSH_MS       (5000)
+#endif
+
+struct psramTierEntry {
+  uint32_t block;
+  uint32_t stamp;
+  bool consumed;
+};
+
+/**
+ * FIFO of completed ring buffer blocks that have not been written to SD.
+ * Blocks enter in ring order, so a block's slot is found from its distance
+ * to the oldest entry without searching.
+ */
+class psramTier {
+  private: uint8_t * data = NULL;
+  private: psramTierEntry * entries = NULL;
+
+  private: uint32_t capacity = 0;
+  private: uint32_t head = 0;
+  private: uint32_t count = 0;
+
+  private: uint32_t ring_start = 0;
+  private: uint32_t ring_span = 1;
+
+  // metrics
+  public: uint32_t pushed = 0;
+  public: uint32_t spilled = 0;
+  public: uint32_t dropped = 0;
+
+  public: bool begin(uint32_t capacity, uint32_t ring_start, uint32_t ring_span) {
+    this->ring_start = ring_start;
+    this->ring_span = ring_span;
+
+    if(capacity == 0) {
+      return false;
+    }
+
+    #ifdef ARDUINO
+    if(!psramFound()) {
+      return false;
+    }
+
+    this->data = (uint8_t *) heap_caps_malloc((size_t) capacity * BUFFER_BLOCK_SIZE_BYTES, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    this->entries = (psramTierEntry *) heap_caps_malloc((size_t) capacity * sizeof(psramTierEntry), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    #else
+    this->data = (uint8_t *) malloc((size_t) capacity * BUFFER_BLOCK_SIZE_BYTES);
+    this->entries = (psramTierEntry *) malloc((size_t) capacity * sizeof(psramTierEntry));
+    #endif
+
+    if(this->data == NULL || this->entries == NULL) {
+      this->release();
+
+      return false;
+    }
+
+    this->capacity = capacity;
+    this->clear();
+
+    return true;
+  }
+
+  public: bool enabled() {
+    return this->capacity > 0;
+  }
+
+  public: bool full() {
+    return this->count >= this->capacity;
+  }
+
+  public: uint32_t occupancy() {
+    return this->count;
+  }
+
+  public: uint32_t size() {
+    return this->capacity;
+  }
+
+  public: void clear() {
+    this->head = 0;
+    this->count = 0;
+  }
+
+  public: void push(uint32_t block, const uint8_t * src, uint32_t now) {
+    uint32_t index = (this->head + this->count) % this->capacity;
+
+    memcpy(this->data + (size_t) index * BUFFER_BLOCK_SIZE_BYTES, src, BUFFER_BLOCK_SIZE_BYTES);
+
+    this->entries[index].block = block;
+    this->entries[index].stamp = now;
+    this->entries[index].consumed = false;
+
+    this->count++;
+    this->pushed++;
+  }
+
+  public: uint8_t * lookup(uint32_t block) {
+    int32_t index = this->find(block);
+
+    return index < 0 ? NULL : this->data + (size_t) index * BUFFER_BLOCK_SIZE_BYTES;
+  }
+
+  public: void markConsumed(uint32_t block) {
+    int32_t index = this->find(block);
+
+    if(index >= 0) {
+      this->entries[index].consumed = true;
+    }
+  }
+
+  public: uint8_t * oldest(uint32_t &block, bool &consumed) {
+    block = this->entries[this->head].block;
+    consumed = this->entries[this->head].consumed;
+
+    return this->data + (size_t) this->head * BUFFER_BLOCK_SIZE_BYTES;
+  }
+
+  public: bool oldestExpired(uint32_t now, uint32_t max_age) {
+    return max_age > 0 && (now - this->entries[this->head].stamp) >= max_age;
+  }
+
+  public: bool oldestConsumed() {
+    return this->entries[this->head].consumed;
+  }
+
+  // Remove the oldest entry; `spill` records whether it had to be written to SD
+  public: void popOldest(bool spill) {
+    this->head = (this->head + 1) % this->capacity;
+    this->count--;
+
+    if(spill) {
+      this->spilled++;
+    } else {
+      this->dropped++;
+    }
+  }
+
+  // Share of blocks leaving the tier that had to be written to SD
+  public: float spillRate() {
+    uint32_t total = this->spilled + this->dropped;
+
+    return total > 0 ? (float) this->spilled / (float) total : 0.0;
+  }
+
+  private: int32_t find(uint32_t block) {
+    if(this->count == 0) {
+      return -1;
+    }
+
+    uint32_t first = this->entries[this->head].block;
+    uint32_t distance = ((block - this->ring_start) + this->ring_span - (first - this->ring_start)) % this->ring_span;
+
+    if(distance >= this->count) {
+      return -1;
+    }
+
+    uint32_t index = (this->head + distance) % this->capacity;
+
+    return this->entries[index].block == block ? (int32_t) index : -1;
+  }
+
+  private: void release() {
+    #ifdef ARDUINO
+    heap_caps_free(this->data);
+    heap_caps_free(this->entries);
+    #else
+    free(this->data);
+    free(this->entries);
+    #endif
+
+    this->data = NULL;
+    this->entries = NULL;
+  }
+
+};
@@ -0,0 +1,118 @@
+using namespace std;
+
+#pragma once
+
+#include "esp_idf_version.h"
+
+// Capture modes requested with FRAME_CAPTURE
+#define PULSE_CAPTURE_FIXED         (0) // edges at the current gain and load
+#define PULSE_CAPTURE_SWEEP         (1) // two high pulses per AGC gain/load step
+
+#define PULSE_CAPTURE_MAX_EDGES     (16384)
+#define PULSE_CAPTURE_TIMEOUT_MS    (1000)
+#define PULSE_CAPTURE_STEP_US       (200)
+#define PULSE_CAPTURE_SWEEP_EDGES   (16)
+
+// Capture timer runs from the 80 MHz APB clock
+#define PULSE_CAPTURE_TICK_HZ       (80000000)
+#define PULSE_CAPTURE_HIGH          (0x80000000)
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+#define PULSE_CAPTURE_SUPPORTED     (1)
+#include "driver/mcpwm.h"
+#else
+#define PULSE_CAPTURE_SUPPORTED     (0)
+#endif
+
+/**
+ * Hardware timer capture of the optical input. The MCPWM capture unit
+ * latches a timestamp on every edge, so widths do not depend on interrupt
+ * latency. Each stored edge is the duration of the level that just ended,
+ * in capture ticks, with PULSE_CAPTURE_HIGH set for high levels.
+ */
+class pulseCapture {
+  private: uint32_t * edges = NULL;
+  private: uint32_t capacity = 0;
+  private: volatile uint32_t count = 0;
+  private: volatile uint32_t last = 0;
+  private: volatile bool started = false;
+
+  public: bool begin(uint8_t pin, uint32_t capacity) {
+    #if PULSE_CAPTURE_SUPPORTED
+    this->edges = (uint32_t *) malloc(capacity * sizeof(uint32_t));
+
+    if(this->edges == NULL) {
+      return false;
+    }
+
+    this->capacity = capacity;
+
+    return mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM_CAP_0, pin) == ESP_OK;
+    #else
+    return false;
+    #endif
+  }
+
+  public: void end() {
+    free(this->edges);
+
+    this->edges = NULL;
+    this->capacity = 0;
+  }
+
+  public: void start() {
+    #if PULSE_CAPTURE_SUPPORTED
+    mcpwm_capture_config_t config;
+
+    this->count = 0;
+    this->started = false;
+
+    config.cap_edge = MCPWM_BOTH_EDGE;
+    config.cap_prescale = 1;
+    config.capture_cb = pulseCapture::onEdge;
+    config.user_data = this;
+
+    mcpwm_capture_enable_channel(MCPWM_UNIT_0, MCPWM_SELECT_CAP0, &config);
+    #endif
+  }
+
+  public: void stop() {
+    #if PULSE_CAPTURE_SUPPORTED
+    mcpwm_capture_disable_channel(MCPWM_UNIT_0, MCPWM_SELECT_CAP0);
+    #endif
+  }
+
+  public: bool full() {
+    return this->count >= this->capacity;
+  }
+
+  public: uint32_t captured() {
+    return this->count;
+  }
+
+  public: uint32_t edge(uint32_t index) {
+    return this->edges[index];
+  }
+
+  public: static uint32_t nanoseconds(uint32_t edge) {
+    return (uint32_t) (((uint64_t) (edge & ~PULSE_CAPTURE_HIGH) * 1000000000) / PULSE_CAPTURE_TICK_HZ);
+  }
+
+  #if PULSE_CAPTURE_SUPPORTED
+  private: static bool IRAM_ATTR onEdge(mcpwm_unit_t unit, mcpwm_capture_channel_id_t channel, const cap_event_data_t * event, void * user_data) {
+    pulseCapture * capture = (pulseCapture *) user_data;
+
+    // A falling edge ends a high level
+    if(capture->started && capture->count < capture->capacity) {
+      capture->edges[capture->count++] = (event->cap_value - capture->last)
+        | (event->cap_edge == MCPWM_NEG_EDGE ? PULSE_CAPTURE_HIGH : 0);
+    }
+
+    capture->last = event->cap_value;
+    capture->started = true;
+
+    return false;
+  }
+  #endif
+
+};
@@ -0,0 +1,129 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+
+// Pulse widths are compared in fixed point, 1/16 us
+#define PULSE_FRACTION_BITS         (4)
+
+// Signal pulse bounds, relative to the clock period
+#define LOWER_DETECTABLE(period)    ((period)/2 - (period)/16)
+#define UPPER_DETECTABLE(period)    ((period)/2 + (period)/16)
+#define LOWER_VALID(period)         ((period)/4 + (period)/16)
+#define UPPER_VALID(period)         ((period)/2 + (3*(period))/16)
+
+// AGC sweep: every load step tries gains from AGC_GAIN_START down to 0
+#define AGC_LOAD_MAX                (255)
+#define AGC_GAIN_START              (128)
+
+/**
+ * Pulse width windows used to detect a beacon and to validate the link,
+ * in 1/16 us so they are exact for every supported clock and resolve at
+ * compile time. Shared with the host pulse analyzer, which replays
+ * captured traces through the same checks.
+ */
+class pulseDetector {
+  public: uint32_t lower;
+  public: uint32_t upper;
+  public: uint32_t lower_valid;
+  public: uint32_t upper_valid;
+
+  public: constexpr pulseDetector(uint32_t period)
+    : lower(LOWER_DETECTABLE(period)), upper(UPPER_DETECTABLE(period)),
+      lower_valid(LOWER_VALID(period)), upper_valid(UPPER_VALID(period)) {}
+
+  /**
+   * pulseIn measures whole microseconds, so a window that holds none can
+   * never pass; both windows must hold at least one
+   */
+  public: constexpr bool measurable() const {
+    return pulseDetector::holdsMicrosecond(this->lower, this->upper)
+        && pulseDetector::holdsMicrosecond(this->lower_valid, this->upper_valid);
+  }
+
+  // Clock period in 1/16 us
+  public: static constexpr uint32_t period(uint32_t frequency) {
+    return (1000000UL << PULSE_FRACTION_BITS) / frequency;
+  }
+
+  // Widths in whole microseconds, as returned by pulseIn
+  public: bool detectable(long pulse1, long pulse2) const {
+    if(pulse1 <= 0 || pulse2 <= 0) {
+      return false;
+    }
+
+    return this->within(pulse1, this->lower, this->upper)
+        && this->within(pulse2, this->lower, this->upper);
+  }
+
+  public: bool valid(long pulse1, long pulse2) const {
+    if(pulse1 <= 0 || pulse2 <= 0) {
+      return false;
+    }
+
+    return this->within(pulse1, this->lower_valid, this->upper_valid)
+        && this->within(pulse2, this->lower_valid, this->upper_valid);
+  }
+
+  // The first whole microsecond above lower is below upper; bounds are exclusive as in within()
+  private: static constexpr bool holdsMicrosecond(uint32_t lower, uint32_t upper) {
+    return (((lower >> PULSE_FRACTION_BITS) + 1) << PULSE_FRACTION_BITS) < upper;
+  }
+
+  private: static bool within(long pulse, uint32_t lower, uint32_t upper) {
+    uint32_t width = (uint32_t) pulse << PULSE_FRACTION_BITS;
+
+    return width > lower && width < upper;
+  }
+
+};
+
+/**
+ * AGC scoring: the longest run of consecutive gains that detect a pulse at
+ * one load wins, and the gain is set a little above the middle of that run.
+ */
+class agcSearch {
+  private: int long_gain = 0;
+  private: int long_load = 0;
+  private: int long_pulse = 1;
+  private: int pulse_count = 0;
+
+  // load step for the sweep; higher frequencies need finer load control
+  public: static constexpr int loadIncrement(long frequency) {
+    return frequency < 250000 ? 5 : frequency >= 400000 ? 1 : (int) ((frequency - 250000) * (1 - 4) / (400000 - 250000) + 4);
+  }
+
+  public: void beginLoad() {
+    this->pulse_count = 0;
+  }
+
+  public: void observe(int load, int gain, bool pulse) {
+    if(!pulse) {
+      this->pulse_count = 0;
+
+      return;
+    }
+
+    this->pulse_count++;
+
+    if(this->pulse_count >= this->long_pulse) {
+      this->long_pulse = this->pulse_count;
+      this->long_gain = gain + (this->pulse_count*4)/2 + 4;
+      this->long_load = load;
+    }
+  }
+
+  public: bool resolved() {
+    return this->long_pulse > 1;
+  }
+
+  public: int gain() {
+    return this->long_gain;
+  }
+
+  public: int load() {
+    return this->long_load;
+  }
+
+};
@@ -0,0 +1,63 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+
+// Gains of the smoothed round trip time and its mean deviation (RFC 6298): 1/8 and 1/4
+#define RTT_SRTT_SHIFT              (3)
+#define RTT_VAR_SHIFT               (2)
+
+// Deviations added to the smoothed time for the timeout
+#define RTT_VAR_FACTOR              (4)
+
+/**
+ * Round trip estimate of one timed exchange on a link, Jacobson/Karels
+ * style: timeout = srtt + 4 * rttvar, clamped to [min, max]. A timeout
+ * doubles the value until the next sample. Callers only sample exchanges
+ * that were not repeated (Karn), since an answer to a repeat cannot be
+ * matched to the attempt that caused it.
+ */
+class rttEstimator {
+  private: uint32_t min_us;
+  private: uint32_t max_us;
+  private: uint32_t rto_us;
+
+  public: uint32_t srtt_us = 0;
+  public: uint32_t rttvar_us = 0;
+  public: uint32_t samples = 0;
+  public: uint32_t backoffs = 0;
+
+  public: rttEstimator(uint32_t initial_us, uint32_t min_us, uint32_t max_us)
+    : min_us(min_us), max_us(max_us), rto_us(initial_us) {}
+
+  public: uint32_t timeout() {
+    return this->rto_us;
+  }
+
+  public: void sample(uint32_t rtt_us) {
+    if(this->samples++ == 0) {
+      this->srtt_us = rtt_us;
+      this->rttvar_us = rtt_us / 2;
+    } else {
+      int32_t error = (int32_t) (rtt_us - this->srtt_us);
+      uint32_t deviation = (uint32_t) (error < 0 ? -error : error);
+
+      this->srtt_us = (uint32_t) ((int32_t) this->srtt_us + (error >> RTT_SRTT_SHIFT));
+      this->rttvar_us = (uint32_t) ((int32_t) this->rttvar_us + (((int32_t) deviation - (int32_t) this->rttvar_us) >> RTT_VAR_SHIFT));
+    }
+
+    this->rto_us = this->clamp(this->srtt_us + RTT_VAR_FACTOR * this->rttvar_us);
+  }
+
+  // No answer within timeout(): wait twice as long next time
+  public: void backoff() {
+    this->backoffs++;
+    this->rto_us = this->clamp(this->rto_us * 2);
+  }
+
+  private: uint32_t clamp(uint32_t value) {
+    return value < this->min_us ? this->min_us : (value > this->max_us ? this->max_us : value);
+  }
+
+};
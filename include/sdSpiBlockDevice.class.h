@@ -0,0 +1,95 @@
+using namespace std;
+
+#pragma once
+
+#include "blockDevice.class.h"
+
+// PIN definitions
+#define SDCS_PIN 14
+
+// SPI clock used for the uSD card
+#define SD_SPI_CLOCK_MHZ          (20)
+
+class sdSpiBlockDevice : public blockDevice {
+  private: SdFat &uSD;
+  private: uint8_t cs_pin;
+  private: uint32_t clock;
+
+  public: sdSpiBlockDevice(SdFat &uSD, uint8_t cs_pin = SDCS_PIN, uint32_t clock = SD_SCK_MHZ(SD_SPI_CLOCK_MHZ))
+    : uSD(uSD), cs_pin(cs_pin), clock(clock) {}
+
+  public: bool begin() {
+    bool ready;
+
+    SPI_OP_BEGIN();
+    ready = this->uSD.cardBegin(this->cs_pin, this->clock);
+    SPI_OP_END();
+
+    return ready;
+  }
+
+  public: const char * name() {
+    return PROGMEM "SdFat/SPI";
+  }
+
+  public: uint32_t blockCount() {
+    uint32_t blocks;
+
+    SPI_OP_BEGIN();
+    blocks = this->uSD.card()->cardCapacity();
+    SPI_OP_END();
+
+    return blocks;
+  }
+
+  public: bool readBlock(uint32_t block, uint8_t * dst) {
+    bool result;
+
+    SPI_OP_BEGIN();
+    result = this->uSD.card()->readBlock(block, dst);
+    SPI_OP_END();
+
+    return result;
+  }
+
+  public: bool writeBlock(uint32_t block, const uint8_t * src) {
+    bool result;
+
+    SPI_OP_BEGIN();
+    result = this->uSD.card()->writeBlock(block, src);
+    SPI_OP_END();
+
+    return result;
+  }
+
+  public: bool readBlocks(uint32_t block, uint8_t * dst, size_t count) {
+    bool result;
+
+    SPI_OP_BEGIN();
+    result = this->uSD.card()->readBlocks(block, dst, count);
+    SPI_OP_END();
+
+    return result;
+  }
+
+  public: bool writeBlocks(uint32_t block, const uint8_t * src, size_t count) {
+    bool result;
+
+    SPI_OP_BEGIN();
+    result = this->uSD.card()->writeBlocks(block, src, count);
+    SPI_OP_END();
+
+    return result;
+  }
+
+  public: bool erase(uint32_t first, uint32_t last) {
+    bool result;
+
+    SPI_OP_BEGIN();
+    result = this->uSD.card()->erase(first, last);
+    SPI_OP_END();
+
+    return result;
+  }
+
+};
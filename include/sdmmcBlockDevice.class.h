@@ -0,0 +1,85 @@
+using namespace std;
+
+#pragma once
+
+#include "blockDevice.class.h"
+#include "esp_idf_version.h"
+#include "driver/sdmmc_host.h"
+#include "sdmmc_cmd.h"
+
+/**
+ * ESP32 SDMMC host (slot 1). Bus pins are fixed by the peripheral:
+ * CLK 14, CMD 15, D0 2, D1 4, D2 12, D3 13. In 4-bit mode these collide with
+ * LED_RED, LED_BLUE and PIN_STATE, so boards using this backend need those
+ * signals moved. 1-bit mode only claims CLK, CMD and D0.
+ */
+#define SDMMC_BUS_WIDTH           (4)
+#define SDMMC_CLOCK_KHZ           (SDMMC_FREQ_HIGHSPEED)
+
+class sdmmcBlockDevice : public blockDevice {
+  private: sdmmc_card_t card;
+  private: bool host_initialized = false;
+  private: uint8_t width;
+  private: int clock_khz;
+
+  public: sdmmcBlockDevice(uint8_t width = SDMMC_BUS_WIDTH, int clock_khz = SDMMC_CLOCK_KHZ)
+    : width(width), clock_khz(clock_khz) {}
+
+  public: bool begin() {
+    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+    host.max_freq_khz = this->clock_khz;
+
+    sdmmc_slot_config_t slot = SDMMC_SLOT_CONFIG_DEFAULT();
+    slot.width = this->width;
+    slot.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+
+    if(!this->host_initialized) {
+      if(sdmmc_host_init() != ESP_OK) {
+        return false;
+      }
+
+      if(sdmmc_host_init_slot(host.slot, &slot) != ESP_OK) {
+        sdmmc_host_deinit();
+
+        return false;
+      }
+
+      this->host_initialized = true;
+    }
+
+    return sdmmc_card_init(&host, &this->card) == ESP_OK;
+  }
+
+  public: const char * name() {
+    return this->width == 4 ? PROGMEM "SDMMC/4-bit" : PROGMEM "SDMMC/1-bit";
+  }
+
+  public: uint32_t blockCount() {
+    return (uint32_t) this->card.csd.capacity;
+  }
+
+  public: bool readBlock(uint32_t block, uint8_t * dst) {
+    return sdmmc_read_sectors(&this->card, dst, block, 1) == ESP_OK;
+  }
+
+  public: bool writeBlock(uint32_t block, const uint8_t * src) {
+    return sdmmc_write_sectors(&this->card, src, block, 1) == ESP_OK;
+  }
+
+  public: bool readBlocks(uint32_t block, uint8_t * dst, size_t count) {
+    return sdmmc_read_sectors(&this->card, dst, block, count) == ESP_OK;
+  }
+
+  public: bool writeBlocks(uint32_t block, const uint8_t * src, size_t count) {
+    return sdmmc_write_sectors(&this->card, src, block, count) == ESP_OK;
+  }
+
+  public: bool erase(uint32_t first, uint32_t last) {
+    #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+    return sdmmc_erase_sectors(&this->card, first, last - first + 1, SDMMC_ERASE_ARG) == ESP_OK;
+    #else
+    return false;
+    #endif
+  }
+
+};
@@ -0,0 +1,254 @@
+using namespace std;
+
+#pragma once
+
+#include <string.h>
+#include "dataManager.class.h"
+#include "latencyHistogram.class.h"
+
+// Blocks per measured pass, and blocks pushed across the ring end
+#ifndef STORAGE_BENCH_BLOCKS
+#define STORAGE_BENCH_BLOCKS        (2048)
+#endif
+#define STORAGE_BENCH_WRAP_BLOCKS   (64)
+
+/**
+ * Storage path microbenchmark: ingest, raw device access, verified writes,
+ * transmitter reads with and without read-ahead, and the ring wrap. Every
+ * operation is timed per block and printed as one table row, so runs on
+ * the same device can be compared line by line.
+ *
+ * Destroys the buffered backlog and overwrites the ring area of the device.
+ * Runs on the target with -DSTORAGE_BENCH and on Linux (tools/storageBench.cpp).
+ */
+class storageBench {
+  private: dataManager * dm;
+  private: latencyHistogram latency;
+  private: uint8_t data[BUFFER_BLOCK_SIZE_BYTES];
+  private: uint8_t readback[BUFFER_BLOCK_SIZE_BYTES];
+
+  public: storageBench(dataManager &dm) : dm(&dm) {}
+
+  public: bool run(uint32_t blocks = STORAGE_BENCH_BLOCKS) {
+    bool ordered;
+
+    Serial.printf("storage bench: %s, %u blocks per pass, RAM tier %s\n",
+      this->dm->storage()->name(), blocks, this->dm->ramTier.enabled() ? "on" : "off");
+    Serial.printf("%-16s %6s %8s %8s %8s %8s %8s\n", "op", "n", "MB/s", "ns/B", "p50 us", "p99 us", "max us");
+
+    this->benchPush(blocks);
+    this->benchRawWrite(blocks);
+    this->benchRawRead(blocks);
+    this->benchVerifiedWrite(blocks);
+    this->benchErase(blocks);
+    this->benchRawWrite(blocks, "write erased");
+    this->benchOutgoingRead(blocks, false);
+    this->benchOutgoingRead(blocks, true);
+
+    ordered = this->benchWrap();
+
+    this->dm->outgoingBufferFlush();
+
+    return ordered;
+  }
+
+  // outgoingBufferPush, one byte at a time as ingest does, timed per block
+  private: void benchPush(uint32_t blocks) {
+    this->dm->outgoingBufferFlush();
+    this->latency.clear();
+
+    for(uint32_t b=0; b<blocks; b++) {
+      this->fill(b);
+
+      unsigned long start = micros();
+
+      for(size_t n=0; n<BUFFER_BLOCK_PAYLOAD_BYTES; n++) {
+        this->dm->outgoingBufferPush((char) this->data[n]);
+      }
+
+      this->latency.record(micros() - start);
+
+      // Keep the RAM tier draining as the SD writer stage would
+      this->dm->spillRamTier();
+    }
+
+    this->row("push", BUFFER_BLOCK_PAYLOAD_BYTES);
+  }
+
+  private: void benchRawWrite(uint32_t blocks, const char * name = "device write") {
+    this->latency.clear();
+
+    for(uint32_t b=0; b<blocks; b++) {
+      this->fill(b);
+
+      unsigned long start = micros();
+
+      this->dm->storage()->writeBlock(this->ringBlock(b), this->data);
+
+      this->latency.record(micros() - start);
+    }
+
+    this->row(name);
+  }
+
+  private: void benchRawRead(uint32_t blocks) {
+    this->latency.clear();
+
+    for(uint32_t b=0; b<blocks; b++) {
+      unsigned long start = micros();
+
+      this->dm->storage()->readBlock(this->ringBlock(b), this->readback);
+
+      this->latency.record(micros() - start);
+    }
+
+    this->row("device read");
+  }
+
+  // Write, read back and compare, as every block committed to SD is
+  private: void benchVerifiedWrite(uint32_t blocks) {
+    this->latency.clear();
+
+    for(uint32_t b=0; b<blocks; b++) {
+      this->fill(b);
+
+      unsigned long start = micros();
+
+      this->dm->storage()->writeBlock(this->ringBlock(b), this->data);
+      this->dm->storage()->readBlock(this->ringBlock(b), this->readback);
+
+      if(memcmp(this->data, this->readback, BUFFER_BLOCK_SIZE_BYTES) != 0) {
+        Serial.printf("verify mismatch at block %u\n", this->ringBlock(b));
+      }
+
+      this->latency.record(micros() - start);
+    }
+
+    this->row("write+verify");
+  }
+
+  /**
+   * Erase the pass in ERASE_STEP_BLOCKS commands as the background eraser
+   * does; the "write erased" row that follows is the write path once the
+   * ring comes round onto erased blocks, "device write" the one without.
+   */
+  private: void benchErase(uint32_t blocks) {
+    uint32_t batch;
+
+    this->latency.clear();
+
+    for(uint32_t b=0; b<blocks; b+=batch) {
+      batch = blocks - b < ERASE_STEP_BLOCKS ? blocks - b : ERASE_STEP_BLOCKS;
+
+      unsigned long start = micros();
+
+      this->dm->storage()->erase(this->ringBlock(b), this->ringBlock(b + batch - 1));
+
+      this->latency.record(micros() - start);
+    }
+
+    this->row("erase step", (size_t) ERASE_STEP_BLOCKS * BUFFER_BLOCK_SIZE_BYTES);
+  }
+
+  // returnOutgoingBlock over a backlog already on the device, as the transmitter walks it
+  private: void benchOutgoingRead(uint32_t blocks, bool prefetch) {
+    uint32_t hits = this->dm->prefetchHits;
+    uint32_t misses = this->dm->prefetchMisses;
+
+    this->dm->outgoingBufferFlush();
+    this->dm->outgoingBlockPointer = this->ringBlock(blocks - 1);
+    this->latency.clear();
+
+    for(uint32_t b=0; b<blocks; b++) {
+      unsigned long start = micros();
+
+      if(prefetch) {
+        this->dm->prefetchOutgoingBlocks();
+      }
+
+      this->dm->returnOutgoingBlock(this->dm->peekOutgoingReadPointer());
+      this->dm->advanceOutgoingReadPointer();
+
+      this->latency.record(micros() - start);
+    }
+
+    hits = this->dm->prefetchHits - hits;
+    misses = this->dm->prefetchMisses - misses;
+
+    this->row(prefetch ? "read prefetch" : "read");
+
+    if(prefetch && hits + misses > 0) {
+      Serial.printf("%-16s %5.1f%% of %u blocks\n", "  prefetch hits", 100.0 * hits / (hits + misses), hits + misses);
+    }
+  }
+
+  // Push tagged blocks across the end of the ring and read them back in order
+  private: bool benchWrap() {
+    uint32_t start = this->dm->outgoingBlockStart + BUFFER_MAX_SIZE_BLOCKS - STORAGE_BENCH_WRAP_BLOCKS / 2;
+    uint32_t wrapped = 0, misordered = 0;
+    blockHeader header;
+
+    this->dm->outgoingBufferFlush();
+    this->dm->outgoingBlockPointer = start;
+    this->dm->outgoingReadPointer = start;
+    this->latency.clear();
+
+    for(uint32_t b=0; b<STORAGE_BENCH_WRAP_BLOCKS; b++) {
+      this->fill(b);
+
+      for(size_t n=0; n<BUFFER_BLOCK_PAYLOAD_BYTES; n++) {
+        this->dm->outgoingBufferPush((char) this->data[n]);
+      }
+
+      if(this->dm->outgoingBlockPointer < start) {
+        wrapped++;
+      }
+    }
+
+    for(uint32_t b=0; b<STORAGE_BENCH_WRAP_BLOCKS; b++) {
+      this->fill(b);
+
+      unsigned long begin = micros();
+
+      uint8_t * block = this->dm->returnOutgoingBlock(this->dm->peekOutgoingReadPointer());
+
+      this->dm->advanceOutgoingReadPointer();
+
+      this->latency.record(micros() - begin);
+
+      if(!blockHeader::read(block, BUFFER_BLOCK_SIZE_BYTES, header)
+        || memcmp(block + BLOCK_HEADER_BYTES, this->data, BUFFER_BLOCK_PAYLOAD_BYTES) != 0) {
+        misordered++;
+      }
+    }
+
+    this->row("read wrap");
+
+    Serial.printf("%-16s %u blocks past the ring end, %u out of order\n", "  wrap", wrapped, misordered);
+
+    return wrapped > 0 && misordered == 0;
+  }
+
+  private: void row(const char * name, size_t block_bytes = BUFFER_BLOCK_SIZE_BYTES) {
+    double bytes = (double) this->latency.count * block_bytes;
+    double us = this->latency.sum > 0 ? (double) this->latency.sum : 1.0;
+
+    Serial.printf("%-16s %6u %8.2f %8.1f %8u %8u %8u\n", name, this->latency.count,
+      bytes / us, us * 1000.0 / bytes, this->latency.percentile(50), this->latency.percentile(99), this->latency.max);
+  }
+
+  // Ring block b positions after the start of the outgoing area
+  private: uint32_t ringBlock(uint32_t b) {
+    return this->dm->outgoingBlockStart + 1 + b;
+  }
+
+  // Block content tagged with its index so misplaced blocks are detected
+  private: void fill(uint32_t tag) {
+    for(size_t n=0; n<BUFFER_BLOCK_SIZE_BYTES; n++) {
+      this->data[n] = (uint8_t) (tag * 31 + n);
+    }
+
+    memcpy(this->data, &tag, sizeof(tag));
+  }
+
+};
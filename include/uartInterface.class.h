@@ -1,52 +1,354 @@
-using namespace std;
-
-#pragma once
-
-#define UART_PORT_BAUD        (460800)
-#define UART_PORT_DEPTH       (4096)
-
-class uartInterface {
-  public: bool data_available = false;
-  public: unsigned long last_data_available = 0;
-
-  public: void initialize() {
-    size_t uart_depth = UART_PORT_DEPTH;
-
-    platformInterface.begin(UART_PORT_BAUD);
-    platformInterface.setRxBufferSize(uart_depth);
-
-    delay(100);
-  }
-
-  public: void sendData(const char* s) {
-    platformInterface.write(s);
-  }
-
-  public: void flush() {
-    while(platformInterface.available() > 0) {
-      platformInterface.read();
-    }
-  }
-
-  public: void processOutgoingData(dataManager &dataManager) {
-    bool _data_available = false;
-
-    while(platformInterface.available()) {
-      DATA_OP_BEGIN();
-      dataManager.outgoingBufferPush(platformInterface.read());
-      DATA_OP_END();
-
-      _data_available = true;
-    }
-
-    if(_data_available) {
-      this->data_available = this->data_available ? true : _data_available;
-      this->last_data_available = millis();
-
-      #ifdef DEBUG
-      // dataManager.reportOutgoingBufferStats();
-      #endif
-    }
-  }
-  
-};
+using namespace std;
+
+#pragma once
+
+#include "hostProtocol.class.h"
+#include "packetCodec.class.h"
+#include "pulseCapture.class.h"
+
+#define UART_PORT_BAUD        (460800)
+#define UART_PORT_DEPTH       (4096)
+
+// Host flow control modes
+#define UART_FLOW_NONE        (0)
+#define UART_FLOW_XONXOFF     (1) // XOFF/XON bytes in the host stream (FRAME_FLOW frames when framed)
+#define UART_FLOW_RTS         (2) // RTS driven as a GPIO, asserted (LOW) while we accept data
+
+#ifndef UART_FLOW_CONTROL
+#define UART_FLOW_CONTROL     UART_FLOW_RTS
+#endif
+
+#define UART_RTS_PIN          (26)
+#define UART_XON              (0x11)
+#define UART_XOFF             (0x13)
+
+// Pause the host above the high watermark (RX bytes pending), resume below the low one
+#define UART_FLOW_HIGH_WATERMARK    ((UART_PORT_DEPTH * 3) / 4)
+#define UART_FLOW_LOW_WATERMARK     (UART_PORT_DEPTH / 4)
+
+// Pause early while SD writes are this slow, or when the ring is this close to full
+#define UART_FLOW_LATENCY_US        (20000)
+#define UART_FLOW_BACKLOG_RESERVE   (64)
+
+// Host protocol: raw byte pipe, or COBS framed data and commands (see hostProtocol.class.h)
+#define UART_PROTOCOL_RAW           (0)
+#define UART_PROTOCOL_FRAMED        (1)
+
+#ifndef UART_PROTOCOL
+#define UART_PROTOCOL               UART_PROTOCOL_RAW
+#endif
+
+// Delivery receipts are batched: sent every N verified packets or after the interval
+#define UART_RECEIPT_BATCH_PACKETS  (8)
+#define UART_RECEIPT_INTERVAL_MS    (250)
+
+class uartInterface {
+  public: bool data_available = false;
+  public: unsigned long last_data_available = 0;
+
+  // flow control state and counters
+  public: bool flow_paused = false;
+  public: uint32_t flow_pauses = 0;
+
+  // host bytes dropped because packets cannot carry them (POST_PACKET)
+  public: uint32_t unrepresentable = 0;
+
+  // framed protocol state
+  public: uint8_t priority = TX_PRIORITY_BATCH;
+  public: bool status_requested = false;
+
+  // pulse-trace capture requested by the host, run by the link stage when idle
+  public: volatile bool capture_requested = false;
+  public: uint8_t capture_mode = 0;
+  public: uint16_t capture_edges = 0;
+
+  // link profile switch requested by the host, applied by the link stage when idle
+  public: volatile bool profile_requested = false;
+  public: uint8_t profile_index = 0;
+
+  private: hostProtocol protocol;
+  private: uint8_t frame_rx[FRAME_MAX_DECODED];
+  private: size_t frame_rx_length = 0;
+  private: size_t frame_rx_offset = 0;
+  private: uint8_t frame_tx[FRAME_MAX_ENCODED];
+
+  // host TX is shared by the ingest (acks, flow) and host emitter stages
+  private: SemaphoreHandle_t tx_lock = NULL;
+
+  // duration of ingest passes that moved host data into the buffer
+  public: latencyHistogram ingestLatency;
+
+  public: void initialize() {
+    size_t uart_depth = UART_PORT_DEPTH;
+
+    platformInterface.begin(UART_PORT_BAUD);
+    platformInterface.setRxBufferSize(uart_depth);
+
+    this->tx_lock = xSemaphoreCreateMutex();
+
+    #if UART_FLOW_CONTROL == UART_FLOW_RTS
+    pinMode(UART_RTS_PIN, OUTPUT);
+    digitalWrite(UART_RTS_PIN, LOW);
+    #endif
+
+    // Wake the outbound controller as soon as host data arrives (core 2.x and later)
+    #if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 2
+    platformInterface.onReceive(notifyIngest);
+    #endif
+  }
+
+  public: void sendData(const char* s) {
+    this->sendData((const uint8_t*) s, strlen(s));
+  }
+
+  public: void sendData(const uint8_t* data, size_t length) {
+    #if UART_PROTOCOL == UART_PROTOCOL_FRAMED
+    size_t chunk;
+
+    for(size_t offset=0; offset<length; offset+=chunk) {
+      chunk = length - offset > FRAME_MAX_PAYLOAD ? FRAME_MAX_PAYLOAD : length - offset;
+
+      this->sendFrame(FRAME_RX_DATA, data + offset, chunk);
+    }
+    #else
+    xSemaphoreTake(this->tx_lock, portMAX_DELAY);
+    platformInterface.write(data, length);
+    xSemaphoreGive(this->tx_lock);
+    #endif
+  }
+
+  public: void sendFrame(uint8_t type, const void* payload, size_t length) {
+    uint8_t decoded[FRAME_MAX_DECODED];
+
+    decoded[0] = type;
+    memcpy(decoded + 1, payload, length);
+
+    xSemaphoreTake(this->tx_lock, portMAX_DELAY);
+    platformInterface.write(this->frame_tx, this->protocol.encode(decoded, length + 1, this->frame_tx));
+    xSemaphoreGive(this->tx_lock);
+  }
+
+  public: void flush() {
+    while(platformInterface.available() > 0) {
+      platformInterface.read();
+    }
+  }
+
+  public: void processOutgoingData(dataManager &dataManager) {
+    unsigned long start = micros();
+
+    #if UART_PROTOCOL == UART_PROTOCOL_FRAMED
+    bool _data_available = this->processFrames(dataManager);
+    #else
+    bool _data_available = this->processRawData(dataManager);
+    #endif
+
+    this->updateFlowControl(dataManager);
+
+    if(_data_available) {
+      this->data_available = this->data_available ? true : _data_available;
+      this->last_data_available = millis();
+
+      this->ingestLatency.record(micros() - start);
+
+      logComplete(EVENT_INGEST_PASS, start);
+
+      // Frames are built by the tx framer, which wakes the link
+      notifyStage(txFramerStage);
+
+      #ifdef DEBUG
+      // dataManager.reportOutgoingBufferStats();
+      #endif
+    }
+  }
+
+  private: bool processRawData(dataManager &dataManager) {
+    bool _data_available = false;
+    bool accepted;
+
+    while(platformInterface.available()) {
+      if(!this->representable((uint8_t) platformInterface.peek())) {
+        platformInterface.read();
+
+        continue;
+      }
+
+      DATA_OP_BEGIN();
+      accepted = dataManager.outgoingBufferPush(platformInterface.peek());
+      DATA_OP_END();
+
+      // Ring is full: leave the byte queued and let flow control hold the host
+      if(!accepted) {
+        break;
+      }
+
+      platformInterface.read();
+
+      _data_available = true;
+    }
+
+    return _data_available;
+  }
+
+  private: bool processFrames(dataManager &dataManager) {
+    bool _data_available = false;
+
+    // Finish a data frame the ring refused earlier before reading further
+    if(this->frame_rx_length > 0 && !this->pushFramePayload(dataManager, _data_available)) {
+      return _data_available;
+    }
+
+    while(platformInterface.available()) {
+      this->frame_rx_length = this->protocol.receive(platformInterface.read(), this->frame_rx);
+
+      if(this->frame_rx_length == 0) {
+        continue;
+      }
+
+      this->frame_rx_offset = 1;
+
+      if(!this->dispatchFrame(dataManager, _data_available)) {
+        break;
+      }
+    }
+
+    return _data_available;
+  }
+
+  private: bool dispatchFrame(dataManager &dataManager, bool &_data_available) {
+    uint8_t type = this->frame_rx[0];
+
+    switch(type) {
+      case FRAME_DATA:
+      return this->pushFramePayload(dataManager, _data_available);
+
+      case FRAME_STATUS_REQUEST:
+        this->status_requested = true;
+      break;
+
+      case FRAME_FLUSH:
+        DATA_OP_BEGIN();
+        dataManager.outgoingBufferFlush();
+        DATA_OP_END();
+
+        this->sendFrame(FRAME_ACK, &type, 1);
+      break;
+
+      case FRAME_PRIORITY:
+        if(this->frame_rx_length == 2 && this->frame_rx[1] <= TX_PRIORITY_IMMEDIATE) {
+          this->priority = this->frame_rx[1];
+          this->sendFrame(FRAME_ACK, &type, 1);
+        } else {
+          this->sendFrame(FRAME_NAK, &type, 1);
+        }
+      break;
+
+      case FRAME_CAPTURE:
+        if(this->frame_rx_length == 4 && this->frame_rx[1] <= PULSE_CAPTURE_SWEEP) {
+          this->capture_mode = this->frame_rx[1];
+          this->capture_edges = this->frame_rx[2] | (this->frame_rx[3] << 8);
+
+          if(this->capture_edges == 0 || this->capture_edges > PULSE_CAPTURE_MAX_EDGES) {
+            this->capture_edges = PULSE_CAPTURE_MAX_EDGES;
+          }
+
+          this->capture_requested = true;
+          this->sendFrame(FRAME_ACK, &type, 1);
+        } else {
+          this->sendFrame(FRAME_NAK, &type, 1);
+        }
+      break;
+
+      case FRAME_LINK_PROFILE:
+        if(this->frame_rx_length == 2) {
+          this->profile_index = this->frame_rx[1];
+          this->profile_requested = true;
+        } else {
+          this->sendFrame(FRAME_NAK, &type, 1);
+        }
+      break;
+
+      default:
+        this->sendFrame(FRAME_NAK, &type, 1);
+      break;
+    }
+
+    this->frame_rx_length = 0;
+
+    return true;
+  }
+
+  // A byte the packet format cannot carry is dropped and counted, as ocpd refuses such input
+  private: bool representable(uint8_t data) {
+    if(packetCodec::representable(&data, 1)) {
+      return true;
+    }
+
+    this->unrepresentable++;
+
+    return false;
+  }
+
+  private: bool pushFramePayload(dataManager &dataManager, bool &_data_available) {
+    bool accepted;
+
+    while(this->frame_rx_offset < this->frame_rx_length) {
+      if(!this->representable(this->frame_rx[this->frame_rx_offset])) {
+        this->frame_rx_offset++;
+
+        continue;
+      }
+
+      DATA_OP_BEGIN();
+      accepted = dataManager.outgoingBufferPush(this->frame_rx[this->frame_rx_offset]);
+      DATA_OP_END();
+
+      if(!accepted) {
+        return false;
+      }
+
+      this->frame_rx_offset++;
+
+      _data_available = true;
+    }
+
+    this->frame_rx_length = 0;
+
+    return true;
+  }
+
+  private: void updateFlowControl(dataManager &dataManager) {
+    int pending = platformInterface.available();
+    bool backlog_full = dataManager.outgoingBacklogBlocks() + UART_FLOW_BACKLOG_RESERVE >= BUFFER_MAX_SIZE_BLOCKS;
+    bool slow_storage = dataManager.writeLatencyUs > UART_FLOW_LATENCY_US;
+
+    if(!this->flow_paused) {
+      if(pending >= UART_FLOW_HIGH_WATERMARK || backlog_full || (slow_storage && pending >= UART_FLOW_LOW_WATERMARK)) {
+        this->setFlow(false);
+      }
+    } else if(pending <= UART_FLOW_LOW_WATERMARK && !backlog_full) {
+      this->setFlow(true);
+    }
+  }
+
+  private: void setFlow(bool accept) {
+    this->flow_paused = !accept;
+
+    if(!accept) {
+      this->flow_pauses++;
+    }
+
+    #if UART_FLOW_CONTROL == UART_FLOW_RTS
+    digitalWrite(UART_RTS_PIN, accept ? LOW : HIGH);
+    #elif UART_FLOW_CONTROL == UART_FLOW_XONXOFF && UART_PROTOCOL == UART_PROTOCOL_FRAMED
+    uint8_t paused = accept ? 0 : 1;
+
+    this->sendFrame(FRAME_FLOW, &paused, 1);
+    #elif UART_FLOW_CONTROL == UART_FLOW_XONXOFF
+    xSemaphoreTake(this->tx_lock, portMAX_DELAY);
+    platformInterface.write((uint8_t) (accept ? UART_XON : UART_XOFF));
+    xSemaphoreGive(this->tx_lock);
+    #endif
+  }
+  
+};
@@ -0,0 +1,138 @@
+using namespace std;
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "eventLog.class.h"
+
+#ifdef ARDUINO
+#include <esp_attr.h>
+#define WAIT_TRACE_ATTR             RTC_NOINIT_ATTR
+#else
+#define WAIT_TRACE_ATTR
+#endif
+
+// Wait sites with a deadline
+#define WAIT_NONE                   (0)
+#define WAIT_TX_VERIFY              (1) // packet streamed until verified
+#define WAIT_RX_ANSWER              (2) // beacon answered until the packet preamble
+#define WAIT_RX_NEXT                (3) // previous packet verified until the next one starts
+#define WAIT_RX_PACKET              (4) // first byte until POST_PACKET
+#define WAIT_RX_QUEUE               (5) // received packet until the host emitter takes it
+#define WAIT_SD_VERIFY              (6) // SD block written until it reads back intact
+#define WAIT_SITES                  (7)
+
+#define WAIT_TRACE_MAGIC            (0x57414954) // "WAIT"
+
+static const char * const waitSiteNames[WAIT_SITES] = {
+  "none", "tx_verify", "rx_answer", "rx_next", "rx_packet", "rx_queue", "sd_verify",
+};
+
+struct waitSite {
+  uint32_t waits;
+  uint32_t expired;         // deadline reached, recovery path taken
+  uint32_t worst_us;
+};
+
+// Wait in progress on one pipeline track
+struct waitState {
+  volatile uint8_t site;
+  volatile uint32_t since_us;
+  volatile bool stalled;
+};
+
+/**
+ * Kept through a reset in RTC memory, so a watchdog reset can still tell
+ * which wait the link was in.
+ */
+struct waitTrace {
+  uint32_t magic;
+  waitState tracks[EVENT_TRACKS];
+};
+
+WAIT_TRACE_ATTR waitTrace waitTraceRecord;
+
+/**
+ * Worst-case time and expiries of every bounded wait, and the wait each
+ * pipeline track is in right now. A wait still running well past its
+ * deadline means the loop around it is wedged; stalled() finds it for the
+ * watchdog.
+ */
+class waitMonitor {
+  public: waitSite sites[WAIT_SITES];
+
+  // Wait the link was in when the unit last reset, WAIT_NONE if none or the record was lost
+  public: uint8_t previous_site = WAIT_NONE;
+
+  public: uint32_t stalls = 0;
+
+  public: void begin() {
+    waitState &link = waitTraceRecord.tracks[EVENT_TRACK_LINK];
+
+    if(waitTraceRecord.magic == WAIT_TRACE_MAGIC && link.site < WAIT_SITES) {
+      this->previous_site = link.site;
+    }
+
+    memset(this->sites, 0, sizeof(this->sites));
+    memset(&waitTraceRecord, 0, sizeof(waitTraceRecord));
+
+    waitTraceRecord.magic = WAIT_TRACE_MAGIC;
+  }
+
+  public: void enter(uint8_t track, uint8_t site, uint32_t now) {
+    waitState &state = waitTraceRecord.tracks[track];
+
+    state.since_us = now;
+    state.stalled = false;
+    state.site = site;
+  }
+
+  // Close the track's wait; returns how long it took
+  public: uint32_t leave(uint8_t track, bool expired, uint32_t now) {
+    waitState &state = waitTraceRecord.tracks[track];
+    waitSite &site = this->sites[state.site];
+    uint32_t elapsed = now - state.since_us;
+
+    site.waits++;
+
+    if(expired) {
+      site.expired++;
+    }
+
+    if(elapsed > site.worst_us) {
+      site.worst_us = elapsed;
+    }
+
+    state.site = WAIT_NONE;
+
+    return elapsed;
+  }
+
+  /**
+   * A wait that has run for more than limit_us and was not reported yet.
+   * Reports each stalled wait once.
+   */
+  public: bool stalled(uint32_t limit_us, uint32_t now, uint8_t &track, uint8_t &site, uint32_t &elapsed_us) {
+    for(uint8_t t=0; t<EVENT_TRACKS; t++) {
+      waitState &state = waitTraceRecord.tracks[t];
+
+      if(state.site == WAIT_NONE || state.stalled || now - state.since_us <= limit_us) {
+        continue;
+      }
+
+      state.stalled = true;
+      this->stalls++;
+
+      track = t;
+      site = state.site;
+      elapsed_us = now - state.since_us;
+
+      return true;
+    }
+
+    return false;
+  }
+
+};
@@ -1,105 +1,436 @@
-// Toggle debug code: un-comment to enable
-// #define DEBUG 1
-
-#include <Arduino.h>
-#include <SdFat.h>
-#include "includes.h"
-#include "definitions.h"
-#include "peripherals.h"
-#include "dataManager.class.h"
-#include "uartInterface.class.h"
-#include "canInterface.class.h"
-#include "opticalInterface.class.h"
-#include "outboundController.class.h"
-#include "inboundController.class.h"
-
-TaskHandle_t outboundTaskHandler;
-TaskHandle_t inboundTaskHandler;
-
-outboundController outbound;
-inboundController inbound;
-
-uartInterface portUart;
-canInterface portCan;
-dataManager dataManagerObject;
-opticalInterface opticalInterfaceObject;
-
-SdFat uSD;
-
-// Software version, title
-#define SOFTWARE_TITLE          PROGMEM "ESP32-OCP"
-#define SOFTWARE_VERSION        PROGMEM "v1.0.1dev"
-
-// Task manager memory allocations
-#define OUTBOUND_STACK_DEPTH    (_1KB * 8)
-#define INBOUND_STACK_DEPTH     (_1KB * 8)
-
-void outboundTask(void * parameter) {
-  // Log the core number that task is initialized on
-  Serial.println(PROGMEM "outbound task initialized on core " + (String) xPortGetCoreID());
-  ring(1, 5);
-  delay(100);
-  
-  // Signalize beeKit that OCP is ready
-  // portUart.sendData((char*)"READY\n");
-  // delay(50);
-  portUart.flush();
-  delay(50);
-
-  while(true) {
-    outbound.run(portUart, dataManagerObject, opticalInterfaceObject);
-
-    vTaskDelay(10 / portTICK_PERIOD_MS);
-  }
-}
-
-void inboundTask(void * parameter) {
-  // Log the core number that task is initialized on
-  Serial.println(PROGMEM "inbound task initialized on core " + (String) xPortGetCoreID());
-  ring(1, 5);
-
-  while(true) {
-    inbound.run(portUart, dataManagerObject, opticalInterfaceObject);
-
-    vTaskDelay(10 / portTICK_PERIOD_MS);
-  }
-}
-
-void setup() {
-  // Run CPU at 240Mhz
-  setCpuFrequencyMhz(240);
-
-  // Initialize debug port
-  Serial.begin(115200);
-
-  // Initialize UART port to communicate with beeKit
-  portUart.initialize();
-
-  // Software version
-  Serial.print(SOFTWARE_TITLE + (String) " ");
-  Serial.println(SOFTWARE_VERSION);
-  Serial.println("CPU running at " + (String) getCpuFrequencyMhz() + "MHz");
-
-  // Initialize SPI
-  SPI.begin();
-  SPI.setClockDivider(SPI_CLOCK_DIV2);
-
-  // Initialize peripheral methods
-  initializePeripherals();
-
-  // Initialize uSD card buffer
-  dataManagerObject.initialize(uSD);
-
-  // Initialize optical interface
-  opticalInterfaceObject.initialize(dataManagerObject, portUart);
-
-  // Initialize core tasks
-  xTaskCreatePinnedToCore(outboundTask, "outbound_controller", OUTBOUND_STACK_DEPTH, NULL, configMAX_PRIORITIES - 1, &outboundTaskHandler, CORE0);
-  delay(100);
-  xTaskCreatePinnedToCore(inboundTask, "inbound_controller", INBOUND_STACK_DEPTH, NULL, configMAX_PRIORITIES - 1, &inboundTaskHandler, CORE1);
-}
-
-void loop() {
-  // Intentionally left empty:
-  // Tasks allocated to separate cores running infinite loops
-}
+// Toggle debug code: un-comment to enable
+// #define DEBUG 1
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <esp_task_wdt.h>
+#include "esp_idf_version.h"
+#include "includes.h"
+#include "definitions.h"
+#include "peripherals.h"
+#include "events.h"
+#include "blockDevice.class.h"
+#ifdef BLOCK_DEVICE_SDMMC
+#include "sdmmcBlockDevice.class.h"
+#else
+#include "sdSpiBlockDevice.class.h"
+#endif
+#include "dataManager.class.h"
+#include "uartInterface.class.h"
+#include "canInterface.class.h"
+#include "opticalInterface.class.h"
+#include "outboundController.class.h"
+#include "inboundController.class.h"
+#ifdef STORAGE_BENCH
+#include "storageBench.class.h"
+#endif
+
+outboundController outbound;
+inboundController inbound;
+
+uartInterface portUart;
+canInterface portCan;
+dataManager dataManagerObject;
+opticalInterface opticalInterfaceObject;
+
+// Storage backend: define BLOCK_DEVICE_SDMMC to use the SDMMC host instead of SdFat over SPI
+#ifdef BLOCK_DEVICE_SDMMC
+sdmmcBlockDevice uSDDevice;
+#else
+SdFat uSD;
+sdSpiBlockDevice uSDDevice(uSD);
+#endif
+
+// Software version, title
+#define SOFTWARE_TITLE          PROGMEM "ESP32-OCP"
+#define SOFTWARE_VERSION        PROGMEM "v1.0.1dev"
+
+// Pipeline stages: core affinity, priority and stack depth
+#ifndef INGEST_CORE
+#define INGEST_CORE             CORE0
+#endif
+#ifndef INGEST_PRIORITY
+#define INGEST_PRIORITY         (configMAX_PRIORITIES - 1)
+#endif
+#ifndef TX_FRAMER_CORE
+#define TX_FRAMER_CORE          CORE0
+#endif
+#ifndef TX_FRAMER_PRIORITY
+#define TX_FRAMER_PRIORITY      (configMAX_PRIORITIES - 2)
+#endif
+#ifndef HOST_EMITTER_CORE
+#define HOST_EMITTER_CORE       CORE0
+#endif
+#ifndef HOST_EMITTER_PRIORITY
+#define HOST_EMITTER_PRIORITY   (configMAX_PRIORITIES - 3)
+#endif
+#ifndef SD_WRITER_CORE
+#define SD_WRITER_CORE          CORE0
+#endif
+#ifndef SD_WRITER_PRIORITY
+#define SD_WRITER_PRIORITY      (configMAX_PRIORITIES - 4)
+#endif
+#ifndef LINK_CORE
+#define LINK_CORE               CORE1
+#endif
+#ifndef LINK_PRIORITY
+#define LINK_PRIORITY           (configMAX_PRIORITIES - 1)
+#endif
+
+#ifndef LOG_DRAIN_CORE
+#define LOG_DRAIN_CORE          CORE0
+#endif
+#ifndef LOG_DRAIN_PRIORITY
+#define LOG_DRAIN_PRIORITY      (tskIDLE_PRIORITY + 1)
+#endif
+
+#ifndef ERASER_CORE
+#define ERASER_CORE             CORE0
+#endif
+#ifndef ERASER_PRIORITY
+#define ERASER_PRIORITY         (tskIDLE_PRIORITY + 1)
+#endif
+
+#ifndef WATCHDOG_CORE
+#define WATCHDOG_CORE           CORE0
+#endif
+#ifndef WATCHDOG_PRIORITY
+#define WATCHDOG_PRIORITY       (tskIDLE_PRIORITY + 1)
+#endif
+
+#define INGEST_STACK_DEPTH        (_1KB * 8)
+#define TX_FRAMER_STACK_DEPTH     (_1KB * 4)
+#define HOST_EMITTER_STACK_DEPTH  (_1KB * 8)
+#define SD_WRITER_STACK_DEPTH     (_1KB * 4)
+#define LINK_STACK_DEPTH          (_1KB * 8)
+#define LOG_DRAIN_STACK_DEPTH     (_1KB * 4)
+#define WATCHDOG_STACK_DEPTH      (_1KB * 2)
+#define ERASER_STACK_DEPTH        (_1KB * 4)
+
+// The event log is shipped to the debug port this often when it runs dry
+#define LOG_DRAIN_MS            (20)
+
+// Per-stage latency histograms are printed this often in DEBUG builds
+#define LATENCY_REPORT_MS       (10000)
+
+// The link task must complete a pass this often or the task watchdog resets the unit
+#define WATCHDOG_TIMEOUT_S      (10)
+
+// A bounded wait still running this long is wedged (the longest deadline is SESSION_IDLE_TIMEOUT_MS)
+#define WATCHDOG_STALL_MS       (5000)
+#define WATCHDOG_CHECK_MS       (100)
+
+// At most one ERASE_BATCH_BLOCKS batch of sent ring blocks is erased this often
+#ifndef ERASE_INTERVAL_MS
+#define ERASE_INTERVAL_MS       (100)
+#endif
+
+// Milliseconds from reset until each part of the pipeline was up
+unsigned long bootIngestReadyMs = 0;
+unsigned long bootStorageReadyMs = 0;
+unsigned long bootLinkReadyMs = 0;
+
+void reportBoot() {
+  Serial.println(PROGMEM "boot: ingest ready at " + (String) bootIngestReadyMs + "ms, storage at "
+    + (String) bootStorageReadyMs + "ms, link at " + (String) bootLinkReadyMs + "ms");
+}
+
+// Where the link was stuck if the task watchdog reset the unit
+void reportReset() {
+  if(esp_reset_reason() != ESP_RST_TASK_WDT) {
+    return;
+  }
+
+  Serial.println(PROGMEM "reset by the watchdog; link was in wait: " + (String) waitSiteNames[waits.previous_site]);
+}
+
+void reportWaits() {
+  for(uint8_t site=WAIT_NONE+1; site<WAIT_SITES; site++) {
+    waitSite &record = waits.sites[site];
+
+    Serial.println(PROGMEM "wait " + (String) waitSiteNames[site] + ": n=" + (String) record.waits
+      + " expired=" + (String) record.expired + " worst=" + (String) record.worst_us + "us");
+  }
+
+  Serial.println(PROGMEM "wait stalls: " + (String) waits.stalls);
+}
+
+void reportLatency() {
+  reportBoot();
+
+  ingestStage.wake.report(PROGMEM "ingest wake");
+  sdWriterStage.wake.report(PROGMEM "sd writer wake");
+  txFramerStage.wake.report(PROGMEM "tx framer wake");
+  linkStage.wake.report(PROGMEM "link wake");
+  hostEmitterStage.wake.report(PROGMEM "host emitter wake");
+  portUart.ingestLatency.report(PROGMEM "uart ingest");
+  dataManagerObject.writeLatency.report(PROGMEM "sd write");
+  dataManagerObject.readLatency.report(PROGMEM "sd read");
+  dataManagerObject.prefetchLatency.report(PROGMEM "sd prefetch");
+  dataManagerObject.eraseLatency.report(PROGMEM "sd erase");
+  opticalInterfaceObject.buildLatency.report(PROGMEM "tx build");
+  opticalInterfaceObject.txLatency.report(PROGMEM "tx stream");
+  opticalInterfaceObject.rxLatency.report(PROGMEM "rx packet");
+  opticalInterfaceObject.handoffLatency.report(PROGMEM "rx hand-off");
+
+  Serial.println(PROGMEM "frame size: " + (String) opticalInterfaceObject.frameSize.size()
+    + " fer=" + (String) opticalInterfaceObject.frameSize.frameErrorRate()
+    + " ber=" + String(opticalInterfaceObject.frameSize.byteErrorRate(), 8));
+  Serial.println(PROGMEM "timers: ack rtt=" + (String) opticalInterfaceObject.ackTimer.srtt_us
+    + "us var=" + (String) opticalInterfaceObject.ackTimer.rttvar_us
+    + "us wait=" + (String) opticalInterfaceObject.ackTimer.timeout()
+    + "us, packet wait=" + (String) opticalInterfaceObject.packetTimer.timeout()
+    + "us, beacon wait=" + (String) opticalInterfaceObject.beaconTimer.timeout()
+    + "us, verify x" + (String) opticalInterfaceObject.verifyRepeats);
+  Serial.println(PROGMEM "session " + String(opticalInterfaceObject.session.id, HEX)
+    + ": resumes=" + (String) opticalInterfaceObject.session.resumes
+    + " duplicates=" + (String) opticalInterfaceObject.session.duplicates);
+  Serial.println(PROGMEM "invalid backlog blocks: " + (String) opticalInterfaceObject.invalidBlocks);
+  Serial.println(PROGMEM "invalid line characters: " + (String) opticalInterfaceObject.lineCoder.invalid);
+  Serial.println(PROGMEM "dropped host bytes: " + (String) portUart.unrepresentable);
+
+  reportWaits();
+}
+
+/**
+ * The task watchdog watches the link task and the stages that take DATA_OP
+ * or the card: ingest, tx framer, SD writer and eraser. A task stuck on a
+ * lock or the card for WATCHDOG_TIMEOUT_S panics and resets the unit, and
+ * reportReset() names the wait it was in. The host emitter, log drain and
+ * stall logger are left out; starving them under load is harmless.
+ */
+void beginWatchdog() {
+  disableCore0WDT();
+
+  #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+  esp_task_wdt_config_t config = { WATCHDOG_TIMEOUT_S * 1000, 0, true };
+
+  if(esp_task_wdt_reconfigure(&config) != ESP_OK) {
+    esp_task_wdt_init(&config);
+  }
+  #else
+  esp_task_wdt_init(WATCHDOG_TIMEOUT_S, true);
+  #endif
+}
+
+/**
+ * Log waits that ran far past their deadline, naming the wait and the
+ * task, before the task watchdog steps in.
+ */
+void watchdogTask(void * parameter) {
+  uint8_t track, site;
+  uint32_t elapsed;
+
+  while(true) {
+    while(waits.stalled(WATCHDOG_STALL_MS * 1000, micros(), track, site, elapsed)) {
+      logEvent(EVENT_WAIT_STALL, site | (track << 8), elapsed / 1000);
+    }
+
+    delay(WATCHDOG_CHECK_MS);
+  }
+}
+
+/**
+ * Erase ring ranges the remote end has verified, so the card finds them
+ * erased when the ring comes round and the SD writer's latency does not
+ * carry the erase. Runs just above idle, one batch per ERASE_INTERVAL_MS,
+ * and dataManager skips the batch while the card is busy and gives the
+ * card back to the SD writer between erase commands.
+ */
+void eraserTask(void * parameter) {
+  esp_task_wdt_add(NULL);
+
+  while(true) {
+    esp_task_wdt_reset();
+
+    dataManagerObject.eraseConsumed();
+
+    delay(ERASE_INTERVAL_MS);
+  }
+}
+
+/**
+ * Ship event log records to the debug port as FRAME_LOG frames, decoded on
+ * the host by tools/logDecode.cpp. Runs just above idle so logging never
+ * takes time from the pipeline stages.
+ */
+void logDrainTask(void * parameter) {
+  hostProtocol framer;
+  eventRecord records[EVENT_LOG_FRAME_RECORDS];
+  uint8_t frame[FRAME_MAX_DECODED];
+  uint8_t encoded[FRAME_MAX_ENCODED + 1];
+  size_t count;
+
+  while(true) {
+    count = systemLog.drain(records, EVENT_LOG_FRAME_RECORDS);
+
+    if(count == 0) {
+      delay(LOG_DRAIN_MS);
+
+      continue;
+    }
+
+    frame[0] = FRAME_LOG;
+    memcpy(frame + 1, records, count * sizeof(eventRecord));
+
+    // A leading terminator keeps text printed before the frame out of it
+    encoded[0] = 0x00;
+
+    Serial.write(encoded, 1 + framer.encode(frame, 1 + count * sizeof(eventRecord), encoded + 1));
+  }
+}
+
+void ingestTask(void * parameter) {
+  // Log the core number that task is initialized on
+  Serial.println(PROGMEM "ingest task initialized on core " + (String) xPortGetCoreID());
+
+  // Host data sent during boot is kept: it is buffered until the card mounts
+  bootIngestReadyMs = millis();
+
+  esp_task_wdt_add(NULL);
+
+  while(true) {
+    esp_task_wdt_reset();
+
+    outbound.runIngest(portUart, dataManagerObject);
+
+    awaitStage(ingestStage);
+  }
+}
+
+void sdWriterTask(void * parameter) {
+  Serial.println(PROGMEM "sd writer task initialized on core " + (String) xPortGetCoreID());
+
+  esp_task_wdt_add(NULL);
+
+  while(true) {
+    esp_task_wdt_reset();
+
+    dataManagerObject.processWriteQueue(CONTROLLER_POLL_MS);
+
+    // Receiver session record, off the link task
+    opticalInterfaceObject.session.persistPending();
+  }
+}
+
+void txFramerTask(void * parameter) {
+  Serial.println(PROGMEM "tx framer task initialized on core " + (String) xPortGetCoreID());
+
+  esp_task_wdt_add(NULL);
+
+  while(true) {
+    esp_task_wdt_reset();
+
+    outbound.runTxFramer(portUart, dataManagerObject, opticalInterfaceObject);
+
+    awaitStage(txFramerStage);
+  }
+}
+
+void hostEmitterTask(void * parameter) {
+  Serial.println(PROGMEM "host emitter task initialized on core " + (String) xPortGetCoreID());
+
+  #ifdef DEBUG
+  unsigned long last_report = millis();
+  #endif
+
+  while(true) {
+    outbound.runHostEmitter(portUart, dataManagerObject, opticalInterfaceObject);
+
+    #ifdef DEBUG
+    if(millis() - last_report >= LATENCY_REPORT_MS) {
+      reportLatency();
+      last_report = millis();
+    }
+    #endif
+
+    awaitStage(hostEmitterStage);
+  }
+}
+
+void linkTask(void * parameter) {
+  // Log the core number that task is initialized on
+  Serial.println(PROGMEM "link task initialized on core " + (String) xPortGetCoreID());
+  ring(1, 5);
+
+  esp_task_wdt_add(NULL);
+
+  while(true) {
+    esp_task_wdt_reset();
+
+    logBegin(EVENT_LINK_PASS);
+    inbound.run(portUart, dataManagerObject, opticalInterfaceObject);
+    logEnd(EVENT_LINK_PASS);
+
+    awaitStage(linkStage);
+  }
+}
+
+void setup() {
+  // Run CPU at 240Mhz
+  setCpuFrequencyMhz(240);
+
+  // Initialize debug port
+  Serial.begin(115200);
+
+  // Before any task can enter a bounded wait
+  waits.begin();
+
+  xTaskCreatePinnedToCore(logDrainTask, "log_drain", LOG_DRAIN_STACK_DEPTH, NULL, LOG_DRAIN_PRIORITY, NULL, LOG_DRAIN_CORE);
+
+  // Initialize UART port to communicate with beeKit
+  portUart.initialize();
+
+  // Software version
+  Serial.print(SOFTWARE_TITLE + (String) " ");
+  Serial.println(SOFTWARE_VERSION);
+  Serial.println("CPU running at " + (String) getCpuFrequencyMhz() + "MHz");
+  reportReset();
+
+  // Initialize SPI
+  SPI.begin();
+  SPI.setClockDivider(SPI_CLOCK_DIV2);
+
+  // Initialize peripheral methods
+  initializePeripherals();
+
+  // Benchmark build: measure the storage path on this card and stay idle
+  #ifdef STORAGE_BENCH
+  dataManagerObject.initialize(uSDDevice);
+  storageBench(dataManagerObject).run();
+
+  return;
+  #endif
+
+  // Accept host data right away; blocks stay in RAM until the card is mounted
+  dataManagerObject.attach(uSDDevice);
+  dataManagerObject.beginWriteQueue();
+
+  // Before the first watched task starts
+  beginWatchdog();
+
+  xTaskCreatePinnedToCore(sdWriterTask, "sd_writer", SD_WRITER_STACK_DEPTH, NULL, SD_WRITER_PRIORITY, &sdWriterStage.task, SD_WRITER_CORE);
+  xTaskCreatePinnedToCore(ingestTask, "ingest", INGEST_STACK_DEPTH, NULL, INGEST_PRIORITY, &ingestStage.task, INGEST_CORE);
+
+  // Initialize uSD card buffer
+  dataManagerObject.awaitMount();
+  bootStorageReadyMs = millis();
+
+  // Initialize optical interface (reads the session record from the card)
+  opticalInterfaceObject.initialize(dataManagerObject, portUart);
+
+  // Initialize the remaining pipeline stage tasks
+  xTaskCreatePinnedToCore(txFramerTask, "tx_framer", TX_FRAMER_STACK_DEPTH, NULL, TX_FRAMER_PRIORITY, &txFramerStage.task, TX_FRAMER_CORE);
+  xTaskCreatePinnedToCore(hostEmitterTask, "host_emitter", HOST_EMITTER_STACK_DEPTH, NULL, HOST_EMITTER_PRIORITY, &hostEmitterStage.task, HOST_EMITTER_CORE);
+  xTaskCreatePinnedToCore(eraserTask, "eraser", ERASER_STACK_DEPTH, NULL, ERASER_PRIORITY, NULL, ERASER_CORE);
+  xTaskCreatePinnedToCore(watchdogTask, "watchdog", WATCHDOG_STACK_DEPTH, NULL, WATCHDOG_PRIORITY, NULL, WATCHDOG_CORE);
+  xTaskCreatePinnedToCore(linkTask, "link", LINK_STACK_DEPTH, NULL, LINK_PRIORITY, &linkStage.task, LINK_CORE);
+  bootLinkReadyMs = millis();
+
+  reportBoot();
+}
+
+void loop() {
+  // Intentionally left empty:
+  // Tasks allocated to separate cores running infinite loops
+}
@@ -0,0 +1,195 @@
+/**
+ * Minimal single-threaded Arduino/FreeRTOS layer for running the firmware's
+ * portable classes (dataManager and the block devices) in host tools.
+ * Serial goes to stdout; GPIO, SPI and the buzzer are no-ops, and timers
+ * never fire, so LED and buzzer patterns are not played.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#define PROGMEM
+#define HIGH                        (1)
+#define LOW                         (0)
+#define INPUT                       (0)
+#define OUTPUT                      (1)
+#define SERIAL_8N1                  (0x800001c)
+
+class String {
+  public: std::string s;
+
+  public: String() {}
+  public: String(const char * c) : s(c != NULL ? c : "") {}
+  public: String(const std::string &c) : s(c) {}
+  public: String(char c) : s(1, c) {}
+  public: String(int v) : s(std::to_string(v)) {}
+  public: String(unsigned int v) : s(std::to_string(v)) {}
+  public: String(long v) : s(std::to_string(v)) {}
+  public: String(unsigned long v) : s(std::to_string(v)) {}
+  public: String(long long v) : s(std::to_string(v)) {}
+  public: String(unsigned long long v) : s(std::to_string(v)) {}
+  public: String(double v, unsigned char = 2) : s(std::to_string(v)) {}
+
+  public: unsigned int length() const { return this->s.size(); }
+  public: const char * c_str() const { return this->s.c_str(); }
+  public: long toInt() const { return atol(this->s.c_str()); }
+
+  public: int indexOf(const String &x, unsigned int from = 0) const {
+    size_t found = this->s.find(x.s, from);
+
+    return found == std::string::npos ? -1 : (int) found;
+  }
+
+  public: String substring(unsigned int from, unsigned int to) const { return String(this->s.substr(from, to - from)); }
+  public: bool operator==(const String &o) const { return this->s == o.s; }
+  public: bool operator!=(const String &o) const { return this->s != o.s; }
+};
+
+inline String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+inline String operator+(const char * a, const String &b) { return String(std::string(a) + b.s); }
+inline String operator+(const String &a, const char * b) { return String(a.s + b); }
+
+class HardwareSerial {
+  public: HardwareSerial(int) {}
+
+  public: void begin(unsigned long, uint32_t = SERIAL_8N1, int8_t = -1, int8_t = -1, bool = false) {}
+  public: int available() { return 0; }
+  public: int read() { return -1; }
+  public: void flush() { fflush(stdout); }
+
+  public: size_t print(const String &v) { return fputs(v.c_str(), stdout); }
+  public: size_t print(const char * v) { return fputs(v, stdout); }
+  public: size_t print(char v) { return fputc(v, stdout); }
+  public: size_t print(int v) { return printf("%d", v); }
+  public: size_t print(unsigned long v) { return printf("%lu", v); }
+  public: size_t println() { return fputs("\n", stdout); }
+  public: template<class T> size_t println(T v) { return this->print(v) + this->println(); }
+
+  public: size_t printf(const char * format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    int written = vprintf(format, args);
+    va_end(args);
+
+    return written;
+  }
+};
+
+extern HardwareSerial Serial;
+
+inline unsigned long micros() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (unsigned long) ((uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+inline unsigned long millis() {
+  return micros() / 1000;
+}
+
+inline void delay(uint32_t ms) { usleep(ms * 1000); }
+inline void delayMicroseconds(uint32_t us) { usleep(us); }
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+
+// FreeRTOS: a single thread, so notifications are dropped, queues never block and mutexes are always free
+typedef void * TaskHandle_t;
+typedef void * SemaphoreHandle_t;
+typedef std::deque<std::vector<uint8_t> > * QueueHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE                      (1)
+#define pdFALSE                     (0)
+#define portMAX_DELAY               (0xffffffff)
+#define pdMS_TO_TICKS(ms)           (ms)
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return NULL; }
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
+
+// The front entry of a queue holds its depth and item size
+inline size_t hostQueueShape(QueueHandle_t queue, size_t field) {
+  size_t value;
+
+  memcpy(&value, queue->front().data() + field * sizeof(size_t), sizeof(size_t));
+
+  return value;
+}
+
+inline QueueHandle_t xQueueCreate(UBaseType_t depth, UBaseType_t item) {
+  QueueHandle_t queue = new std::deque<std::vector<uint8_t> >();
+  size_t shape[2] = { depth, item };
+
+  queue->push_back(std::vector<uint8_t>((const uint8_t *) shape, (const uint8_t *) (shape + 2)));
+
+  return queue;
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return (SemaphoreHandle_t) 1; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) { return pdTRUE; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) { return pdTRUE; }
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void * item, TickType_t) {
+  if(queue->size() - 1 >= hostQueueShape(queue, 0)) {
+    return pdFALSE;
+  }
+
+  queue->push_back(std::vector<uint8_t>((const uint8_t *) item, (const uint8_t *) item + hostQueueShape(queue, 1)));
+
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void * item, TickType_t) {
+  if(queue->size() <= 1) {
+    return pdFALSE;
+  }
+
+  memcpy(item, (*queue)[1].data(), (*queue)[1].size());
+  queue->erase(queue->begin() + 1);
+
+  return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  return queue->size() - 1;
+}
+
+// esp_timer: created and armed, but callbacks never run
+typedef int esp_err_t;
+typedef void * esp_timer_handle_t;
+
+#define ESP_OK                      (0)
+
+struct esp_timer_create_args_t {
+  void (* callback)(void *);
+  void * arg;
+  int dispatch_method;
+  const char * name;
+  bool skip_unhandled_events;
+};
+
+inline esp_err_t esp_timer_create(const esp_timer_create_args_t *, esp_timer_handle_t * handle) {
+  *handle = (esp_timer_handle_t) handle;
+
+  return ESP_OK;
+}
+
+inline esp_err_t esp_timer_start_once(esp_timer_handle_t, uint64_t) { return ESP_OK; }
+inline esp_err_t esp_timer_stop(esp_timer_handle_t) { return ESP_OK; }
+inline int64_t esp_timer_get_time() { return (int64_t) micros(); }
@@ -0,0 +1,169 @@
+/**
+ * Host benchmark of the DC-balanced line code (include/lineCode.class.h).
+ *
+ * Encodes and decodes a buffer in the chunk sizes the link uses, checks
+ * the round trip, and compares the line signal with plain 8N1: longest run
+ * of equal bits and the largest excursion of the running disparity (ones
+ * minus zeros, start and stop bits included), which is what drifts an
+ * AC-coupled receiver threshold.
+ *
+ * Build: g++ -std=gnu++11 -O2 -I include tools/lineCodeBench.cpp -o lineCodeBench
+ * Usage: lineCodeBench [--bytes N] [--rounds N] [--seed N]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "lineCode.class.h"
+
+// Pieces as the link writes and reads them
+#define BENCH_CHUNK_BYTES           (96)
+#define BENCH_CHUNK_CHARS           (128)
+
+struct lineStats {
+  uint32_t longest_run;
+  int32_t worst_disparity;
+};
+
+// Bits of 8N1 characters as they leave the UART: start 0, data LSB first, stop 1
+static lineStats measure(const uint8_t * line, size_t length) {
+  lineStats stats = { 0, 0 };
+  int32_t disparity = 0;
+  uint32_t run = 0;
+  int last = -1;
+
+  for(size_t n=0; n<length; n++) {
+    uint16_t frame = (uint16_t) ((1 << 9) | (line[n] << 1));
+
+    for(int b=0; b<10; b++) {
+      int bit = (frame >> b) & 1;
+
+      run = bit == last ? run + 1 : 1;
+      last = bit;
+      disparity += bit ? 1 : -1;
+
+      if(run > stats.longest_run) {
+        stats.longest_run = run;
+      }
+
+      if(abs(disparity) > stats.worst_disparity) {
+        stats.worst_disparity = abs(disparity);
+      }
+    }
+  }
+
+  return stats;
+}
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool bench(const char * name, const std::vector<uint8_t> &input, uint32_t rounds) {
+  std::vector<uint8_t> line(LINE_CODE_6B8B_CHARS(input.size()) + 1), output(input.size() + 1);
+  lineCode coder;
+  size_t chars = 0, bytes = 0;
+
+  auto start = std::chrono::steady_clock::now();
+
+  for(uint32_t r=0; r<rounds; r++) {
+    chars = 0;
+    coder.beginEncode();
+
+    for(size_t offset=0; offset<input.size(); offset+=BENCH_CHUNK_BYTES) {
+      size_t chunk = input.size() - offset < BENCH_CHUNK_BYTES ? input.size() - offset : BENCH_CHUNK_BYTES;
+
+      chars += coder.encode(input.data() + offset, chunk, line.data() + chars);
+    }
+
+    chars += coder.finishEncode(line.data() + chars);
+  }
+
+  double encode_s = seconds(start);
+
+  start = std::chrono::steady_clock::now();
+
+  for(uint32_t r=0; r<rounds; r++) {
+    bytes = 0;
+    coder.beginDecode();
+
+    for(size_t offset=0; offset<chars; offset+=BENCH_CHUNK_CHARS) {
+      size_t chunk = chars - offset < BENCH_CHUNK_CHARS ? chars - offset : BENCH_CHUNK_CHARS;
+
+      bytes += coder.decode(line.data() + offset, chunk, output.data() + bytes);
+    }
+  }
+
+  double decode_s = seconds(start);
+
+  bool intact = bytes == input.size() && memcmp(output.data(), input.data(), bytes) == 0 && coder.invalid == 0;
+
+  lineStats plain = measure(input.data(), input.size());
+  lineStats coded = measure(line.data(), chars);
+  double megabytes = (double) input.size() * rounds / 1e6;
+
+  printf("%-8s %8.1f %8.1f %8.2f %8.2f %6u %6u %8d %8d %s\n", name,
+    megabytes / encode_s, megabytes / decode_s,
+    encode_s * 1e9 / (input.size() * (double) rounds), decode_s * 1e9 / (input.size() * (double) rounds),
+    plain.longest_run, coded.longest_run, plain.worst_disparity, coded.worst_disparity,
+    intact ? "ok" : "MISMATCH");
+
+  return intact;
+}
+
+int main(int argc, char ** argv) {
+  size_t total = 1024 * 1024;
+  uint32_t rounds = 20;
+  uint32_t seed = 1;
+  bool intact = true;
+
+  for(int n=1; n+1<argc; n+=2) {
+    if(strcmp(argv[n], "--bytes") == 0) {
+      total = (size_t) atol(argv[n + 1]);
+    } else if(strcmp(argv[n], "--rounds") == 0) {
+      rounds = (uint32_t) atol(argv[n + 1]);
+    } else if(strcmp(argv[n], "--seed") == 0) {
+      seed = (uint32_t) atol(argv[n + 1]);
+    }
+  }
+
+  if(total == 0 || rounds == 0) {
+    fprintf(stderr, "bytes and rounds must be positive\n");
+
+    return 2;
+  }
+
+  std::mt19937 random(seed);
+  std::vector<uint8_t> data(total);
+
+  printf("6b8b line code: %zu bytes x %u rounds, %.0f%% of the plain rate on the line\n",
+    total, rounds, 100.0 * total / LINE_CODE_6B8B_CHARS(total));
+  printf("%-8s %8s %8s %8s %8s %6s %6s %8s %8s\n", "data", "enc MB/s", "dec MB/s", "enc ns/B", "dec ns/B",
+    "run", "coded", "disp", "coded");
+
+  for(size_t n=0; n<total; n++) {
+    data[n] = (uint8_t) random();
+  }
+
+  intact &= bench("random", data, rounds);
+
+  // Packet text: header fields and digits, as most of a packet is
+  for(size_t n=0; n<total; n++) {
+    data[n] = (uint8_t) "[flag]12[offset]0123456789abcdef"[n % 32];
+  }
+
+  intact &= bench("text", data, rounds);
+
+  // Worst case for plain 8N1: nine bit runs and one-sided disparity
+  memset(data.data(), 0x00, total);
+  intact &= bench("zeros", data, rounds);
+
+  memset(data.data(), 0xFF, total);
+  intact &= bench("ones", data, rounds);
+
+  return intact ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+/**
+ * Host decoder for the binary event log shipped on the debug port.
+ *
+ * Reads raw captures of the debug port and prints every FRAME_LOG record
+ * as a line of text with its time since the first record, passing the
+ * ordinary text output through unchanged. Gaps in the record sequence are
+ * reported. With --trace, the records of every capture are written as a
+ * Chrome trace / Perfetto timeline instead, one process per capture and one
+ * track per pipeline stage, so transmitter and receiver captures taken
+ * side by side line up.
+ *
+ * Build: g++ -std=gnu++11 -O2 -I tools/host -I include tools/logDecode.cpp -o logDecode
+ * Usage: logDecode [--trace out.json] [capture...]
+ *        stty -F /dev/ttyUSB0 115200 raw; cat /dev/ttyUSB0 > tx.bin
+ */
+#include <Arduino.h>
+#include "hostProtocol.class.h"
+#include "eventLog.class.h"
+#include "traceJson.h"
+
+static const eventFormat * formatOf(uint8_t event) {
+  for(const eventFormat &format : eventFormats) {
+    if(format.event == event) {
+      return &format;
+    }
+  }
+
+  return NULL;
+}
+
+static const char * const eventKinds[] = { "", "begin ", "end ", "" };
+
+class decoder {
+  private: hostProtocol protocol;
+  private: uint8_t decoded[FRAME_MAX_DECODED];
+  private: bool started = false;
+  private: uint32_t last_sequence = 0;
+  private: uint32_t last_time = 0;
+  private: uint64_t elapsed_us = 0;
+  private: traceJson * trace;
+  private: uint32_t pid;
+
+  public: uint32_t records = 0;
+  public: uint32_t missing = 0;
+
+  public: decoder(traceJson * trace, uint32_t pid) : trace(trace), pid(pid) {}
+
+  public: void chunk(const std::vector<uint8_t> &bytes) {
+    size_t length;
+
+    if(bytes.empty()) {
+      return;
+    }
+
+    length = this->protocol.decode(bytes.data(), bytes.size(), this->decoded);
+
+    if(length < 1 + sizeof(eventRecord) || this->decoded[0] != FRAME_LOG || (length - 1) % sizeof(eventRecord) != 0) {
+      if(this->trace == NULL) {
+        fwrite(bytes.data(), 1, bytes.size(), stdout);
+      }
+
+      return;
+    }
+
+    for(size_t offset=1; offset<length; offset+=sizeof(eventRecord)) {
+      eventRecord record;
+
+      memcpy(&record, this->decoded + offset, sizeof(record));
+
+      this->advance(record);
+
+      if(this->trace != NULL) {
+        this->traceRecord(record);
+      } else {
+        this->print(record);
+      }
+    }
+  }
+
+  private: void advance(const eventRecord &record) {
+    if(this->started) {
+      if(record.sequence != this->last_sequence + 1) {
+        if(this->trace == NULL) {
+          printf("# %u records missing\n", record.sequence - this->last_sequence - 1);
+        }
+
+        this->missing += record.sequence - this->last_sequence - 1;
+      }
+
+      // 32-bit microseconds wrap after 71 minutes
+      this->elapsed_us += (uint32_t) (record.time_us - this->last_time);
+    }
+
+    this->started = true;
+    this->last_sequence = record.sequence;
+    this->last_time = record.time_us;
+    this->records++;
+  }
+
+  private: void print(const eventRecord &record) {
+    const eventFormat * format = formatOf(record.event);
+    uint8_t kind = record.kind & 0x0F;
+
+    printf("%12.6f #%-8u %-12s %s", this->elapsed_us / 1e6, record.sequence, this->track(record), eventKinds[kind]);
+
+    if(format == NULL) {
+      printf("event_%02x a=%u b=%u\n", record.event, record.a, record.b);
+
+      return;
+    }
+
+    printf("%s", format->name);
+
+    // Span arguments travel on the end record
+    if(kind != EVENT_BEGIN && format->a != NULL) {
+      printf(" %s=%u", format->a, record.a);
+    }
+
+    if(kind != EVENT_BEGIN && format->b != NULL) {
+      printf(" %s=%u", format->b, record.b);
+    }
+
+    printf("\n");
+  }
+
+  private: void traceRecord(const eventRecord &record) {
+    const eventFormat * format = formatOf(record.event);
+    uint8_t kind = record.kind & 0x0F;
+    uint32_t tid = record.kind >> 4;
+    char unknown[16];
+    const char * name = unknown;
+
+    snprintf(unknown, sizeof(unknown), "event_%02x", record.event);
+
+    if(format != NULL) {
+      name = format->name;
+    }
+
+    const char * a_name = format != NULL ? format->a : "a";
+    const char * b_name = format != NULL ? format->b : "b";
+
+    switch(kind) {
+      case EVENT_BEGIN:
+        this->trace->event('B', this->pid, tid, name, (double) this->elapsed_us, 0);
+      break;
+
+      case EVENT_END:
+        this->trace->event('E', this->pid, tid, name, (double) this->elapsed_us, 0, a_name, record.a, b_name, record.b);
+      break;
+
+      case EVENT_COMPLETE:
+        this->trace->event('X', this->pid, tid, name, (double) this->elapsed_us - record.b, record.b, a_name, record.a);
+      break;
+
+      default:
+        this->trace->event('i', this->pid, tid, name, (double) this->elapsed_us, 0, a_name, record.a, b_name, record.b);
+      break;
+    }
+  }
+
+  private: const char * track(const eventRecord &record) {
+    uint8_t track = record.kind >> 4;
+
+    return track < sizeof(eventTracks) / sizeof(eventTracks[0]) ? eventTracks[track] : "?";
+  }
+};
+
+static bool decodeCapture(const char * path, traceJson * trace, uint32_t pid) {
+  FILE * input = path != NULL ? fopen(path, "rb") : stdin;
+  std::vector<uint8_t> bytes;
+  decoder log(trace, pid);
+  int c;
+
+  if(input == NULL) {
+    fprintf(stderr, "cannot open %s\n", path);
+
+    return false;
+  }
+
+  if(trace != NULL) {
+    trace->processName(pid, path != NULL ? path : "stdin");
+
+    for(uint32_t t=0; t<sizeof(eventTracks) / sizeof(eventTracks[0]); t++) {
+      trace->threadName(pid, t, eventTracks[t]);
+    }
+  }
+
+  // Frames are 0x00 delimited; anything that is not a log frame is text
+  while((c = fgetc(input)) != EOF) {
+    if(c == 0x00) {
+      log.chunk(bytes);
+      bytes.clear();
+    } else {
+      bytes.push_back((uint8_t) c);
+    }
+  }
+
+  log.chunk(bytes);
+
+  if(input != stdin) {
+    fclose(input);
+  }
+
+  fprintf(stderr, "%s: %u records, %u missing\n", path != NULL ? path : "stdin", log.records, log.missing);
+
+  return true;
+}
+
+int main(int argc, char ** argv) {
+  traceJson trace;
+  traceJson * output = NULL;
+  uint32_t captures = 0;
+  bool ok = true;
+
+  for(int n=1; n<argc; n++) {
+    if(strcmp(argv[n], "--trace") == 0 && n + 1 < argc) {
+      if(!trace.open(argv[++n])) {
+        fprintf(stderr, "cannot write %s\n", argv[n]);
+
+        return 1;
+      }
+
+      output = &trace;
+
+      continue;
+    }
+
+    ok = decodeCapture(argv[n], output, ++captures) && ok;
+  }
+
+  if(captures == 0) {
+    ok = decodeCapture(NULL, output, 1);
+  }
+
+  trace.close();
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,435 @@
+/**
+ * Linux endpoint daemon speaking the optical protocol over a serial device.
+ *
+ * Runs linkEndpoint (packet framing, MD5 checks, stop-and-wait ARQ, session
+ * offsets and adaptive frame size, the same code as the firmware's packet
+ * path) over a tty or a pseudo terminal, so a PC can stand in for one end
+ * of a link. The tty, the input and a retransmit timer are multiplexed with
+ * epoll on non-blocking descriptors. Received payloads are written to the
+ * output straight from the receive buffer, and a packet is only verified
+ * once its payload was written out.
+ *
+ * Data read from --in is sent and ends with a reset packet; data received is
+ * written to --out. Either may be a path, - for stdin/stdout or unix:PATH
+ * for a stream socket. Input holding '|' (POST_PACKET) cannot be carried
+ * and is refused; the device drops such bytes from the host stream.
+ *
+ * With --state, the receiver's session offset survives restarts, so a
+ * sender that repeats packets after a crash does not duplicate output (the
+ * output is then appended to, not truncated).
+ *
+ * Build: g++ -std=gnu++11 -O2 -I include tools/ocpd.cpp -o ocpd
+ * Usage: ocpd (--tty DEV [--baud N] | --pty) [--in SRC] [--out DST] [--state FILE] [--once]
+ *        --pty creates a pseudo terminal and prints its path on stderr
+ *        --once exits when the input was sent and verified (with --in) and
+ *        the peer's reset packet arrived (with --out)
+ * Loopback: ocpd --pty --in data.txt --once   (prints "ocpd: pty /dev/pts/N")
+ *           ocpd --tty /dev/pts/N --out copy.txt --once
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+// The state file holds nothing but the session record
+#define SESSION_RECORD_BLOCK        (0)
+
+#include "fileBlockDevice.class.h"
+#include "linkEndpoint.class.h"
+
+// Retransmit timer tick
+#define OCPD_TICK_MS                (10)
+
+// Time to keep answering repeats of the peer's reset packet before leaving
+#define OCPD_LINGER_MS              (1000)
+
+static volatile sig_atomic_t stopping = 0;
+
+static uint32_t nowMs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static uint32_t nowUs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint32_t) (ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static bool writeAll(int fd, const uint8_t * data, size_t length) {
+  while(length > 0) {
+    ssize_t written = write(fd, data, length);
+
+    if(written < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+
+      return false;
+    }
+
+    data += written;
+    length -= (size_t) written;
+  }
+
+  return true;
+}
+
+class fdSink : public linkEndpointSink {
+  public: int fd;
+
+  public: fdSink(int fd) : fd(fd) {}
+
+  public: bool deliver(const uint8_t * data, size_t length) {
+    return this->fd < 0 || writeAll(this->fd, data, length);
+  }
+};
+
+static speed_t baudConstant(long baud) {
+  switch(baud) {
+    case 9600:    return B9600;
+    case 19200:   return B19200;
+    case 38400:   return B38400;
+    case 57600:   return B57600;
+    case 115200:  return B115200;
+    case 230400:  return B230400;
+    case 460800:  return B460800;
+    case 921600:  return B921600;
+    case 1000000: return B1000000;
+    case 2000000: return B2000000;
+    default:      return B0;
+  }
+}
+
+static bool rawMode(int fd, speed_t speed) {
+  struct termios tio;
+
+  if(tcgetattr(fd, &tio) != 0) {
+    return false;
+  }
+
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+
+  if(speed != B0) {
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+  }
+
+  return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+static int openSocket(const char * path) {
+  struct sockaddr_un address;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+  if(fd >= 0 && connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    close(fd);
+
+    return -1;
+  }
+
+  return fd;
+}
+
+static int openStream(const char * target, bool output, bool append) {
+  if(strcmp(target, "-") == 0) {
+    return output ? STDOUT_FILENO : STDIN_FILENO;
+  }
+
+  if(strncmp(target, "unix:", 5) == 0) {
+    return openSocket(target + 5);
+  }
+
+  if(!output) {
+    return open(target, O_RDONLY);
+  }
+
+  return open(target, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+}
+
+static void watch(int epoll, int fd, uint32_t events, int op) {
+  struct epoll_event event;
+
+  event.events = events;
+  event.data.fd = fd;
+
+  epoll_ctl(epoll, op, fd, &event);
+}
+
+static void stop(int) {
+  stopping = 1;
+}
+
+static int usage() {
+  fprintf(stderr, "usage: ocpd (--tty DEV [--baud N] | --pty) [--in SRC] [--out DST] [--state FILE] [--once]\n");
+
+  return 2;
+}
+
+int main(int argc, char ** argv) {
+  const char * tty = NULL, * in = NULL, * out = NULL, * state = NULL;
+  long baud = 115200;
+  bool pty = false, once = false;
+
+  for(int n=1; n<argc; n++) {
+    bool value = n + 1 < argc;
+
+    if(strcmp(argv[n], "--tty") == 0 && value) {
+      tty = argv[++n];
+    } else if(strcmp(argv[n], "--baud") == 0 && value) {
+      baud = atol(argv[++n]);
+    } else if(strcmp(argv[n], "--in") == 0 && value) {
+      in = argv[++n];
+    } else if(strcmp(argv[n], "--out") == 0 && value) {
+      out = argv[++n];
+    } else if(strcmp(argv[n], "--state") == 0 && value) {
+      state = argv[++n];
+    } else if(strcmp(argv[n], "--pty") == 0) {
+      pty = true;
+    } else if(strcmp(argv[n], "--once") == 0) {
+      once = true;
+    } else {
+      return usage();
+    }
+  }
+
+  if((tty == NULL) == !pty || (tty != NULL && baudConstant(baud) == B0)) {
+    return usage();
+  }
+
+  // The line: a tty, or the master of a new pseudo terminal whose slave we hold open in raw mode
+  int line, slave = -1;
+
+  if(pty) {
+    line = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if(line < 0 || grantpt(line) != 0 || unlockpt(line) != 0 || (slave = open(ptsname(line), O_RDWR | O_NOCTTY)) < 0
+        || !rawMode(slave, B0)) {
+      perror("ocpd: pty");
+
+      return 1;
+    }
+
+    fprintf(stderr, "ocpd: pty %s\n", ptsname(line));
+  } else {
+    line = open(tty, O_RDWR | O_NOCTTY);
+
+    if(line < 0 || !rawMode(line, baudConstant(baud))) {
+      perror(tty);
+
+      return 1;
+    }
+  }
+
+  fcntl(line, F_SETFL, fcntl(line, F_GETFL) | O_NONBLOCK);
+
+  int input = -1, output = -1;
+  bool input_polled = false;
+
+  if(in != NULL) {
+    struct stat info;
+
+    if((input = openStream(in, false, false)) < 0 || fstat(input, &info) != 0) {
+      perror(in);
+
+      return 1;
+    }
+
+    // Regular files are always readable and cannot be polled
+    if(!S_ISREG(info.st_mode)) {
+      fcntl(input, F_SETFL, fcntl(input, F_GETFL) | O_NONBLOCK);
+      input_polled = true;
+    }
+  }
+
+  if(out != NULL && (output = openStream(out, true, state != NULL)) < 0) {
+    perror(out);
+
+    return 1;
+  }
+
+  fileBlockDevice stateDevice(state, 1);
+
+  if(state != NULL && !stateDevice.begin()) {
+    perror(state);
+
+    return 1;
+  }
+
+  uint32_t id;
+  int random = open("/dev/urandom", O_RDONLY);
+
+  if(random < 0 || read(random, &id, sizeof(id)) != (ssize_t) sizeof(id)) {
+    id = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16);
+  }
+
+  if(random >= 0) {
+    close(random);
+  }
+
+  fdSink sink(output);
+  static linkEndpoint endpoint;
+
+  endpoint.line_bps = pty ? 1000000 : (uint32_t) baud;
+  endpoint.begin(&sink, state != NULL ? &stateDevice : NULL, id);
+
+  int epoll = epoll_create1(0);
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  struct itimerspec tick = { { 0, OCPD_TICK_MS * 1000000 }, { 0, OCPD_TICK_MS * 1000000 } };
+
+  timerfd_settime(timer, 0, &tick, NULL);
+
+  watch(epoll, line, EPOLLIN, EPOLL_CTL_ADD);
+  watch(epoll, timer, EPOLLIN, EPOLL_CTL_ADD);
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  signal(SIGPIPE, SIG_IGN);
+
+  // Input not yet framed; at most one payload is held back
+  static uint8_t staged[FRAME_SIZE_MAX_BYTES];
+  size_t staged_length = 0;
+  bool input_eof = input < 0, final_sent = input < 0, input_watched = false, line_writable = false;
+  uint32_t linger_until = 0;
+  int status = 0;
+
+  while(!stopping) {
+    // Offer the next payload once the previous one was verified
+    if(endpoint.idle() && !final_sent) {
+      if(!input_polled && !input_eof && staged_length < sizeof(staged)) {
+        ssize_t got = read(input, staged + staged_length, sizeof(staged) - staged_length);
+
+        if(got <= 0) {
+          input_eof = true;
+        } else {
+          staged_length += (size_t) got;
+        }
+      }
+
+      size_t length = staged_length < endpoint.frameSize.size() ? staged_length : endpoint.frameSize.size();
+
+      if(length > 0 || input_eof) {
+        bool last = input_eof && length == staged_length;
+
+        if(!endpoint.send(staged, length, last, nowUs())) {
+          fprintf(stderr, "ocpd: input at byte %llu cannot be carried by the packet format\n",
+            (unsigned long long) endpoint.session.tx_offset);
+          status = 1;
+
+          break;
+        }
+
+        memmove(staged, staged + length, staged_length - length);
+        staged_length -= length;
+        final_sent = last;
+      }
+    }
+
+    // Interest follows state: the line while output is queued, the input while there is room to stage
+    const uint8_t * bytes;
+    bool want_write = endpoint.output(bytes) > 0;
+    bool want_input = input_polled && !input_eof && staged_length < sizeof(staged);
+
+    if(want_write != line_writable) {
+      watch(epoll, line, EPOLLIN | (want_write ? (uint32_t) EPOLLOUT : 0), EPOLL_CTL_MOD);
+      line_writable = want_write;
+    }
+
+    if(want_input != input_watched) {
+      watch(epoll, input, EPOLLIN, want_input ? EPOLL_CTL_ADD : EPOLL_CTL_DEL);
+      input_watched = want_input;
+    }
+
+    if(once && final_sent && endpoint.idle() && !want_write
+        && (output < 0 || (endpoint.reset_received && (int32_t) (nowMs() - linger_until) >= 0))) {
+      break;
+    }
+
+    struct epoll_event events[4];
+    int ready = epoll_wait(epoll, events, 4, -1);
+
+    for(int e=0; e<ready; e++) {
+      int fd = events[e].data.fd;
+
+      if(fd == timer) {
+        uint64_t expirations;
+
+        if(read(timer, &expirations, sizeof(expirations)) > 0) {
+          endpoint.poll(nowUs());
+        }
+      } else if(fd == line) {
+        if(events[e].events & EPOLLIN) {
+          uint8_t received[4096];
+          ssize_t got = read(line, received, sizeof(received));
+          bool was_reset = endpoint.reset_received;
+
+          if(got > 0) {
+            endpoint.receive(received, (size_t) got, nowUs());
+          }
+
+          if(endpoint.reset_received && !was_reset) {
+            linger_until = nowMs() + OCPD_LINGER_MS;
+          }
+        }
+
+        if(events[e].events & EPOLLOUT) {
+          size_t pending = endpoint.output(bytes);
+          ssize_t written = write(line, bytes, pending);
+
+          if(written > 0) {
+            endpoint.written((size_t) written, nowUs());
+          }
+        }
+      } else if(fd == input) {
+        ssize_t got = read(input, staged + staged_length, sizeof(staged) - staged_length);
+
+        if(got > 0) {
+          staged_length += (size_t) got;
+        } else if(got == 0 || (errno != EAGAIN && errno != EINTR)) {
+          input_eof = true;
+        }
+      }
+    }
+  }
+
+  fprintf(stderr, "ocpd: sent %llu bytes in %lu packets (%lu repeated, frame %u), received %llu bytes in %lu packets"
+    " (%lu duplicate, %lu invalid)\n",
+    (unsigned long long) endpoint.bytes_verified, (unsigned long) endpoint.packets_sent, (unsigned long) endpoint.retransmits,
+    endpoint.frameSize.size(), (unsigned long long) endpoint.bytes_delivered, (unsigned long) endpoint.packets_received,
+    (unsigned long) endpoint.session.duplicates, (unsigned long) endpoint.packets_invalid);
+
+  if(endpoint.ackTimer.samples > 0) {
+    fprintf(stderr, "ocpd: verification rtt %lu us (var %lu us), wait %lu us\n", (unsigned long) endpoint.ackTimer.srtt_us,
+      (unsigned long) endpoint.ackTimer.rttvar_us, (unsigned long) endpoint.ackTimer.timeout());
+  }
+
+  if(slave >= 0) {
+    close(slave);
+  }
+
+  close(line);
+
+  return status;
+}
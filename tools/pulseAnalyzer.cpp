@@ -0,0 +1,266 @@
+/**
+ * Host analyzer for pulse traces dumped by opticalInterface::processCapture.
+ *
+ * Fixed traces: width histograms, bit clock and jitter estimates, and the
+ * hit rate of the detection windows on consecutive high pulses.
+ * Sweep traces: replays the AGC search and prints the detection map.
+ *
+ * Build: g++ -std=gnu++11 -O2 -I include tools/pulseAnalyzer.cpp -o pulseAnalyzer
+ * Usage: pulseAnalyzer [--frequency Hz] [--bin ns] trace.txt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "pulseDetector.class.h"
+
+struct edge {
+  bool high;
+  uint32_t ns;
+};
+
+struct sweepStep {
+  int load;
+  int gain;
+  uint32_t high1;
+  uint32_t high2;
+};
+
+struct trace {
+  std::string mode;
+  long frequency = 0;
+  std::vector<edge> edges;
+  std::vector<sweepStep> steps;
+};
+
+static long headerValue(const char * line, const char * key) {
+  const char * found = strstr(line, key);
+
+  return found != NULL ? atol(found + strlen(key)) : 0;
+}
+
+static bool load(const char * path, trace &t) {
+  char line[256], mode[32];
+  FILE * file = fopen(path, "r");
+
+  if(file == NULL) {
+    perror(path);
+
+    return false;
+  }
+
+  while(fgets(line, sizeof(line), file) != NULL) {
+    edge e;
+    sweepStep s;
+    char level;
+
+    if(strncmp(line, "# pulse-trace", 13) == 0) {
+      if(sscanf(strstr(line, "mode=") != NULL ? strstr(line, "mode=") : "", "mode=%31s", mode) == 1) {
+        t.mode = mode;
+      }
+
+      t.frequency = headerValue(line, "frequency=");
+    } else if(sscanf(line, "S %d %d %u %u", &s.load, &s.gain, &s.high1, &s.high2) == 4) {
+      t.steps.push_back(s);
+    } else if(sscanf(line, "%c %u", &level, &e.ns) == 2 && (level == 'H' || level == 'L')) {
+      e.high = level == 'H';
+      t.edges.push_back(e);
+    }
+  }
+
+  fclose(file);
+
+  return true;
+}
+
+static void histogram(const trace &t, bool high, uint32_t bin) {
+  std::map<uint32_t, uint32_t> bins;
+  uint32_t peak = 0;
+
+  for(const edge &e : t.edges) {
+    if(e.high == high) {
+      uint32_t &n = bins[e.ns / bin];
+
+      if(++n > peak) {
+        peak = n;
+      }
+    }
+  }
+
+  printf("\n%s widths (%u ns bins)\n", high ? "high" : "low", bin);
+
+  for(auto &b : bins) {
+    int bar = (int) ((b.second * 50 + peak - 1) / peak);
+
+    printf("%7u ns %7u %.*s\n", b.first * bin, b.second, bar, "##################################################");
+  }
+}
+
+/**
+ * Widths are whole bit times, so the bit time is estimated from pulses up to
+ * 10 bits long after rounding each to its nominal bit count. Jitter is the
+ * spread of single-bit pulses around that estimate.
+ */
+static void bitClock(const trace &t) {
+  double nominal = 1e9 / (2.0 * t.frequency);
+  double total = 0, bits = 0;
+  double sum[2] = {0, 0}, squares[2] = {0, 0};
+  uint32_t count[2] = {0, 0};
+
+  for(const edge &e : t.edges) {
+    long n = lround(e.ns / nominal);
+
+    if(n >= 1 && n <= 10) {
+      total += e.ns;
+      bits += n;
+    }
+  }
+
+  if(bits == 0) {
+    printf("\nno pulses near the nominal bit time of %.0f ns\n", nominal);
+
+    return;
+  }
+
+  double bit = total / bits;
+
+  for(const edge &e : t.edges) {
+    if(e.ns > bit / 2 && e.ns < bit * 3 / 2) {
+      sum[e.high] += e.ns;
+      squares[e.high] += (double) e.ns * e.ns;
+      count[e.high]++;
+    }
+  }
+
+  printf("\nbit time %.1f ns (nominal %.1f ns), clock %.0f Hz (configured %ld Hz)\n", bit, nominal, 1e9 / (2 * bit), t.frequency);
+
+  for(int level=1; level>=0; level--) {
+    if(count[level] == 0) {
+      continue;
+    }
+
+    double mean = sum[level] / count[level];
+    double deviation = sqrt(squares[level] / count[level] - mean * mean);
+
+    printf("single-bit %s: n=%u mean=%.1f ns jitter=%.1f ns rms\n", level ? "high" : "low", count[level], mean, deviation);
+  }
+}
+
+static double microseconds(uint32_t fixed) {
+  return (double) fixed / (1 << PULSE_FRACTION_BITS);
+}
+
+// Consecutive high pulses, truncated to microseconds like pulseIn
+static void detection(const trace &t, pulseDetector &detector) {
+  std::vector<long> highs;
+  uint32_t pairs = 0, detectable = 0, valid = 0;
+
+  for(const edge &e : t.edges) {
+    if(e.high) {
+      highs.push_back(e.ns / 1000);
+    }
+  }
+
+  for(size_t n=0; n+1<highs.size(); n+=2) {
+    pairs++;
+    detectable += detector.detectable(highs[n], highs[n + 1]) ? 1 : 0;
+    valid += detector.valid(highs[n], highs[n + 1]) ? 1 : 0;
+  }
+
+  printf("\ndetectable window (%.4f, %.4f) us: %u/%u pairs\n", microseconds(detector.lower), microseconds(detector.upper), detectable, pairs);
+  printf("valid window      (%.4f, %.4f) us: %u/%u pairs\n", microseconds(detector.lower_valid), microseconds(detector.upper_valid), valid, pairs);
+}
+
+static void agc(const trace &t, pulseDetector &detector) {
+  agcSearch search;
+  int load = -1;
+  std::string row;
+
+  printf("\ndetection map, gain %d..0 left to right\n", AGC_GAIN_START);
+
+  for(const sweepStep &s : t.steps) {
+    if(s.load != load) {
+      if(load >= 0) {
+        printf("load %3d %s\n", load, row.c_str());
+      }
+
+      load = s.load;
+      row.clear();
+      search.beginLoad();
+    }
+
+    bool pulse = detector.detectable(s.high1 / 1000, s.high2 / 1000);
+
+    search.observe(s.load, s.gain, pulse);
+    row += pulse ? '#' : '.';
+  }
+
+  if(load >= 0) {
+    printf("load %3d %s\n", load, row.c_str());
+  }
+
+  if(search.resolved()) {
+    printf("\nAGC resolves load %d gain %d\n", search.load(), search.gain());
+  } else {
+    printf("\nAGC does not resolve\n");
+  }
+}
+
+int main(int argc, char ** argv) {
+  const char * path = NULL;
+  long frequency = 0;
+  uint32_t bin = 100;
+  trace t;
+
+  for(int n=1; n<argc; n++) {
+    if(strcmp(argv[n], "--frequency") == 0 && n + 1 < argc) {
+      frequency = atol(argv[++n]);
+    } else if(strcmp(argv[n], "--bin") == 0 && n + 1 < argc) {
+      bin = (uint32_t) atol(argv[++n]);
+    } else {
+      path = argv[n];
+    }
+  }
+
+  if(path == NULL || bin == 0) {
+    fprintf(stderr, "usage: %s [--frequency Hz] [--bin ns] trace.txt\n", argv[0]);
+
+    return 2;
+  }
+
+  if(!load(path, t)) {
+    return 1;
+  }
+
+  if(frequency > 0) {
+    t.frequency = frequency;
+  }
+
+  if(t.frequency <= 0) {
+    fprintf(stderr, "%s: no frequency in trace header, pass --frequency\n", path);
+
+    return 1;
+  }
+
+  pulseDetector detector = pulseDetector(pulseDetector::period(t.frequency));
+
+  printf("%s: mode=%s frequency=%ld edges=%zu steps=%zu\n", path, t.mode.c_str(), t.frequency, t.edges.size(), t.steps.size());
+
+  if(!t.edges.empty()) {
+    histogram(t, true, bin);
+    histogram(t, false, bin);
+    bitClock(t);
+    detection(t, detector);
+  }
+
+  if(!t.steps.empty()) {
+    agc(t, detector);
+  }
+
+  return 0;
+}
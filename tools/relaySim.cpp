@@ -0,0 +1,177 @@
+/**
+ * Host simulation of a multi-hop chain through linkRelay.
+ *
+ * An origin streams pseudo-random data over simulated optical channels
+ * through two relays to a destination: origin -> R1 -> R2 -> destination.
+ * The R1 -> R2 hop loses its beam for a while, so R1 has to store and
+ * forward, and the last hop is slower, so R2 queues. Each relay spills to
+ * its own RAM block image, which fails that share of writes with
+ * --store-errors. The run checks the destination output is the input, in
+ * order and exactly once, and prints how each relay forwarded.
+ *
+ * Build: g++ -std=gnu++11 -O2 -I include tools/relaySim.cpp -o relaySim
+ * Usage: relaySim [--bytes N] [--payload N] [--seed N] [--store BLOCKS] [--store-errors P]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include "fileBlockDevice.class.h"
+#include "linkRelay.class.h"
+#include "simChannel.h"
+
+static size_t frameOf(uint32_t sequence, const uint8_t * data, size_t length, uint8_t * frame) {
+  frame[0] = sequence & 0xFF;
+  frame[1] = (sequence >> 8) & 0xFF;
+  frame[2] = (sequence >> 16) & 0xFF;
+  frame[3] = (sequence >> 24) & 0xFF;
+  frame[4] = length & 0xFF;
+  frame[5] = (length >> 8) & 0xFF;
+
+  memcpy(frame + BOND_HEADER_BYTES, data, length);
+
+  return BOND_HEADER_BYTES + length;
+}
+
+// Block image that fails a share of its writes, as a worn or removed card would
+class faultyStore : public fileBlockDevice {
+  private: double write_errors;
+  private: std::mt19937 &random;
+
+  public: faultyStore(uint32_t blocks, double write_errors, std::mt19937 &random)
+    : fileBlockDevice(NULL, blocks), write_errors(write_errors), random(random) {}
+
+  public: bool writeBlocks(uint32_t block, const uint8_t * src, size_t count) {
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    if(chance(this->random) < this->write_errors) {
+      return false;
+    }
+
+    return fileBlockDevice::writeBlocks(block, src, count);
+  }
+};
+
+static void report(const char * name, linkRelay &relay) {
+  printf("%s: %u cut-through, %u queued in RAM, %u stored, %u forwarded, %u retries, %u duplicates dropped, %u declined, %u lost\n",
+    name, relay.cut_through, relay.queued, relay.spilled, relay.forwarded, relay.retries, relay.duplicates, relay.declined,
+    relay.lost);
+}
+
+int main(int argc, char ** argv) {
+  size_t total = 2 * 1024 * 1024;
+  size_t payload = 1024;
+  uint32_t seed = 1;
+  uint32_t store_blocks = 4096;
+  double store_errors = 0.0;
+
+  for(int n=1; n+1<argc; n+=2) {
+    if(strcmp(argv[n], "--bytes") == 0) {
+      total = (size_t) atol(argv[n + 1]);
+    } else if(strcmp(argv[n], "--payload") == 0) {
+      payload = (size_t) atol(argv[n + 1]);
+    } else if(strcmp(argv[n], "--seed") == 0) {
+      seed = (uint32_t) atol(argv[n + 1]);
+    } else if(strcmp(argv[n], "--store") == 0) {
+      store_blocks = (uint32_t) atol(argv[n + 1]);
+    } else if(strcmp(argv[n], "--store-errors") == 0) {
+      store_errors = atof(argv[n + 1]);
+    }
+  }
+
+  if(payload == 0 || payload > BOND_PAYLOAD_MAX) {
+    fprintf(stderr, "payload must be 1..%d bytes\n", BOND_PAYLOAD_MAX);
+
+    return 2;
+  }
+
+  std::mt19937 random(seed);
+  std::vector<uint8_t> input(total), output;
+  uint8_t frame[RELAY_FRAME_MAX], received[RELAY_FRAME_MAX];
+  size_t sent = 0, frame_length = 0, length;
+  uint32_t sequence = 0, last = 0, repeats = 0, gaps = 0;
+  bool sending = false, seen = false;
+
+  for(size_t n=0; n<total; n++) {
+    input[n] = (uint8_t) random();
+  }
+
+  // 200 kbaud hops; the middle one loses its beam between 3 s and 10 s, the last runs at 100 kbaud
+  simChannel first("origin-R1", 20000, 0.00001, 0.01, 15, UINT32_MAX, UINT32_MAX, random);
+  simChannel middle("R1-R2", 20000, 0.00001, 0.01, 15, 3000, 10000, random);
+  simChannel last_hop("R2-destination", 10000, 0.00001, 0.01, 15, UINT32_MAX, UINT32_MAX, random);
+
+  faultyStore store1(store_blocks, store_errors, random), store2(store_blocks, store_errors, random);
+  linkRelay relay1, relay2;
+
+  // --store 0 runs the relays on RAM alone
+  if((store_blocks > 0 && (!store1.begin() || !store2.begin()))
+      || !relay1.begin(&first, &middle, store_blocks > 0 ? &store1 : NULL, 0, store_blocks)
+      || !relay2.begin(&middle, &last_hop, store_blocks > 0 ? &store2 : NULL, 0, store_blocks)) {
+    return 1;
+  }
+
+  while(output.size() < total && now < 3600000) {
+    // Origin: stop-and-wait over the first hop
+    if(sending) {
+      uint8_t outcome = first.poll();
+
+      if(outcome != BOND_PENDING) {
+        sending = false;
+
+        if(outcome == BOND_VERIFIED) {
+          frame_length = 0;
+        }
+      }
+    }
+
+    if(!sending && frame_length == 0 && sent < total) {
+      size_t chunk = total - sent < payload ? total - sent : payload;
+
+      frame_length = frameOf(sequence++, input.data() + sent, chunk, frame);
+      sent += chunk;
+    }
+
+    if(!sending && frame_length > 0) {
+      sending = first.send(frame, frame_length);
+    }
+
+    relay1.service(now);
+    relay2.service(now);
+
+    // Destination: drop repeats of the frame before, as a relay does
+    while((length = last_hop.receive(received)) > 0) {
+      uint32_t number = received[0] | (received[1] << 8) | (received[2] << 16) | ((uint32_t) received[3] << 24);
+
+      if(seen && number == last) {
+        repeats++;
+
+        continue;
+      }
+
+      if(number != (seen ? last + 1 : 0)) {
+        gaps++;
+      }
+
+      seen = true;
+      last = number;
+      output.insert(output.end(), received + BOND_HEADER_BYTES, received + length);
+    }
+
+    now++;
+  }
+
+  bool intact = output == input;
+
+  printf("%zu bytes over 3 hops in %u ms: %.0f B/s, %s\n", total, now, total * 1000.0 / now, intact ? "in order, exactly once" : "MISMATCH");
+
+  report("R1", relay1);
+  report("R2", relay2);
+
+  printf("destination: %u repeats dropped, %u sequence gaps\n", repeats, gaps);
+
+  return intact ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/**
+ * Simulated optical channel for the host simulators: a linkChannel with
+ * its own rate, byte errors, lost verifications, per-frame overhead and a
+ * beam outage window. A frame whose verification is lost still arrives,
+ * so the sender repeats a frame the far end already has. A frame that
+ * arrives is verified once the far end takes it with receive(), so a
+ * receiver that stops taking frames holds the sender, and one that
+ * declines a frame gets it again.
+ *
+ * The simulators advance `now` (milliseconds) once per loop.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "linkBonding.class.h"
+#include "traceJson.h"
+
+static uint32_t now = 0;
+
+struct simFrame {
+  uint32_t arrives_at;
+  std::vector<uint8_t> data;
+};
+
+class simChannel : public linkChannel {
+  private: const char * label;
+  private: uint32_t bytes_per_second;
+  private: double byte_error_rate;
+  private: double verification_loss;
+  private: uint32_t overhead_ms;
+  private: uint32_t outage_start;
+  private: uint32_t outage_end;
+  private: std::mt19937 &random;
+
+  private: bool busy = false;
+  private: uint32_t done_at = 0;
+  private: uint8_t outcome = BOND_PENDING;
+  private: std::deque<simFrame> far_end;
+  private: bool taken = false;
+
+  private: traceJson * trace = NULL;
+  private: uint32_t track = 0;
+  private: uint32_t sent_at = 0;
+  private: uint32_t sequence = 0;
+  private: uint32_t length = 0;
+
+  public: simChannel(const char * label, uint32_t bytes_per_second, double byte_error_rate, double verification_loss,
+      uint32_t overhead_ms, uint32_t outage_start, uint32_t outage_end, std::mt19937 &random)
+    : label(label), bytes_per_second(bytes_per_second), byte_error_rate(byte_error_rate),
+      verification_loss(verification_loss), overhead_ms(overhead_ms),
+      outage_start(outage_start), outage_end(outage_end), random(random) {}
+
+  public: const char * name() {
+    return this->label;
+  }
+
+  public: void traceTo(traceJson * trace, uint32_t track) {
+    this->trace = trace;
+    this->track = track;
+  }
+
+  public: uint32_t rate() {
+    return this->bytes_per_second;
+  }
+
+  public: bool send(const uint8_t * frame, size_t length) {
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    if(this->busy) {
+      return false;
+    }
+
+    this->busy = true;
+    this->done_at = now + this->overhead_ms + (uint32_t) (length * 1000 / this->bytes_per_second);
+    this->sent_at = now;
+    this->sequence = frame[0] | (frame[1] << 8) | (frame[2] << 16) | ((uint32_t) frame[3] << 24);
+    this->length = (uint32_t) length;
+
+    // Beam blocked at any point of the transfer: nothing arrives, the verification times out
+    if(this->done_at >= this->outage_start && now < this->outage_end) {
+      this->outcome = BOND_FAILED;
+
+      return true;
+    }
+
+    if(chance(this->random) >= pow(1.0 - this->byte_error_rate, (double) length)) {
+      this->outcome = BOND_FAILED;
+
+      return true;
+    }
+
+    this->far_end.push_back(simFrame{this->done_at, std::vector<uint8_t>(frame, frame + length)});
+    this->taken = false;
+    this->outcome = chance(this->random) < this->verification_loss ? BOND_FAILED : BOND_VERIFIED;
+
+    return true;
+  }
+
+  public: uint8_t poll() {
+    if(!this->busy || (int32_t) (now - this->done_at) < 0 || !this->far_end.empty()) {
+      return BOND_PENDING;
+    }
+
+    this->busy = false;
+
+    if(this->trace != NULL) {
+      this->trace->event('X', 1, this->track, this->outcome == BOND_VERIFIED ? "verified" : "failed",
+        this->sent_at * 1000.0, (now - this->sent_at) * 1000.0, "sequence", this->sequence, "bytes", this->length);
+    }
+
+    return this->outcome;
+  }
+
+  public: size_t receive(uint8_t * frame) {
+    if(this->far_end.empty() || (int32_t) (now - this->far_end.front().arrives_at) < 0) {
+      return 0;
+    }
+
+    size_t length = this->far_end.front().data.size();
+
+    memcpy(frame, this->far_end.front().data.data(), length);
+    this->far_end.pop_front();
+    this->taken = true;
+
+    return length;
+  }
+
+  public: void decline() {
+    if(this->taken && this->busy) {
+      this->outcome = BOND_FAILED;
+    }
+  }
+
+};
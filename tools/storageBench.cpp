@@ -0,0 +1,52 @@
+/**
+ * Host run of the storage path benchmark (include/storageBench.class.h)
+ * against a memory-mapped image file, or a RAM image when no path is given.
+ * The image is sparse, so the full ring size costs only the touched pages.
+ *
+ * Build: g++ -std=gnu++11 -O2 -I tools/host -I include tools/storageBench.cpp -o storageBench
+ *        add -DPSRAM_TIER_BLOCKS=0 to measure the path without the RAM tier
+ * Usage: storageBench [--image PATH] [--blocks N]
+ */
+#include <Arduino.h>
+#include "includes.h"
+#include "definitions.h"
+#include "peripherals.h"
+#include "events.h"
+#include "blockDevice.class.h"
+#include "fileBlockDevice.class.h"
+#include "dataManager.class.h"
+#include "storageBench.class.h"
+
+HardwareSerial Serial(0);
+
+int main(int argc, char ** argv) {
+  const char * image = NULL;
+  uint32_t blocks = STORAGE_BENCH_BLOCKS;
+
+  for(int n=1; n+1<argc; n+=2) {
+    if(strcmp(argv[n], "--image") == 0) {
+      image = argv[n + 1];
+    } else if(strcmp(argv[n], "--blocks") == 0) {
+      blocks = (uint32_t) atol(argv[n + 1]);
+    }
+  }
+
+  if(blocks == 0 || blocks > BUFFER_MAX_SIZE_BLOCKS) {
+    fprintf(stderr, "blocks must be 1..%d\n", BUFFER_MAX_SIZE_BLOCKS);
+
+    return 2;
+  }
+
+  fileBlockDevice device(image, BUFFER_OUTGOING_START + BUFFER_MAX_SIZE_BLOCKS + 1);
+  dataManager dm;
+
+  if(!device.begin()) {
+    fprintf(stderr, "cannot map %s\n", image != NULL ? image : "RAM image");
+
+    return 1;
+  }
+
+  dm.initialize(device);
+
+  return storageBench(dm).run(blocks) ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+/**
+ * Chrome trace / Perfetto JSON writer for the host tools. Load the output in
+ * chrome://tracing or ui.perfetto.dev. Times are in microseconds; every
+ * process (unit) and thread (track) gets its own timeline row.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+class traceJson {
+  private: FILE * out = NULL;
+  private: bool first = true;
+
+  public: bool open(const char * path) {
+    this->out = fopen(path, "w");
+
+    if(this->out == NULL) {
+      return false;
+    }
+
+    fprintf(this->out, "{\"traceEvents\":[\n");
+
+    return true;
+  }
+
+  public: void close() {
+    if(this->out == NULL) {
+      return;
+    }
+
+    fprintf(this->out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(this->out);
+
+    this->out = NULL;
+  }
+
+  public: void processName(uint32_t pid, const char * name) {
+    this->separator();
+    fprintf(this->out, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%u,\"tid\":0,\"args\":{\"name\":\"%s\"}}", pid, name);
+  }
+
+  public: void threadName(uint32_t pid, uint32_t tid, const char * name) {
+    this->separator();
+    fprintf(this->out, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%u,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", pid, tid, name);
+  }
+
+  /**
+   * One event: ph is B (begin), E (end), i (instant) or X (complete, with
+   * duration). Arguments with a NULL name are left out.
+   */
+  public: void event(char ph, uint32_t pid, uint32_t tid, const char * name, double ts, double duration,
+      const char * a_name = NULL, uint32_t a = 0, const char * b_name = NULL, uint32_t b = 0) {
+    this->separator();
+    fprintf(this->out, "{\"ph\":\"%c\",\"name\":\"%s\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f", ph, name, pid, tid, ts);
+
+    if(ph == 'X') {
+      fprintf(this->out, ",\"dur\":%.3f", duration);
+    }
+
+    if(ph == 'i') {
+      fprintf(this->out, ",\"s\":\"t\"");
+    }
+
+    fprintf(this->out, ",\"args\":{");
+
+    if(a_name != NULL) {
+      fprintf(this->out, "\"%s\":%u", a_name, a);
+    }
+
+    if(b_name != NULL) {
+      fprintf(this->out, "%s\"%s\":%u", a_name != NULL ? "," : "", b_name, b);
+    }
+
+    fprintf(this->out, "}}");
+  }
+
+  private: void separator() {
+    if(!this->first) {
+      fprintf(this->out, ",\n");
+    }
+
+    this->first = false;
+  }
+};